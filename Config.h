@@ -11,3 +11,5 @@
 
 #define MAX_PATHS_COUNT 5
 #define MAX_CLIENTS_PER_PATH 5
+
+#define CLIENT_THREADS_COUNT 4
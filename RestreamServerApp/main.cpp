@@ -1,7 +1,27 @@
 #include "RestreamServerLib/Server.h"
 
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <glib-unix.h>
+
 #include <gst/gst.h>
 
+#include <CxxPtr/GlibPtr.h>
+
+#include "RestreamServerLib/ShardTable.h"
+
 #include "Config.h"
 
 extern "C" {
@@ -24,19 +44,731 @@ bool authenticationRequired(GstRTSPMethod method, const std::string& path, bool
     return true;
 }
 
+// path is appended to archive dir, so it shouldn't leave it
+bool isArchivablePath(const std::string& path)
+{
+    if(path.empty() || path[0] != '/')
+        return false;
+
+    std::string::size_type begin = 1;
+    while(begin <= path.size()) {
+        std::string::size_type end = path.find('/', begin);
+        if(end == std::string::npos)
+            end = path.size();
+
+        const std::string component = path.substr(begin, end - begin);
+        if(component == "." || component == "..")
+            return false;
+
+        begin = end + 1;
+    }
+
+    return true;
+}
+
+struct AppConfig
+{
+    // ports, media pool, memory, archive, hls, splash encoder and tracing are applied on start only
+    unsigned short staticPort = STATIC_SERVER_PORT;
+    unsigned short restreamPort = RESTREAM_SERVER_PORT;
+    RestreamServerLib::MediaPoolOptions mediaPool;
+    RestreamServerLib::MemoryOptions memory;
+    // recorded paths are archived to subdirectories of archiveDir if it's set
+    std::string archiveDir;
+    RestreamServerLib::ArchiveOptions archive;
+    RestreamServerLib::HlsOptions hls;
+    RestreamServerLib::H264EncoderType splashEncoder = RestreamServerLib::H264EncoderType::AUTO;
+    RestreamServerLib::TracingOptions tracing;
+    // Chrome trace of pipeline stages is written here on SIGUSR1
+    std::string traceFile;
+
+    RestreamServerLib::RuntimeOptions runtime;
+    RestreamServerLib::DrainOptions drain;
+
+    // worker processes sharing ports, applied on start only
+    unsigned workers = 1;
+    // worker N also listens on directPort + N
+    unsigned short directPort = RESTREAM_SERVER_PORT + 10;
+    // players are redirected to owning worker on this host if set,
+    // otherwise path is relayed from owning worker
+    std::string redirectHost;
+    unsigned shardPaths = 4096;
+};
+
+// parent process is worker 0
+unsigned forkWorkers(unsigned workers, std::vector<pid_t>* children)
+{
+    for(unsigned i = 1; i < workers; ++i) {
+        const pid_t pid = fork();
+        if(pid < 0) {
+            RestreamServerLib::Log()->error("Fail to start worker {}", i);
+            break;
+        }
+
+        if(0 == pid) {
+            // worker shouldn't outlive main process
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            children->clear();
+            return i;
+        }
+
+        children->push_back(pid);
+    }
+
+    return 0;
+}
+
+// passed to instance started by handOver
+const gchar* HANDOVER_FDS_ENV = "RESTREAM_HANDOVER_FDS";
+const gchar* HANDOVER_PID_ENV = "RESTREAM_HANDOVER_PID";
+
+// passed to worker started by spawnWorker, shard table is mapped from SHARD_TABLE_FD
+const gchar* WORKER_ENV = "RESTREAM_WORKER";
+const int SHARD_TABLE_FD = 5;
+// to not respawn worker crashing on start too often
+const guint WORKER_RESPAWN_DELAY_SEC = 1;
+// path owners changed by other workers are re-resolved this often
+const guint SHARD_REFRESH_PERIOD_MS = 500;
+
+// returns 0 if it's not worker started by spawnWorker
+unsigned respawnedWorker()
+{
+    const gchar* worker = g_getenv(WORKER_ENV);
+    const int index = worker ? atoi(worker) : 0;
+    g_unsetenv(WORKER_ENV);
+
+    return index > 0 ? static_cast<unsigned>(index) : 0;
+}
+
+// starts worker replacing exited one. Worker can't be just forked at this point,
+// since GStreamer threads are running already, so binary is started again
+GSubprocess* spawnWorker(
+    const gchar* const* argv,
+    unsigned worker,
+    int shardTableFd,
+    const RestreamServerLib::ListenOptions& inherited)
+{
+    GSubprocessLauncher* launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
+    g_subprocess_launcher_setenv(launcher, WORKER_ENV, std::to_string(worker).c_str(), TRUE);
+    g_subprocess_launcher_take_fd(launcher, dup(shardTableFd), SHARD_TABLE_FD);
+    if(inherited.staticFd >= 0 && inherited.restreamFd >= 0) {
+        // passed the same way as on handover
+        g_subprocess_launcher_setenv(launcher, HANDOVER_FDS_ENV, "2", TRUE);
+        g_subprocess_launcher_take_fd(launcher, dup(inherited.staticFd), 3);
+        g_subprocess_launcher_take_fd(launcher, dup(inherited.restreamFd), 4);
+    }
+    g_subprocess_launcher_set_child_setup(
+        launcher,
+        [] (gpointer) {
+            // worker shouldn't outlive main process
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+        },
+        nullptr, nullptr);
+
+    GError* error = nullptr;
+    GSubprocess* subprocess = g_subprocess_launcher_spawnv(launcher, argv, &error);
+    g_object_unref(launcher);
+
+    if(!subprocess) {
+        RestreamServerLib::Log()->error("Fail to respawn worker {}: {}", worker, error->message);
+        g_error_free(error);
+        return nullptr;
+    }
+
+    return subprocess;
+}
+
+// sd_notify() without libsystemd. Does nothing if not started by systemd
+void notifySystemd(const std::string& state)
+{
+    const gchar* socketPath = g_getenv("NOTIFY_SOCKET");
+    if(!socketPath || !socketPath[0])
+        return;
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    const size_t pathLength = strlen(socketPath);
+    if(pathLength >= sizeof(address.sun_path))
+        return;
+    memcpy(address.sun_path, socketPath, pathLength);
+    // abstract namespace
+    if('@' == address.sun_path[0])
+        address.sun_path[0] = '\0';
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return;
+
+    const socklen_t addressLength =
+        static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + pathLength);
+    if(sendto(fd, state.data(), state.size(), MSG_NOSIGNAL,
+              reinterpret_cast<const sockaddr*>(&address), addressLength) < 0)
+    {
+        RestreamServerLib::Log()->warn("Fail to notify systemd: {}", strerror(errno));
+    }
+
+    close(fd);
+}
+
+// sockets passed by systemd socket activation (static port socket first)
+// or by previous instance on handover
+RestreamServerLib::ListenOptions inheritedSockets()
+{
+    RestreamServerLib::ListenOptions sockets;
+
+    const int SD_LISTEN_FDS_START = 3;
+
+    const gchar* fds = g_getenv("LISTEN_FDS");
+    const gchar* pid = g_getenv("LISTEN_PID");
+    const gchar* handoverFds = g_getenv(HANDOVER_FDS_ENV);
+    if(fds && pid && atoi(fds) >= 2 && atol(pid) == getpid()) {
+        sockets.staticFd = SD_LISTEN_FDS_START;
+        sockets.restreamFd = SD_LISTEN_FDS_START + 1;
+    } else if(handoverFds && atoi(handoverFds) >= 2) {
+        sockets.staticFd = SD_LISTEN_FDS_START;
+        sockets.restreamFd = SD_LISTEN_FDS_START + 1;
+    }
+
+    // not for children (as sd_listen_fds does)
+    g_unsetenv("LISTEN_FDS");
+    g_unsetenv("LISTEN_PID");
+    g_unsetenv("LISTEN_FDNAMES");
+    g_unsetenv(HANDOVER_FDS_ENV);
+
+    return sockets;
+}
+
+// called once server is listening.
+// Instance started by handOver becomes main process of service
+// and asks previous instance to drain
+void notifyStarted()
+{
+    const gchar* previousPid = g_getenv(HANDOVER_PID_ENV);
+    const pid_t previous = previousPid ? static_cast<pid_t>(atol(previousPid)) : 0;
+    g_unsetenv(HANDOVER_PID_ENV);
+
+    if(previous > 0) {
+        notifySystemd(fmt::format("MAINPID={}\nREADY=1", getpid()));
+        // previous instance is not parent anymore if it's gone already
+        if(getppid() == previous)
+            kill(previous, SIGTERM);
+    } else
+        notifySystemd("READY=1");
+}
+
+// starts new instance of (possibly updated) binary taking over listening sockets.
+// New instance sends SIGTERM to this one (starting drain) as soon as it's listening
+bool handOver(const gchar* const* argv, const RestreamServerLib::ListenOptions& sockets)
+{
+    if(sockets.staticFd < 0 || sockets.restreamFd < 0)
+        return false;
+
+    GSubprocessLauncher* launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
+    g_subprocess_launcher_setenv(launcher, HANDOVER_FDS_ENV, "2", TRUE);
+    g_subprocess_launcher_setenv(
+        launcher, HANDOVER_PID_ENV, std::to_string(getpid()).c_str(), TRUE);
+    // launcher owns fds passed to it, and server keeps it's own ones
+    g_subprocess_launcher_take_fd(launcher, dup(sockets.staticFd), 3);
+    g_subprocess_launcher_take_fd(launcher, dup(sockets.restreamFd), 4);
+
+    GError* error = nullptr;
+    GSubprocess* subprocess = g_subprocess_launcher_spawnv(launcher, argv, &error);
+    g_object_unref(launcher);
+
+    if(!subprocess) {
+        RestreamServerLib::Log()->error("Fail to start new instance: {}", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    RestreamServerLib::Log()->info(
+        "New instance started. pid: {}",
+        g_subprocess_get_identifier(subprocess));
+    g_object_unref(subprocess);
+
+    return true;
+}
+
+// missing file or keys keep current values
+bool loadConfig(const gchar* path, AppConfig* config)
+{
+    GKeyFile* keyFile = g_key_file_new();
+
+    GError* error = nullptr;
+    if(!g_key_file_load_from_file(keyFile, path, G_KEY_FILE_NONE, &error)) {
+        const bool missing = g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+        if(missing) {
+            RestreamServerLib::Log()->info("Config \"{}\" not found, using defaults", path);
+        } else {
+            RestreamServerLib::Log()->error(
+                "Fail to load config \"{}\": {}",
+                path, error->message);
+        }
+        g_error_free(error);
+        g_key_file_free(keyFile);
+        return missing;
+    }
+
+    // invalid or out of range values are ignored (keeping current value)
+    auto readInteger =
+        [keyFile] (const gchar* group, const gchar* key, guint64 max, guint64* value) -> bool {
+            if(!g_key_file_has_key(keyFile, group, key, nullptr))
+                return false;
+
+            GError* error = nullptr;
+            const gint64 integer = g_key_file_get_int64(keyFile, group, key, &error);
+            if(error) {
+                RestreamServerLib::Log()->error(
+                    "Invalid config value ignored. key: {}.{}, error: {}",
+                    group, key, error->message);
+                g_error_free(error);
+                return false;
+            }
+
+            if(integer < 0 || static_cast<guint64>(integer) > max) {
+                RestreamServerLib::Log()->error(
+                    "Out of range config value ignored. key: {}.{}, value: {}, max: {}",
+                    group, key, integer, max);
+                return false;
+            }
+
+            *value = static_cast<guint64>(integer);
+            return true;
+        };
+    auto readUInt =
+        [&readInteger] (const gchar* group, const gchar* key, unsigned* value) {
+            guint64 integer;
+            if(readInteger(group, key, G_MAXUINT, &integer))
+                *value = static_cast<unsigned>(integer);
+        };
+    auto readSize =
+        [&readInteger] (const gchar* group, const gchar* key, size_t* value) {
+            guint64 integer;
+            if(readInteger(group, key, G_MAXSIZE, &integer))
+                *value = static_cast<size_t>(integer);
+        };
+    auto readPort =
+        [&readInteger] (const gchar* group, const gchar* key, unsigned short* value) {
+            guint64 integer;
+            if(readInteger(group, key, G_MAXUINT16, &integer))
+                *value = static_cast<unsigned short>(integer);
+        };
+
+    readPort("server", "static-port", &config->staticPort);
+    readPort("server", "restream-port", &config->restreamPort);
+    readUInt("media", "linger-ms", &config->mediaPool.lingerMs);
+    readUInt("media", "prebuilt-per-description", &config->mediaPool.prebuiltPerDescription);
+    readUInt("media", "prebuilt-descriptions", &config->mediaPool.prebuiltDescriptions);
+    if(gchar** paths = g_key_file_get_string_list(keyFile, "media", "preregister", nullptr, nullptr)) {
+        config->mediaPool.preregisteredPaths.assign(paths, paths + g_strv_length(paths));
+        g_strfreev(paths);
+    }
+    readUInt("memory", "pool-buffers", &config->memory.poolBuffers);
+    readSize("memory", "pool-buffer-bytes", &config->memory.poolBufferBytes);
+    if(g_key_file_has_key(keyFile, "memory", "selector-cache", nullptr)) {
+        config->memory.selectorCacheBuffers =
+            g_key_file_get_boolean(keyFile, "memory", "selector-cache", nullptr);
+    }
+    readUInt("memory", "trim-interval-sec", &config->memory.trimIntervalSec);
+    readUInt("archive", "segment-sec", &config->archive.segmentDurationSec);
+    readUInt("archive", "max-queue-ms", &config->archive.maxQueueMs);
+    if(gchar* dir = g_key_file_get_string(keyFile, "archive", "dir", nullptr)) {
+        config->archiveDir = dir;
+        g_free(dir);
+    }
+    if(gchar* format = g_key_file_get_string(keyFile, "archive", "format", nullptr)) {
+        config->archive.format =
+            0 == g_strcmp0(format, "mp4") ?
+                RestreamServerLib::ArchiveFormat::FRAGMENTED_MP4 :
+                RestreamServerLib::ArchiveFormat::MPEG_TS;
+        g_free(format);
+    }
+    if(gchar* encoder = g_key_file_get_string(keyFile, "splash", "encoder", nullptr)) {
+        const std::pair<const char*, RestreamServerLib::H264EncoderType> encoders[] = {
+            { "x264", RestreamServerLib::H264EncoderType::X264 },
+            { "vaapi", RestreamServerLib::H264EncoderType::VAAPI },
+            { "nvenc", RestreamServerLib::H264EncoderType::NVENC },
+            { "v4l2", RestreamServerLib::H264EncoderType::V4L2 },
+        };
+        config->splashEncoder = RestreamServerLib::H264EncoderType::AUTO;
+        for(const auto& pair: encoders) {
+            if(0 == g_strcmp0(encoder, pair.first))
+                config->splashEncoder = pair.second;
+        }
+        g_free(encoder);
+    }
+    if(g_key_file_has_key(keyFile, "tracing", "enabled", nullptr))
+        config->tracing.enabled = g_key_file_get_boolean(keyFile, "tracing", "enabled", nullptr);
+    readUInt("tracing", "max-events", &config->tracing.maxEvents);
+    if(gchar* file = g_key_file_get_string(keyFile, "tracing", "file", nullptr)) {
+        config->traceFile = file;
+        g_free(file);
+    }
+    readPort("hls", "port", &config->hls.port);
+    readUInt("hls", "segments", &config->hls.segmentsCount);
+    readUInt("hls", "min-segment-ms", &config->hls.minSegmentMs);
+    readUInt("server", "max-paths", &config->runtime.maxPathsCount);
+    readUInt("server", "max-clients-per-path", &config->runtime.maxClientsPerPath);
+    readUInt("source", "timeout-ms", &config->runtime.source.timeoutMs);
+    readUInt("source", "check-period-ms", &config->runtime.source.checkPeriodMs);
+    readUInt("bandwidth", "egress-budget-kbps", &config->runtime.bandwidth.egressBudgetKbps);
+    readUInt("bandwidth", "ingress-budget-kbps", &config->runtime.bandwidth.ingressBudgetKbps);
+    readUInt("bandwidth", "default-record-kbps", &config->runtime.bandwidth.defaultRecordKbps);
+    readUInt("transport", "tcp-queue-latency-ms", &config->runtime.transport.tcpQueueLatencyMs);
+    readSize("transport", "tcp-queue-bytes", &config->runtime.transport.tcpQueueBytes);
+    if(gchar* url = g_key_file_get_string(keyFile, "drain", "redirect-url", nullptr)) {
+        config->drain.redirectUrl = url;
+        g_free(url);
+    }
+    readUInt("drain", "players-grace-ms", &config->drain.playersGraceMs);
+    readUInt("drain", "timeout-ms", &config->drain.timeoutMs);
+    readUInt("shard", "workers", &config->workers);
+    readPort("shard", "direct-port", &config->directPort);
+    readUInt("shard", "paths", &config->shardPaths);
+    if(gchar* host = g_key_file_get_string(keyFile, "shard", "redirect-host", nullptr)) {
+        config->redirectHost = host;
+        g_free(host);
+    }
+    if(g_key_file_has_key(keyFile, "transport", "batch-udp", nullptr)) {
+        config->runtime.transport.batchUdp =
+            g_key_file_get_boolean(keyFile, "transport", "batch-udp", nullptr);
+    }
+
+    g_key_file_free(keyFile);
+
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
+    // optional config file, reloaded on SIGHUP
+    const gchar* configPath = argc > 1 ? argv[1] : nullptr;
+
+    // binary could be replaced on disk before handover
+    GCharPtr programPath(g_find_program_in_path(argv[0]));
+    std::vector<const gchar*> programArgv(argv, argv + argc);
+    if(programPath)
+        programArgv[0] = programPath.get();
+    programArgv.push_back(nullptr);
+
+    AppConfig config;
+    config.runtime.maxPathsCount = MAX_PATHS_COUNT;
+    config.runtime.maxClientsPerPath = MAX_CLIENTS_PER_PATH;
+    if(configPath && !loadConfig(configPath, &config))
+        return 1;
+
+    // should be created before fork to be shared by workers
+    std::unique_ptr<RestreamServerLib::ShardTable> shardTable;
+    const unsigned respawned = respawnedWorker();
+    if(respawned > 0) {
+        shardTable = RestreamServerLib::ShardTable::Inherit(SHARD_TABLE_FD);
+        if(!shardTable)
+            return 1;
+    } else if(config.workers > 1) {
+        shardTable.reset(new RestreamServerLib::ShardTable(config.shardPaths));
+        if(!shardTable->valid())
+            return 1;
+    }
+
+    // before fork, so all workers accept on inherited sockets
+    const RestreamServerLib::ListenOptions inherited = inheritedSockets();
+
+    std::vector<pid_t> workers;
+    const unsigned worker =
+        respawned > 0 ? respawned :
+        shardTable ? forkWorkers(config.workers, &workers) :
+        0;
+
+    // after fork, since GStreamer could start threads
     gst_init(0, nullptr);
 
     GST_PLUGIN_STATIC_REGISTER(interpipe);
 
     RestreamServerLib::Callbacks callbacks;
     callbacks.authenticationRequired = authenticationRequired;
+    // HLS has no authentication, so only public paths are served
+    callbacks.hls =
+        [] (const std::string& path) {
+            return !authenticationRequired(GST_RTSP_PLAY, path, false);
+        };
+    if(!config.archiveDir.empty()) {
+        const std::string archiveDir = config.archiveDir;
+        callbacks.archive =
+            [archiveDir] (const std::string& path) {
+                if(!isArchivablePath(path)) {
+                    RestreamServerLib::Log()->warn("Path is not archived. path: {}", path);
+                    return std::string();
+                }
+
+                return archiveDir + path;
+            };
+    }
+
+    RestreamServerLib::Options options;
+    options.threadPool.maxThreads = CLIENT_THREADS_COUNT;
+    options.splash.mode = RestreamServerLib::SplashMode::INTERPIPE;
+    options.splash.cached = true;
+    options.splash.encoder = config.splashEncoder;
+    options.gopCache.enabled = true;
+    options.source = config.runtime.source;
+    options.transport = config.runtime.transport;
+    options.bandwidth = config.runtime.bandwidth;
+    options.mediaPool = config.mediaPool;
+    options.memory = config.memory;
+    options.archive = config.archive;
+    options.hls = config.hls;
+    options.listen = inherited;
+    options.tracing = config.tracing;
+
+    if(shardTable) {
+        RestreamServerLib::ShardTable* table = shardTable.get();
+        const unsigned short directPort = config.directPort;
+        const std::string host =
+            config.redirectHost.empty() ? std::string("127.0.0.1") : config.redirectHost;
+
+        callbacks.recorderConnected =
+            [table, worker] (const std::string& /*user*/, const std::string& path) {
+                table->setOwner(path, worker);
+            };
+        callbacks.recorderDisconnected =
+            [table, worker] (const std::string& path) {
+                table->resetOwner(path, worker);
+            };
+        callbacks.pathOwner =
+            [table, worker, directPort, host] (const std::string& path) {
+                const int owner = table->owner(path);
+                if(owner < 0 || static_cast<unsigned>(owner) == worker)
+                    return std::string();
+
+                return fmt::format("rtsp://{}:{}", host, directPort + owner);
+            };
+
+        options.cluster.mode =
+            config.redirectHost.empty() ?
+                RestreamServerLib::ClusterMode::RELAY :
+                RestreamServerLib::ClusterMode::REDIRECT;
+        options.listen.reusePort = true;
+        options.listen.directPort = directPort + worker;
+        // HLS port can't be shared, so only paths recorded to first worker are served
+        if(worker > 0)
+            options.hls.port = 0;
+
+        RestreamServerLib::Log()->info("Worker {} started. pid: {}", worker, getpid());
+    }
 
     RestreamServerLib::Server restreamServer(
         callbacks,
-        STATIC_SERVER_PORT, RESTREAM_SERVER_PORT, false,
-        MAX_PATHS_COUNT, MAX_CLIENTS_PER_PATH);
+        config.staticPort, config.restreamPort, false,
+        config.runtime.maxPathsCount, config.runtime.maxClientsPerPath,
+        options);
+
+    struct ReloadContext
+    {
+        const gchar* configPath;
+        const gchar* const* argv;
+        AppConfig config;
+        RestreamServerLib::Server* server;
+        // worker N pid is at N - 1, 0 if it's not running.
+        // reloaded together with main process
+        std::vector<pid_t> workers;
+        RestreamServerLib::ShardTable* shardTable;
+        RestreamServerLib::ListenOptions inherited;
+        // exited workers are not respawned on stop
+        bool draining;
+
+        struct WorkerData
+        {
+            ReloadContext* context;
+            unsigned worker;
+        };
+
+        // paths owned by exited worker are released,
+        // and crashed worker is respawned
+        void workerExited(unsigned worker, bool crashed)
+        {
+            RestreamServerLib::Log()->warn(
+                "Worker {} exited. pid: {}, crashed: {}",
+                worker, workers[worker - 1], crashed);
+            workers[worker - 1] = 0;
+            shardTable->resetWorker(worker);
+
+            if(!crashed || draining)
+                return;
+
+            g_timeout_add_seconds_full(
+                G_PRIORITY_DEFAULT,
+                WORKER_RESPAWN_DELAY_SEC,
+                [] (gpointer userData) -> gboolean {
+                    const WorkerData* data = static_cast<const WorkerData*>(userData);
+                    data->context->respawnWorker(data->worker);
+                    return G_SOURCE_REMOVE;
+                },
+                new WorkerData { this, worker },
+                [] (gpointer userData) {
+                    delete static_cast<WorkerData*>(userData);
+                });
+        }
+
+        void respawnWorker(unsigned worker)
+        {
+            if(draining)
+                return;
+
+            GSubprocess* subprocess = spawnWorker(argv, worker, shardTable->fd(), inherited);
+            if(!subprocess)
+                return;
+
+            workers[worker - 1] = static_cast<pid_t>(atol(g_subprocess_get_identifier(subprocess)));
+            RestreamServerLib::Log()->info(
+                "Worker {} respawned. pid: {}",
+                worker, workers[worker - 1]);
+
+            g_subprocess_wait_async(
+                subprocess, nullptr,
+                [] (GObject* source, GAsyncResult* result, gpointer userData) {
+                    const WorkerData* data = static_cast<const WorkerData*>(userData);
+                    GSubprocess* subprocess = G_SUBPROCESS(source);
+
+                    const bool exited = g_subprocess_wait_finish(subprocess, result, nullptr);
+                    data->context->workerExited(
+                        data->worker,
+                        exited && !g_subprocess_get_successful(subprocess));
+
+                    delete data;
+                    g_object_unref(subprocess);
+                },
+                new WorkerData { this, worker });
+        }
+    } reloadContext {
+        configPath, programArgv.data(), config, &restreamServer, workers,
+        shardTable.get(), inherited, false };
+
+    for(unsigned i = 0; i < workers.size(); ++i) {
+        g_child_watch_add(
+            workers[i],
+            [] (GPid pid, gint status, gpointer userData) {
+                ReloadContext::WorkerData* data = static_cast<ReloadContext::WorkerData*>(userData);
+                g_spawn_close_pid(pid);
+
+                const bool crashed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+                data->context->workerExited(data->worker, crashed);
+
+                delete data;
+            },
+            new ReloadContext::WorkerData { &reloadContext, i + 1 });
+    }
+
+    // relayed paths mounted before owner was known (or before owner changed)
+    // are refreshed when any worker changes shard table
+    struct ShardRefreshContext
+    {
+        RestreamServerLib::ShardTable* shardTable;
+        RestreamServerLib::Server* server;
+        uint64_t generation;
+    } shardRefreshContext {
+        shardTable.get(), &restreamServer,
+        shardTable ? shardTable->generation() : 0 };
+    if(shardTable && config.redirectHost.empty()) {
+        g_timeout_add(
+            SHARD_REFRESH_PERIOD_MS,
+            [] (gpointer userData) -> gboolean {
+                ShardRefreshContext* context = static_cast<ShardRefreshContext*>(userData);
+                const uint64_t generation = context->shardTable->generation();
+                if(generation != context->generation) {
+                    context->generation = generation;
+                    context->server->refreshPaths();
+                }
+
+                return G_SOURCE_CONTINUE;
+            },
+            &shardRefreshContext);
+    }
+
+    // graceful stop (systemctl stop/restart)
+    auto drainCallback =
+        [] (gpointer userData) -> gboolean {
+            ReloadContext* context = static_cast<ReloadContext*>(userData);
+            context->draining = true;
+            context->server->drain(context->config.drain);
+
+            return G_SOURCE_CONTINUE;
+        };
+    g_unix_signal_add(SIGTERM, drainCallback, &reloadContext);
+    g_unix_signal_add(SIGINT, drainCallback, &reloadContext);
+
+    g_unix_signal_add(
+        SIGUSR1,
+        [] (gpointer userData) -> gboolean {
+            ReloadContext* context = static_cast<ReloadContext*>(userData);
+            if(context->config.traceFile.empty())
+                return G_SOURCE_CONTINUE;
+
+            const std::string trace = context->server->chromeTrace();
+            GError* error = nullptr;
+            if(!g_file_set_contents(
+                context->config.traceFile.c_str(), trace.data(), trace.size(), &error))
+            {
+                RestreamServerLib::Log()->error("Fail to write trace: {}", error->message);
+                g_error_free(error);
+            } else
+                RestreamServerLib::Log()->info("Trace written to {}", context->config.traceFile);
+
+            return G_SOURCE_CONTINUE;
+        },
+        &reloadContext);
+
+    // zero downtime restart: new instance accepts while this one drains
+    g_unix_signal_add(
+        SIGUSR2,
+        [] (gpointer userData) -> gboolean {
+            ReloadContext* context = static_cast<ReloadContext*>(userData);
+            if(context->config.workers > 1)
+                RestreamServerLib::Log()->warn("Handover is not supported with several workers");
+            else
+                handOver(context->argv, context->server->listenSockets());
+
+            return G_SOURCE_CONTINUE;
+        },
+        &reloadContext);
+
+    if(configPath) {
+        // called from server's main loop
+        g_unix_signal_add(
+            SIGHUP,
+            [] (gpointer userData) -> gboolean {
+                ReloadContext* context = static_cast<ReloadContext*>(userData);
+
+                for(pid_t pid: context->workers) {
+                    if(pid > 0)
+                        kill(pid, SIGHUP);
+                }
+
+                AppConfig config = context->config;
+                if(loadConfig(context->configPath, &config)) {
+                    if(config.staticPort != context->config.staticPort ||
+                       config.restreamPort != context->config.restreamPort)
+                    {
+                        RestreamServerLib::Log()->warn("Ports change requires restart");
+                    }
+
+                    context->server->reconfigure(config.runtime);
+                    context->config = config;
+                }
+
+                return G_SOURCE_CONTINUE;
+            },
+            &reloadContext);
+    }
+
+    // workers are children of main process, so only it talks to systemd
+    if(0 == worker) {
+        g_idle_add(
+            [] (gpointer) -> gboolean {
+                notifyStarted();
+                return G_SOURCE_REMOVE;
+            },
+            nullptr);
+    }
 
     restreamServer.serverMain();
 
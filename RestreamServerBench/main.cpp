@@ -0,0 +1,711 @@
+#include "RestreamServerLib/Server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GstPtr.h>
+
+extern "C" {
+GST_PLUGIN_STATIC_DECLARE(interpipe);
+}
+
+// Starts RestreamServerLib::Server in-process,
+// connects recorders and players to it and prints results as JSON to stdout.
+//
+// Glass-to-glass latency is measured with timecode drawn as row of
+// black/white 16x16 blocks into raw frames before encoder
+// and read back from decoded frames on player side.
+
+namespace
+{
+
+const unsigned FRAME_WIDTH = 640;
+const unsigned FRAME_HEIGHT = 360;
+
+// 2 sync blocks + 38 bits of monotonic time (us) = 640 pixels
+const unsigned TIMECODE_BLOCK = 16;
+const unsigned TIMECODE_SYNC_BITS = 2;
+const unsigned TIMECODE_BITS = 38;
+const guint64 TIMECODE_MASK = (G_GUINT64_CONSTANT(1) << TIMECODE_BITS) - 1;
+
+// latency above is considered as misread timecode
+const gint64 MAX_LATENCY_US = 10 * G_USEC_PER_SEC;
+
+struct BenchOptions
+{
+    gint recorders = 1;
+    gint playersPerRecorder = 4;
+    // players decoding video to measure latency, per path
+    gint decodersPerPath = 1;
+    gint durationSec = 10;
+    gint threads = 4;
+    gint port = 18000;
+    gboolean tcp = FALSE;
+    gboolean relay = FALSE;
+    gboolean batchUdp = FALSE;
+    gboolean gopCache = FALSE;
+    // reconnect all recorders at once after measurement
+    gboolean storm = FALSE;
+    gboolean preregister = FALSE;
+};
+
+struct Recorder
+{
+    GstElement* pipeline = nullptr;
+    gint64 startTime = 0;
+    std::atomic<gint64> playingTime { 0 };
+};
+
+struct RecordersSetup
+{
+    unsigned failed = 0;
+    gint64 totalUs = 0;
+    // sorted
+    std::vector<gint64> setupUs;
+};
+
+struct Player
+{
+    bool decoding = false;
+    GstElement* pipeline = nullptr;
+    gint64 startTime = 0;
+    std::atomic<gint64> firstFrameTime { 0 };
+};
+
+struct Stats
+{
+    std::mutex mutex;
+    std::vector<gint64> latenciesUs;
+    guint64 misreadTimecodes = 0;
+};
+
+gint64 Now()
+{
+    return g_get_monotonic_time();
+}
+
+long RssKb()
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(!statm)
+        return 0;
+
+    long size = 0, resident = 0;
+    if(2 != fscanf(statm, "%ld %ld", &size, &resident))
+        resident = 0;
+    fclose(statm);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double CpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return
+        usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+gint64 Percentile(const std::vector<gint64>& sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+
+    const size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+GstElement* ParsePipeline(const std::string& description)
+{
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(description.c_str(), &error);
+    GErrorPtr errorPtr(error);
+
+    if(errorPtr) {
+        RestreamServerLib::Log()->critical(
+            "Fail to create bench pipeline: {}",
+            errorPtr->message);
+    }
+
+    return pipeline;
+}
+
+GstPadProbeReturn
+DrawTimecode(GstPad* pad, GstPadProbeInfo* info, gpointer)
+{
+    GstCaps* caps = gst_pad_get_current_caps(pad);
+    if(!caps)
+        return GST_PAD_PROBE_OK;
+
+    GstVideoInfo videoInfo;
+    const bool infoValid = gst_video_info_from_caps(&videoInfo, caps);
+    gst_caps_unref(caps);
+    if(!infoValid || GST_VIDEO_INFO_WIDTH(&videoInfo) < (TIMECODE_SYNC_BITS + TIMECODE_BITS) * TIMECODE_BLOCK)
+        return GST_PAD_PROBE_OK;
+
+    GstBuffer* buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    GstVideoFrame frame;
+    if(!gst_video_frame_map(&frame, &videoInfo, buffer, GST_MAP_WRITE))
+        return GST_PAD_PROBE_OK;
+
+    const guint64 timecode = static_cast<guint64>(Now()) & TIMECODE_MASK;
+
+    guint8* luma = static_cast<guint8*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 0));
+    const gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+    for(unsigned block = 0; block < TIMECODE_SYNC_BITS + TIMECODE_BITS; ++block) {
+        bool bit;
+        if(block < TIMECODE_SYNC_BITS)
+            bit = (0 == block); // sync: 1, 0
+        else
+            bit = (timecode >> (block - TIMECODE_SYNC_BITS)) & 1;
+
+        for(unsigned y = 0; y < TIMECODE_BLOCK; ++y)
+            memset(luma + y * stride + block * TIMECODE_BLOCK, bit ? 235 : 16, TIMECODE_BLOCK);
+    }
+
+    gst_video_frame_unmap(&frame);
+
+    return GST_PAD_PROBE_OK;
+}
+
+// returns false if frame doesn't contain timecode (splash screen f.e.)
+bool ReadTimecode(GstSample* sample, guint64* timecode)
+{
+    GstVideoInfo videoInfo;
+    if(!gst_video_info_from_caps(&videoInfo, gst_sample_get_caps(sample)))
+        return false;
+    if(GST_VIDEO_INFO_WIDTH(&videoInfo) < (TIMECODE_SYNC_BITS + TIMECODE_BITS) * TIMECODE_BLOCK)
+        return false;
+
+    GstVideoFrame frame;
+    if(!gst_video_frame_map(&frame, &videoInfo, gst_sample_get_buffer(sample), GST_MAP_READ))
+        return false;
+
+    const guint8* luma = static_cast<const guint8*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 0));
+    const gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+    auto readBit =
+        [luma, stride] (unsigned block) {
+            const unsigned center = TIMECODE_BLOCK / 2;
+            return luma[center * stride + block * TIMECODE_BLOCK + center] > 128;
+        };
+
+    bool valid = readBit(0) && !readBit(1);
+
+    *timecode = 0;
+    for(unsigned bit = 0; valid && bit < TIMECODE_BITS; ++bit) {
+        if(readBit(TIMECODE_SYNC_BITS + bit))
+            *timecode |= G_GUINT64_CONSTANT(1) << bit;
+    }
+
+    gst_video_frame_unmap(&frame);
+
+    return valid;
+}
+
+void StartRecorder(const BenchOptions& options, unsigned index, Recorder* recorder)
+{
+    GstElement* pipeline =
+        ParsePipeline(
+            fmt::format(
+                "videotestsrc is-live=true pattern=ball ! "
+                "video/x-raw,format=I420,width={},height={},framerate=30/1 ! "
+                "x264enc name=encoder tune=zerolatency speed-preset=ultrafast key-int-max=30 bitrate=2000 ! "
+                "video/x-h264,profile=baseline ! "
+                "rtspclientsink latency=0 protocols={} location=rtsp://127.0.0.1:{}/bench{}?record",
+                FRAME_WIDTH, FRAME_HEIGHT,
+                options.tcp ? "tcp" : "udp",
+                options.port + 1, index));
+    if(!pipeline)
+        return;
+
+    GstElementPtr encoderPtr(gst_bin_get_by_name(GST_BIN(pipeline), "encoder"));
+    GstPadPtr sinkPadPtr(gst_element_get_static_pad(encoderPtr.get(), "sink"));
+    gst_pad_add_probe(sinkPadPtr.get(), GST_PAD_PROBE_TYPE_BUFFER, DrawTimecode, nullptr, nullptr);
+
+    // rtspclientsink reaches PLAYING after RECORD is replied
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(
+        bus,
+        [] (GstBus*, GstMessage* message, gpointer userData) -> GstBusSyncReply {
+            Recorder* recorder = static_cast<Recorder*>(userData);
+            if(GST_MESSAGE_STATE_CHANGED == GST_MESSAGE_TYPE(message) &&
+               GST_MESSAGE_SRC(message) == GST_OBJECT(recorder->pipeline))
+            {
+                GstState newState;
+                gst_message_parse_state_changed(message, nullptr, &newState, nullptr);
+
+                gint64 expected = 0;
+                if(GST_STATE_PLAYING == newState)
+                    recorder->playingTime.compare_exchange_strong(expected, Now());
+            }
+
+            return GST_BUS_PASS;
+        },
+        recorder, nullptr);
+    gst_object_unref(bus);
+
+    recorder->pipeline = pipeline;
+    recorder->startTime = Now();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+}
+
+// starts all recorders at once and waits until every one is recording
+RecordersSetup ConnectRecorders(
+    const BenchOptions& options,
+    std::vector<std::unique_ptr<Recorder>>* recorders)
+{
+    const gint64 startTime = Now();
+    for(gint i = 0; i < options.recorders; ++i) {
+        recorders->emplace_back(new Recorder);
+        StartRecorder(options, i, recorders->back().get());
+    }
+
+    const gint64 deadline = startTime + 10 * G_USEC_PER_SEC;
+    auto allRecording =
+        [recorders] () {
+            return std::all_of(recorders->begin(), recorders->end(),
+                [] (const std::unique_ptr<Recorder>& recorder) {
+                    return !recorder->pipeline || recorder->playingTime.load() != 0;
+                });
+        };
+    while(!allRecording() && Now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    RecordersSetup setup;
+    gint64 lastPlayingTime = startTime;
+    for(const std::unique_ptr<Recorder>& recorder: *recorders) {
+        const gint64 playingTime = recorder->playingTime.load();
+        if(!playingTime) {
+            ++setup.failed;
+            continue;
+        }
+
+        setup.setupUs.push_back(playingTime - recorder->startTime);
+        lastPlayingTime = std::max(lastPlayingTime, playingTime);
+    }
+    std::sort(setup.setupUs.begin(), setup.setupUs.end());
+    setup.totalUs = lastPlayingTime - startTime;
+
+    return setup;
+}
+
+void StopRecorders(std::vector<std::unique_ptr<Recorder>>* recorders)
+{
+    for(const std::unique_ptr<Recorder>& recorder: *recorders) {
+        if(recorder->pipeline) {
+            gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+            gst_object_unref(recorder->pipeline);
+        }
+    }
+    recorders->clear();
+}
+
+void StartPlayer(const BenchOptions& options, unsigned path, Player* player, Stats* stats)
+{
+    const std::string source =
+        fmt::format(
+            "rtspsrc latency=0 protocols={} location=rtsp://127.0.0.1:{}/bench{} ! rtph264depay ! ",
+            options.tcp ? "tcp" : "udp",
+            options.port + 1, path);
+
+    if(player->decoding) {
+        player->pipeline =
+            ParsePipeline(
+                source +
+                "avdec_h264 ! videoconvert ! video/x-raw,format=I420 ! "
+                "appsink name=sink sync=false max-buffers=1 drop=true");
+    } else {
+        player->pipeline = ParsePipeline(source + "fakesink name=sink sync=false");
+    }
+    if(!player->pipeline)
+        return;
+
+    GstElementPtr sinkPtr(gst_bin_get_by_name(GST_BIN(player->pipeline), "sink"));
+
+    if(player->decoding) {
+        struct Context
+        {
+            Player* player;
+            Stats* stats;
+        };
+
+        GstAppSinkCallbacks callbacks = {};
+        callbacks.new_sample =
+            [] (GstAppSink* appSink, gpointer userData) -> GstFlowReturn {
+                const Context* context = static_cast<const Context*>(userData);
+
+                GstSample* sample = gst_app_sink_pull_sample(appSink);
+                if(!sample)
+                    return GST_FLOW_OK;
+
+                const gint64 now = Now();
+
+                gint64 expected = 0;
+                context->player->firstFrameTime.compare_exchange_strong(expected, now);
+
+                guint64 timecode = 0;
+                if(ReadTimecode(sample, &timecode)) {
+                    const gint64 latency =
+                        static_cast<gint64>((static_cast<guint64>(now) - timecode) & TIMECODE_MASK);
+
+                    std::lock_guard<std::mutex> lock(context->stats->mutex);
+                    if(latency < MAX_LATENCY_US)
+                        context->stats->latenciesUs.push_back(latency);
+                    else
+                        ++context->stats->misreadTimecodes;
+                }
+
+                gst_sample_unref(sample);
+
+                return GST_FLOW_OK;
+            };
+
+        gst_app_sink_set_callbacks(
+            GST_APP_SINK(sinkPtr.get()),
+            &callbacks,
+            new Context { player, stats },
+            [] (gpointer userData) {
+                delete static_cast<Context*>(userData);
+            });
+    } else {
+        GstPadPtr sinkPadPtr(gst_element_get_static_pad(sinkPtr.get(), "sink"));
+        gst_pad_add_probe(
+            sinkPadPtr.get(),
+            GST_PAD_PROBE_TYPE_BUFFER,
+            [] (GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer userData) -> GstPadProbeReturn {
+                Player* player = static_cast<Player*>(userData);
+
+                gint64 expected = 0;
+                player->firstFrameTime.compare_exchange_strong(expected, Now());
+
+                return GST_PAD_PROBE_REMOVE;
+            },
+            player, nullptr);
+    }
+
+    player->startTime = Now();
+    gst_element_set_state(player->pipeline, GST_STATE_PLAYING);
+}
+
+unsigned CountErrors(GstElement* pipeline)
+{
+    if(!pipeline)
+        return 1;
+
+    unsigned errors = 0;
+
+    GstBus* bus = gst_element_get_bus(pipeline);
+    while(GstMessage* message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR)) {
+        ++errors;
+        gst_message_unref(message);
+    }
+    gst_object_unref(bus);
+
+    return errors;
+}
+
+bool WaitServer(unsigned short port)
+{
+    GSocketClient* client = g_socket_client_new();
+
+    bool ready = false;
+    for(unsigned i = 0; i < 100 && !ready; ++i) {
+        GSocketConnection* connection =
+            g_socket_client_connect_to_host(client, "127.0.0.1", port, nullptr, nullptr);
+        if(connection) {
+            ready = true;
+            g_object_unref(connection);
+        } else
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    g_object_unref(client);
+
+    return ready;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+
+    GOptionEntry entries[] = {
+        { "recorders", 'r', 0, G_OPTION_ARG_INT, &options.recorders, "Recorders (paths) count", "N" },
+        { "players", 'p', 0, G_OPTION_ARG_INT, &options.playersPerRecorder, "Players per recorder", "M" },
+        { "decoders", 0, 0, G_OPTION_ARG_INT, &options.decodersPerPath,
+            "Players per path decoding video to measure latency", "K" },
+        { "duration", 'd', 0, G_OPTION_ARG_INT, &options.durationSec, "Measurement duration", "SEC" },
+        { "threads", 't', 0, G_OPTION_ARG_INT, &options.threads, "Server client threads", "N" },
+        { "port", 0, 0, G_OPTION_ARG_INT, &options.port,
+            "Server static port (restream port is next one)", "PORT" },
+        { "tcp", 0, 0, G_OPTION_ARG_NONE, &options.tcp, "Use RTP over RTSP", nullptr },
+        { "relay", 0, 0, G_OPTION_ARG_NONE, &options.relay, "Relay paths on RTP level", nullptr },
+        { "batch-udp", 0, 0, G_OPTION_ARG_NONE, &options.batchUdp, "Batch UDP send", nullptr },
+        { "gop-cache", 0, 0, G_OPTION_ARG_NONE, &options.gopCache, "Enable GOP cache", nullptr },
+        { "storm", 0, 0, G_OPTION_ARG_NONE, &options.storm,
+            "Reconnect all recorders at once after measurement", nullptr },
+        { "preregister", 0, 0, G_OPTION_ARG_NONE, &options.preregister,
+            "Preregister recorders paths on server start", nullptr },
+        { nullptr }
+    };
+
+    GOptionContext* optionContext = g_option_context_new("- RestreamServer benchmark");
+    g_option_context_add_main_entries(optionContext, entries, nullptr);
+    g_option_context_add_group(optionContext, gst_init_get_option_group());
+
+    GError* error = nullptr;
+    const bool parsed = g_option_context_parse(optionContext, &argc, &argv, &error);
+    GErrorPtr errorPtr(error);
+    g_option_context_free(optionContext);
+    if(!parsed) {
+        fprintf(stderr, "%s\n", errorPtr ? errorPtr->message : "Invalid options");
+        return 1;
+    }
+
+    gst_init(0, nullptr);
+
+    GST_PLUGIN_STATIC_REGISTER(interpipe);
+
+    const long rssStartKb = RssKb();
+
+    RestreamServerLib::Callbacks callbacks;
+    if(options.relay)
+        callbacks.rtpRelay = [] (const std::string&) { return true; };
+
+    RestreamServerLib::Options serverOptions;
+    serverOptions.threadPool.maxThreads = options.threads;
+    serverOptions.splash.mode = RestreamServerLib::SplashMode::INTERPIPE;
+    serverOptions.splash.cached = true;
+    serverOptions.gopCache.enabled = options.gopCache;
+    serverOptions.transport.batchUdp = options.batchUdp;
+    if(options.preregister) {
+        for(gint i = 0; i < options.recorders; ++i)
+            serverOptions.mediaPool.preregisteredPaths.push_back(fmt::format("/bench{}", i));
+    }
+    serverOptions.log.serverLevel = spdlog::level::warn;
+    serverOptions.log.authLevel = spdlog::level::warn;
+    serverOptions.log.mediaLevel = spdlog::level::warn;
+
+    std::unique_ptr<RestreamServerLib::Server> server(
+        new RestreamServerLib::Server(
+            callbacks,
+            options.port, options.port + 1, false,
+            0, 0,
+            serverOptions));
+    std::thread serverThread([&server] () { server->serverMain(); });
+
+    // serverMain returns after drain, which should be started from server's main loop
+    auto stopServer =
+        [&server, &serverThread] () {
+            g_main_context_invoke(
+                nullptr,
+                [] (gpointer userData) -> gboolean {
+                    RestreamServerLib::DrainOptions drainOptions;
+                    drainOptions.playersGraceMs = 0;
+                    drainOptions.timeoutMs = 0;
+                    static_cast<RestreamServerLib::Server*>(userData)->drain(drainOptions);
+                    return G_SOURCE_REMOVE;
+                },
+                server.get());
+            serverThread.join();
+            server.reset();
+        };
+
+    if(!WaitServer(options.port + 1)) {
+        RestreamServerLib::Log()->critical("Restream server didn't start");
+        stopServer();
+        return 1;
+    }
+
+    const long rssServerKb = RssKb();
+
+    // recorders
+    std::vector<std::unique_ptr<Recorder>> recorders;
+    const RecordersSetup recordersSetup = ConnectRecorders(options, &recorders);
+
+    // let recorded streams reach players side
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    const long rssRecordersKb = RssKb();
+
+    // players
+    Stats stats;
+    std::vector<std::unique_ptr<Player>> players;
+    const gint64 playersStartTime = Now();
+    for(gint path = 0; path < options.recorders; ++path) {
+        for(gint i = 0; i < options.playersPerRecorder; ++i) {
+            players.emplace_back(new Player);
+            players.back()->decoding = i < options.decodersPerPath;
+            StartPlayer(options, path, players.back().get(), &stats);
+        }
+    }
+
+    const gint64 firstFrameDeadline = Now() + 30 * G_USEC_PER_SEC;
+    auto allPlayersGotFrame =
+        [&players] () {
+            return std::all_of(players.begin(), players.end(),
+                [] (const std::unique_ptr<Player>& player) {
+                    return player->firstFrameTime.load() != 0;
+                });
+        };
+    while(!allPlayersGotFrame() && Now() < firstFrameDeadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    std::vector<gint64> firstFrameUs;
+    gint64 lastFirstFrameTime = playersStartTime;
+    for(const std::unique_ptr<Player>& player: players) {
+        const gint64 firstFrameTime = player->firstFrameTime.load();
+        if(!firstFrameTime)
+            continue;
+
+        firstFrameUs.push_back(firstFrameTime - player->startTime);
+        lastFirstFrameTime = std::max(lastFirstFrameTime, firstFrameTime);
+    }
+    std::sort(firstFrameUs.begin(), firstFrameUs.end());
+
+    const long rssPlayersKb = RssKb();
+
+    // steady state
+    {
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        stats.latenciesUs.clear();
+        stats.misreadTimecodes = 0;
+    }
+
+    // whole process, i.e. including recorders' encoders and decoding players
+    const double cpuStart = CpuSeconds();
+    const gint64 steadyStartTime = Now();
+    std::this_thread::sleep_for(std::chrono::seconds(options.durationSec));
+    const double cpuSeconds = CpuSeconds() - cpuStart;
+    const double wallSeconds = static_cast<double>(Now() - steadyStartTime) / G_USEC_PER_SEC;
+
+    const long rssEndKb = RssKb();
+
+    std::vector<gint64> latenciesUs;
+    guint64 misreadTimecodes;
+    {
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        latenciesUs = stats.latenciesUs;
+        misreadTimecodes = stats.misreadTimecodes;
+    }
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+
+    unsigned playersFailed = players.size() - firstFrameUs.size();
+    unsigned pipelineErrors = 0;
+    for(const std::unique_ptr<Player>& player: players)
+        pipelineErrors += CountErrors(player->pipeline);
+    for(const std::unique_ptr<Recorder>& recorder: recorders)
+        pipelineErrors += CountErrors(recorder->pipeline);
+
+    for(const std::unique_ptr<Player>& player: players) {
+        if(player->pipeline) {
+            gst_element_set_state(player->pipeline, GST_STATE_NULL);
+            gst_object_unref(player->pipeline);
+        }
+    }
+    StopRecorders(&recorders);
+
+    // all cameras reconnecting at once.
+    // server keeps running, so it's reconnect to warm server (not restart)
+    RecordersSetup stormSetup;
+    if(options.storm) {
+        // let server release paths of disconnected recorders
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        stormSetup = ConnectRecorders(options, &recorders);
+        StopRecorders(&recorders);
+    }
+
+    stopServer();
+
+    const unsigned streams = options.recorders + players.size();
+    const double setupSeconds =
+        static_cast<double>(lastFirstFrameTime - playersStartTime) / G_USEC_PER_SEC;
+    gint64 latencySumUs = 0;
+    for(gint64 latency: latenciesUs)
+        latencySumUs += latency;
+
+    const std::string result =
+        fmt::format(
+            "{{\n"
+            "  \"config\": {{\"recorders\": {}, \"players_per_recorder\": {}, \"decoders_per_path\": {}, "
+            "\"duration_sec\": {}, \"threads\": {}, \"transport\": \"{}\", \"relay\": {}, "
+            "\"batch_udp\": {}, \"gop_cache\": {}, \"storm\": {}, \"preregister\": {}, "
+            "\"gstreamer\": \"{}\"}},\n"
+            "  \"recorders_failed\": {},\n"
+            "  \"players_failed\": {},\n"
+            "  \"pipeline_errors\": {},\n"
+            "  \"recorders_setup_sec\": {:.3f},\n"
+            "  \"recorder_setup_ms\": {{\"p50\": {:.1f}, \"p95\": {:.1f}, \"max\": {:.1f}}},\n"
+            "  \"storm\": {{\"server_restarted\": false, \"failed\": {}, \"reconnect_sec\": {:.3f}, "
+            "\"recorder_setup_ms\": {{\"p50\": {:.1f}, \"p95\": {:.1f}, \"max\": {:.1f}}}}},\n"
+            "  \"players_setup_per_sec\": {:.1f},\n"
+            "  \"time_to_first_frame_ms\": {{\"min\": {:.1f}, \"p50\": {:.1f}, \"p95\": {:.1f}, \"max\": {:.1f}}},\n"
+            "  \"latency_ms\": {{\"samples\": {}, \"misread\": {}, \"avg\": {:.1f}, "
+            "\"p50\": {:.1f}, \"p95\": {:.1f}, \"p99\": {:.1f}, \"max\": {:.1f}}},\n"
+            "  \"process_cpu_percent\": {:.1f},\n"
+            "  \"process_cpu_percent_per_stream\": {:.3f},\n"
+            "  \"rss_kb\": {{\"start\": {}, \"server\": {}, \"recorders\": {}, \"players\": {}, \"end\": {}}},\n"
+            "  \"rss_kb_per_player\": {:.1f}\n"
+            "}}\n",
+            options.recorders, options.playersPerRecorder, options.decodersPerPath,
+            options.durationSec, options.threads, options.tcp ? "tcp" : "udp",
+            options.relay ? "true" : "false",
+            options.batchUdp ? "true" : "false",
+            options.gopCache ? "true" : "false",
+            options.storm ? "true" : "false",
+            options.preregister ? "true" : "false",
+            GCharPtr(gst_version_string()).get(),
+            recordersSetup.failed,
+            playersFailed,
+            pipelineErrors,
+            static_cast<double>(recordersSetup.totalUs) / G_USEC_PER_SEC,
+            Percentile(recordersSetup.setupUs, 0.5) / 1000.0,
+            Percentile(recordersSetup.setupUs, 0.95) / 1000.0,
+            Percentile(recordersSetup.setupUs, 1) / 1000.0,
+            stormSetup.failed,
+            static_cast<double>(stormSetup.totalUs) / G_USEC_PER_SEC,
+            Percentile(stormSetup.setupUs, 0.5) / 1000.0,
+            Percentile(stormSetup.setupUs, 0.95) / 1000.0,
+            Percentile(stormSetup.setupUs, 1) / 1000.0,
+            setupSeconds > 0 ? firstFrameUs.size() / setupSeconds : 0.0,
+            Percentile(firstFrameUs, 0) / 1000.0,
+            Percentile(firstFrameUs, 0.5) / 1000.0,
+            Percentile(firstFrameUs, 0.95) / 1000.0,
+            Percentile(firstFrameUs, 1) / 1000.0,
+            latenciesUs.size(), misreadTimecodes,
+            latenciesUs.empty() ? 0.0 : latencySumUs / 1000.0 / latenciesUs.size(),
+            Percentile(latenciesUs, 0.5) / 1000.0,
+            Percentile(latenciesUs, 0.95) / 1000.0,
+            Percentile(latenciesUs, 0.99) / 1000.0,
+            Percentile(latenciesUs, 1) / 1000.0,
+            100 * cpuSeconds / wallSeconds,
+            streams ? 100 * cpuSeconds / wallSeconds / streams : 0.0,
+            rssStartKb, rssServerKb, rssRecordersKb, rssPlayersKb, rssEndKb,
+            players.empty() ? 0.0 : static_cast<double>(rssPlayersKb - rssRecordersKb) / players.size());
+
+    fputs(result.c_str(), stdout);
+    fflush(stdout);
+
+    return (recordersSetup.failed || playersFailed || stormSetup.failed) ? 2 : 0;
+}
@@ -0,0 +1,68 @@
+#include "AccessUnitPool.h"
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+AccessUnitPool::AccessUnitPool(size_t bufferBytes, unsigned maxBuffers) :
+    _bufferBytes(bufferBytes),
+    _pool(gst_buffer_pool_new())
+{
+    GstStructure* config = gst_buffer_pool_get_config(_pool);
+    gst_buffer_pool_config_set_params(
+        config, nullptr, static_cast<guint>(bufferBytes), 0, maxBuffers);
+
+    if(!gst_buffer_pool_set_config(_pool, config) ||
+       !gst_buffer_pool_set_active(_pool, TRUE))
+    {
+        MediaLog()->error("Fail to activate access units pool. Pooling is disabled.");
+        gst_object_unref(_pool);
+        _pool = nullptr;
+    }
+}
+
+AccessUnitPool::~AccessUnitPool()
+{
+    if(!_pool)
+        return;
+
+    // buffers still in use are freed on release
+    gst_buffer_pool_set_active(_pool, FALSE);
+    gst_object_unref(_pool);
+}
+
+bool AccessUnitPool::repack(GstBuffer** buffer)
+{
+    GstBuffer* source = *buffer;
+    const gsize size = gst_buffer_get_size(source);
+    if(!_pool || size > _bufferBytes)
+        return false;
+
+    GstBufferPoolAcquireParams params = { };
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+
+    GstBuffer* pooled = nullptr;
+    if(GST_FLOW_OK != gst_buffer_pool_acquire_buffer(_pool, &pooled, &params))
+        return false;
+
+    GstMapInfo map;
+    if(!gst_buffer_map(pooled, &map, GST_MAP_WRITE)) {
+        gst_buffer_unref(pooled);
+        return false;
+    }
+    gst_buffer_extract(source, 0, map.data, size);
+    gst_buffer_unmap(pooled, &map);
+
+    // pool restores full size on release
+    gst_buffer_set_size(pooled, size);
+    gst_buffer_copy_into(pooled, source, GST_BUFFER_COPY_METADATA, 0, -1);
+
+    gst_buffer_unref(source);
+    *buffer = pooled;
+
+    return true;
+}
+
+}
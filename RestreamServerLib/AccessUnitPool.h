@@ -0,0 +1,32 @@
+#pragma once
+
+#include <gst/gst.h>
+
+
+namespace RestreamServerLib
+{
+
+// Fixed size buffers recycled for parsed access units of all paths,
+// so steady flow of frames doesn't allocate (and fragment) heap for every frame.
+// Pool memory is allocated on demand and never shrinks.
+// Thread safe.
+class AccessUnitPool
+{
+public:
+    AccessUnitPool(size_t bufferBytes, unsigned maxBuffers);
+    ~AccessUnitPool();
+
+    AccessUnitPool(const AccessUnitPool&) = delete;
+    AccessUnitPool& operator = (const AccessUnitPool&) = delete;
+
+    // replaces buffer with pooled copy (unreffing original one).
+    // returns false and keeps buffer as is
+    // if it doesn't fit to pool buffer or pool is exhausted
+    bool repack(GstBuffer** buffer);
+
+private:
+    const size_t _bufferBytes;
+    GstBufferPool* _pool;
+};
+
+}
@@ -0,0 +1,134 @@
+#include "AuthCache.h"
+
+#include <CxxPtr/GlibPtr.h>
+
+
+namespace RestreamServerLib
+{
+
+AuthCache::AuthCache(size_t maxEntries, unsigned ttlMs) :
+    _maxEntries(maxEntries), _ttlMs(ttlMs)
+{
+}
+
+std::string AuthCache::AuthenticationKey(const std::string& user, const std::string& pass)
+{
+    // don't keep passwords in memory as is
+    GCharPtr passHashPtr(
+        g_compute_checksum_for_data(
+            G_CHECKSUM_SHA256,
+            reinterpret_cast<const guchar*>(pass.data()),
+            pass.size()));
+
+    std::string key;
+    key.reserve(user.size() + 1 + 64);
+    key += user;
+    key += '\0';
+    key += passHashPtr.get();
+
+    return key;
+}
+
+std::string AuthCache::AuthorizationKey(
+    const std::string& user,
+    Action action,
+    const std::string& path,
+    bool record)
+{
+    std::string key;
+    key.reserve(user.size() + 4 + path.size());
+    key += user;
+    key += '\0';
+    key += static_cast<char>('0' + static_cast<int>(action));
+    key += record ? 'R' : 'P';
+    key += '\0';
+    key += path;
+
+    return key;
+}
+
+void AuthCache::store(std::string&& key, bool result, unsigned ttlMs)
+{
+    if(0 == ttlMs || 0 == _maxEntries)
+        return;
+
+    const gint64 now = g_get_monotonic_time();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _entries.find(key);
+    if(it != _entries.end()) {
+        _lru.erase(it->second.lruIt);
+        _entries.erase(it);
+    }
+
+    // drop oldest entries (expired first, since ttl is mostly the same)
+    while(_entries.size() >= _maxEntries) {
+        _entries.erase(_lru.front());
+        _lru.pop_front();
+    }
+
+    _lru.push_back(key);
+    _entries.emplace(
+        std::move(key),
+        Entry { result, now + gint64(ttlMs) * 1000, std::prev(_lru.end()) });
+}
+
+bool AuthCache::find(const std::string& key, bool* result)
+{
+    const gint64 now = g_get_monotonic_time();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _entries.find(key);
+    if(it == _entries.end())
+        return false;
+
+    if(it->second.expireTime <= now) {
+        _lru.erase(it->second.lruIt);
+        _entries.erase(it);
+        return false;
+    }
+
+    *result = it->second.result;
+
+    return true;
+}
+
+void AuthCache::storeAuthentication(
+    const std::string& user,
+    const std::string& pass,
+    bool result)
+{
+    store(AuthenticationKey(user, pass), result, _ttlMs);
+}
+
+bool AuthCache::findAuthentication(
+    const std::string& user,
+    const std::string& pass,
+    bool* result)
+{
+    return find(AuthenticationKey(user, pass), result);
+}
+
+void AuthCache::storeAuthorization(
+    const std::string& user,
+    Action action,
+    const std::string& path,
+    bool record,
+    bool result)
+{
+    store(AuthorizationKey(user, action, path, record), result, _ttlMs);
+}
+
+bool AuthCache::findAuthorization(
+    const std::string& user,
+    Action action,
+    const std::string& path,
+    bool record,
+    bool* result)
+{
+    return find(AuthorizationKey(user, action, path, record), result);
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <glib.h>
+
+#include "Action.h"
+
+
+namespace RestreamServerLib
+{
+
+// Bounded TTL cache of authentication and authorization results,
+// to not go to (potentially slow) backend on every request of the same session.
+// Thread safe.
+class AuthCache
+{
+public:
+    // ttlMs == 0 disables caching
+    AuthCache(size_t maxEntries, unsigned ttlMs);
+
+    void storeAuthentication(
+        const std::string& user, const std::string& pass, bool result);
+    bool findAuthentication(
+        const std::string& user, const std::string& pass, bool* result);
+
+    void storeAuthorization(
+        const std::string& user, Action, const std::string& path, bool record, bool result);
+    bool findAuthorization(
+        const std::string& user, Action, const std::string& path, bool record, bool* result);
+
+    // keys of cached results (password is hashed)
+    static std::string AuthenticationKey(const std::string& user, const std::string& pass);
+    static std::string AuthorizationKey(
+        const std::string& user, Action, const std::string& path, bool record);
+
+private:
+    void store(std::string&& key, bool result, unsigned ttlMs);
+    bool find(const std::string& key, bool* result);
+
+private:
+    struct Entry
+    {
+        bool result;
+        gint64 expireTime;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    const size_t _maxEntries;
+    const unsigned _ttlMs;
+
+    std::mutex _mutex;
+    // most recently stored at the end
+    std::list<std::string> _lru;
+    std::unordered_map<std::string, Entry> _entries;
+};
+
+}
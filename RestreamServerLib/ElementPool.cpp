@@ -0,0 +1,138 @@
+#include "ElementPool.h"
+
+#include "Log.h"
+#include "Elements.h"
+
+
+namespace RestreamServerLib
+{
+
+ElementPool::ElementPool(unsigned elementsPerDescription, unsigned maxDescriptions) :
+    _elementsPerDescription(elementsPerDescription),
+    _maxDescriptions(maxDescriptions),
+    _refillSource(0)
+{
+}
+
+ElementPool::~ElementPool()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_refillSource)
+        g_source_remove(_refillSource);
+
+    for(auto& pair: _entries) {
+        for(GstElement* element: pair.second.elements)
+            ReleaseElement(element);
+    }
+}
+
+GstElement*
+ElementPool::Launch(ElementPool* pool, const std::string& key, const Builder& builder)
+{
+    if(pool)
+        return pool->take(key, builder);
+
+    return builder();
+}
+
+GstElement* ElementPool::take(const std::string& key, const Builder& builder)
+{
+    if(0 == _elementsPerDescription || 0 == _maxDescriptions)
+        return builder();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _entries.find(key);
+        if(it == _entries.end()) {
+            while(_entries.size() >= _maxDescriptions) {
+                auto oldestIt = _entries.find(_lru.front());
+                for(GstElement* element: oldestIt->second.elements)
+                    ReleaseElement(element);
+                _entries.erase(oldestIt);
+                _lru.pop_front();
+            }
+
+            _lru.push_back(key);
+            it = _entries.emplace(key, Entry { {}, builder, std::prev(_lru.end()) }).first;
+        } else
+            _lru.splice(_lru.end(), _lru, it->second.lruIt);
+
+        scheduleRefill();
+
+        Entry& entry = it->second;
+        if(!entry.elements.empty()) {
+            GstElement* element = entry.elements.front();
+            entry.elements.pop_front();
+
+            MediaLog()->debug("ElementPool. Pre-built pipeline taken.");
+
+            return element;
+        }
+    }
+
+    return builder();
+}
+
+// should be called with _mutex locked
+void ElementPool::scheduleRefill()
+{
+    if(!_refillSource)
+        _refillSource = g_idle_add(onRefill, this);
+}
+
+gboolean ElementPool::onRefill(gpointer userData)
+{
+    ElementPool* self = static_cast<ElementPool*>(userData);
+
+    return self->refill() ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+// builds one element per call, to not block main context for long.
+// returns true if more elements are needed
+bool ElementPool::refill()
+{
+    std::string key;
+    Builder builder;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // most recently used first
+        for(auto it = _lru.rbegin(); it != _lru.rend(); ++it) {
+            const Entry& entry = _entries[*it];
+            if(entry.elements.size() < _elementsPerDescription) {
+                key = *it;
+                builder = entry.builder;
+                break;
+            }
+        }
+
+        if(key.empty()) {
+            _refillSource = 0;
+            return false;
+        }
+    }
+
+    GstElement* element = builder();
+    if(!element)
+        MediaLog()->error("ElementPool. Fail to pre-build pipeline: {}", key);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _entries.find(key);
+    if(!element) {
+        // don't retry broken pipeline forever
+        if(it != _entries.end()) {
+            _lru.erase(it->second.lruIt);
+            _entries.erase(it);
+        }
+    } else if(it != _entries.end() && it->second.elements.size() < _elementsPerDescription)
+        it->second.elements.push_back(element);
+    else
+        ReleaseElement(element);
+
+    return true;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <gst/gst.h>
+
+
+namespace RestreamServerLib
+{
+
+// Keeps pre-built (not prepared yet) pipelines of recently used keys,
+// so media creation takes ready bin instead of building it again.
+// Taken elements are replaced from default main context idle.
+// Thread safe.
+class ElementPool
+{
+public:
+    // returns floating reference or nullptr on failure
+    typedef std::function<GstElement* ()> Builder;
+
+    // up to elementsPerDescription elements are kept
+    // for every of maxDescriptions most recently used keys
+    ElementPool(unsigned elementsPerDescription, unsigned maxDescriptions);
+    ~ElementPool();
+
+    // key should identify pipeline built by builder.
+    // Pre-built element is returned if available.
+    // pool could be nullptr
+    static GstElement* Launch(ElementPool*, const std::string& key, const Builder&);
+
+private:
+    GstElement* take(const std::string& key, const Builder&);
+
+    static gboolean onRefill(gpointer userData);
+    bool refill();
+
+    void scheduleRefill();
+
+private:
+    struct Entry
+    {
+        // floating references
+        std::deque<GstElement*> elements;
+        Builder builder;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    const unsigned _elementsPerDescription;
+    const unsigned _maxDescriptions;
+
+    std::mutex _mutex;
+    // most recently used at the end
+    std::list<std::string> _lru;
+    std::unordered_map<std::string, Entry> _entries;
+    guint _refillSource;
+};
+
+}
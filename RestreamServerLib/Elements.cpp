@@ -0,0 +1,113 @@
+#include "Elements.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+GstElementFactory* FindFactory(const gchar* factoryName)
+{
+    static std::mutex mutex;
+    // factories are kept until process exit
+    static std::unordered_map<std::string, GstElementFactory*> factories;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = factories.find(factoryName);
+    if(it != factories.end())
+        return it->second;
+
+    GstElementFactory* factory = gst_element_factory_find(factoryName);
+    if(!factory)
+        return nullptr;
+
+    // load plugin once, instead of on every element creation
+    GstPluginFeature* loaded = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+    if(loaded) {
+        gst_object_unref(factory);
+        factory = GST_ELEMENT_FACTORY(loaded);
+    }
+
+    factories.emplace(factoryName, factory);
+
+    return factory;
+}
+
+}
+
+GstElement* MakeElement(const gchar* factoryName, const gchar* name)
+{
+    GstElementFactory* factory = FindFactory(factoryName);
+    GstElement* element = factory ? gst_element_factory_create(factory, name) : nullptr;
+    if(!element)
+        MediaLog()->critical("Fail to create element \"{}\"", factoryName);
+
+    return element;
+}
+
+void ReleaseElement(GstElement* element)
+{
+    gst_object_ref_sink(element);
+    gst_object_unref(element);
+}
+
+GstElement* AddElement(GstBin* bin, GstElement* element)
+{
+    if(element)
+        gst_bin_add(bin, element);
+
+    return element;
+}
+
+bool AddLinked(GstBin* bin, std::initializer_list<GstElement*> elements)
+{
+    bool success = true;
+    for(GstElement* element: elements) {
+        if(!element)
+            success = false;
+        else if(GST_OBJECT_PARENT(element) != GST_OBJECT(bin))
+            gst_bin_add(bin, element);
+    }
+
+    if(!success)
+        return false;
+
+    GstElement* prev = nullptr;
+    for(GstElement* element: elements) {
+        if(prev && !gst_element_link(prev, element)) {
+            MediaLog()->critical(
+                "Fail to link \"{}\" to \"{}\"",
+                GST_ELEMENT_NAME(prev), GST_ELEMENT_NAME(element));
+            return false;
+        }
+        prev = element;
+    }
+
+    return true;
+}
+
+void LinkAddedPads(GstElement* src, GstElement* sink)
+{
+    // both elements are in the same bin, so sink outlives src signals
+    g_signal_connect(src, "pad-added",
+        G_CALLBACK(+[] (GstElement* /*src*/, GstPad* pad, gpointer userData) {
+            GstElement* sink = static_cast<GstElement*>(userData);
+
+            GstPadPtr sinkPadPtr(gst_element_get_static_pad(sink, "sink"));
+            if(!gst_pad_is_linked(sinkPadPtr.get()))
+                gst_pad_link(pad, sinkPadPtr.get());
+        }),
+        sink);
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <initializer_list>
+
+#include <gst/gst.h>
+
+
+namespace RestreamServerLib
+{
+
+// Element factories are looked up once and cached,
+// so pipelines are built without parsing descriptions
+// and without registry lookup for every element.
+// Returns floating reference or nullptr if element is not available.
+GstElement* MakeElement(const gchar* factoryName, const gchar* name = nullptr);
+
+// frees element having floating reference
+void ReleaseElement(GstElement*);
+
+// adds element to bin if it's not nullptr. Returns element
+GstElement* AddElement(GstBin*, GstElement*);
+
+// adds elements to bin (if not added yet) and links them one after another.
+// Available elements are added even on failure, so they are freed with bin.
+bool AddLinked(GstBin*, std::initializer_list<GstElement*>);
+
+// links src pads appearing on src later (like rtspsrc ones)
+// to sink pad of sink, if pads are compatible
+void LinkAddedPads(GstElement* src, GstElement* sink);
+
+}
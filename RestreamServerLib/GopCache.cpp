@@ -0,0 +1,141 @@
+#include "GopCache.h"
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+#if GST_CHECK_VERSION(1, 14, 0)
+GstCaps* RecordTimeCaps()
+{
+    static GstCaps* caps = nullptr;
+
+    static gsize initialized = 0;
+    if(g_once_init_enter(&initialized)) {
+        caps = gst_caps_new_empty_simple("timestamp/x-restream-record");
+        GST_MINI_OBJECT_FLAG_SET(caps, GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);
+        g_once_init_leave(&initialized, 1);
+    }
+
+    return caps;
+}
+#endif
+
+GstClockTime BufferTime(GstBuffer* buffer)
+{
+    return
+        GST_BUFFER_DTS_IS_VALID(buffer) ?
+            GST_BUFFER_DTS(buffer) :
+            GST_BUFFER_PTS(buffer);
+}
+
+}
+
+GopCache::GopCache(const std::shared_ptr<GopCacheLimits>& limits) :
+    _limits(limits), _bytes(0), _started(false)
+{
+}
+
+GopCache::~GopCache()
+{
+    clear();
+}
+
+void GopCache::push(GstBuffer* buffer)
+{
+#if GST_CHECK_VERSION(1, 14, 0)
+    const GstClockTime time = BufferTime(buffer);
+    if(!GST_CLOCK_TIME_IS_VALID(time))
+        return;
+
+    gst_buffer_add_reference_timestamp_meta(
+        buffer, RecordTimeCaps(), time, GST_CLOCK_TIME_NONE);
+
+    const bool keyFrame = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    // memory held by buffer (whole slot for pooled access unit)
+    gsize size = 0;
+    gst_buffer_get_sizes(buffer, nullptr, &size);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(keyFrame) {
+        clearLocked();
+        _started = true;
+    } else if(!_started)
+        return;
+
+    if(_bytes + size > _limits->maxPathBytes ||
+       _limits->totalBytes() + size > _limits->maxTotalBytes)
+    {
+        MediaLog()->debug(
+            "GOP cache limit reached. path bytes: {}, total bytes: {}",
+            _bytes, _limits->totalBytes());
+        clearLocked();
+        return;
+    }
+
+    _buffers.push_back(gst_buffer_ref(buffer));
+    _bytes += size;
+    _limits->_totalBytes += size;
+#endif
+}
+
+void GopCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    clearLocked();
+}
+
+void GopCache::clearLocked()
+{
+    for(GstBuffer* buffer: _buffers)
+        gst_buffer_unref(buffer);
+    _buffers.clear();
+
+    _limits->_totalBytes -= _bytes;
+    _bytes = 0;
+
+    _started = false;
+}
+
+std::vector<GstBuffer*> GopCache::snapshot(GstClockTime before) const
+{
+    std::vector<GstBuffer*> buffers;
+
+    if(!GST_CLOCK_TIME_IS_VALID(before))
+        return buffers;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(GstBuffer* buffer: _buffers) {
+        if(RecordTime(buffer) >= before)
+            break;
+        buffers.push_back(gst_buffer_ref(buffer));
+    }
+
+    return buffers;
+}
+
+size_t GopCache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+GstClockTime GopCache::RecordTime(GstBuffer* buffer)
+{
+#if GST_CHECK_VERSION(1, 14, 0)
+    GstReferenceTimestampMeta* meta =
+        gst_buffer_get_reference_timestamp_meta(buffer, RecordTimeCaps());
+    if(meta)
+        return meta->timestamp;
+#endif
+
+    return GST_CLOCK_TIME_NONE;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <gst/gst.h>
+
+
+namespace RestreamServerLib
+{
+
+// Memory limits shared by all paths GOP caches
+class GopCacheLimits
+{
+public:
+    GopCacheLimits(size_t maxPathBytes, size_t maxTotalBytes) :
+        maxPathBytes(maxPathBytes), maxTotalBytes(maxTotalBytes), _totalBytes(0) {}
+
+    const size_t maxPathBytes;
+    const size_t maxTotalBytes;
+
+    size_t totalBytes() const
+        { return _totalBytes.load(std::memory_order_relaxed); }
+
+private:
+    friend class GopCache;
+
+    std::atomic<size_t> _totalBytes;
+};
+
+// Keeps access units since last key frame of recorded stream,
+// to prime freshly prepared play media with it.
+class GopCache
+{
+public:
+    GopCache(const std::shared_ptr<GopCacheLimits>&);
+    ~GopCache();
+
+    // record side, called from streaming thread for every access unit.
+    // marks buffer with record time, so buffer should be writable
+    void push(GstBuffer*);
+    void clear();
+
+    // play side. returns cached access units (starting from key frame)
+    // recorded before given record time
+    std::vector<GstBuffer*> snapshot(GstClockTime before) const;
+
+    // record time of buffer marked by push, or GST_CLOCK_TIME_NONE
+    static GstClockTime RecordTime(GstBuffer*);
+
+    // memory held by cached buffers, not just their payload
+    size_t bytes() const;
+
+private:
+    void clearLocked();
+
+private:
+    const std::shared_ptr<GopCacheLimits> _limits;
+
+    mutable std::mutex _mutex;
+    std::deque<GstBuffer*> _buffers;
+    size_t _bytes;
+    // waiting key frame after clear or limit overflow
+    bool _started;
+};
+
+}
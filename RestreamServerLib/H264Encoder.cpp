@@ -0,0 +1,138 @@
+#include "H264Encoder.h"
+
+#include <mutex>
+#include <string>
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+struct Encoder
+{
+    H264EncoderType type;
+    const char* factory;
+    // key frame interval goes between prefix and suffix
+    const char* prefix;
+    const char* suffix;
+};
+
+// in order of preference, software encoder is the last
+const Encoder Encoders[] = {
+    { H264EncoderType::VAAPI, "vaapih264enc",
+        "videoconvert ! vaapih264enc keyframe-period=",
+        " ! video/x-h264, profile=constrained-baseline" },
+    { H264EncoderType::NVENC, "nvh264enc",
+        "videoconvert ! nvh264enc gop-size=",
+        " ! video/x-h264, profile=baseline" },
+    { H264EncoderType::V4L2, "v4l2h264enc",
+        "videoconvert ! v4l2h264enc extra-controls=\"controls,video_gop_size=",
+        "\" ! video/x-h264, profile=baseline" },
+    { H264EncoderType::X264, "x264enc",
+        "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=",
+        " ! video/x-h264, profile=baseline" },
+};
+
+const Encoder& SoftwareEncoder()
+{
+    return Encoders[G_N_ELEMENTS(Encoders) - 1];
+}
+
+std::mutex selectedMutex;
+const Encoder* selected = nullptr;
+
+std::string Describe(const Encoder& encoder, unsigned keyFrameInterval)
+{
+    return encoder.prefix + std::to_string(keyFrameInterval) + encoder.suffix;
+}
+
+bool Probe(const Encoder& encoder)
+{
+    GstElementFactory* factory = gst_element_factory_find(encoder.factory);
+    if(!factory)
+        return false;
+    gst_object_unref(factory);
+
+    const std::string pipelineDesc =
+        fmt::format(
+            "videotestsrc num-buffers=2 ! video/x-raw, width=320, height=240 ! "
+            "{} ! fakesink",
+            Describe(encoder, 1));
+
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(pipelineDesc.c_str(), &error);
+    GErrorPtr errorPtr(error);
+    if(!pipeline)
+        return false;
+
+    GstElementPtr pipelinePtr(GST_ELEMENT(gst_object_ref_sink(pipeline)));
+
+    if(GST_STATE_CHANGE_FAILURE == gst_element_set_state(pipeline, GST_STATE_PLAYING)) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        return false;
+    }
+
+    GstBus* bus = gst_element_get_bus(pipeline);
+    GstMessage* message =
+        gst_bus_timed_pop_filtered(
+            bus,
+            2 * GST_SECOND,
+            GstMessageType(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    gst_object_unref(bus);
+    const bool encoded = message && GST_MESSAGE_EOS == GST_MESSAGE_TYPE(message);
+    if(message)
+        gst_message_unref(message);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    return encoded;
+}
+
+}
+
+void SelectH264Encoder(H264EncoderType preferred)
+{
+    const Encoder* found = nullptr;
+    for(const Encoder& encoder: Encoders) {
+        if(H264EncoderType::AUTO != preferred && preferred != encoder.type)
+            continue;
+
+        if(Probe(encoder)) {
+            found = &encoder;
+            break;
+        }
+
+        Log()->debug("H264 encoder is not usable: {}", encoder.factory);
+    }
+
+    if(!found) {
+        if(H264EncoderType::AUTO != preferred)
+            Log()->warn("Preferred H264 encoder is not usable, falling back to x264enc");
+        found = &SoftwareEncoder();
+    }
+
+    Log()->info("H264 encoder for static sources and splash screens: {}", found->factory);
+
+    std::lock_guard<std::mutex> lock(selectedMutex);
+    selected = found;
+}
+
+std::string H264EncoderDescription(unsigned keyFrameInterval)
+{
+    const Encoder* encoder;
+    {
+        std::lock_guard<std::mutex> lock(selectedMutex);
+        encoder = selected ? selected : &SoftwareEncoder();
+    }
+
+    return Describe(*encoder, keyFrameInterval);
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+#include "Options.h"
+
+
+namespace RestreamServerLib
+{
+
+// Checks encoders by encoding test frames,
+// so failing hardware encoders (no device, no driver) are skipped.
+// Should be called once at startup, before H264EncoderDescription
+void SelectH264Encoder(H264EncoderType preferred);
+
+// gst-launch description of selected encoder with following caps filter,
+// producing baseline profile with key frame every keyFrameInterval frames
+std::string H264EncoderDescription(unsigned keyFrameInterval);
+
+}
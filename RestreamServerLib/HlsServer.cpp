@@ -0,0 +1,476 @@
+#include "HlsServer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+#include "Private.h"
+#include "Elements.h"
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+const size_t TS_PACKET_SIZE = 188;
+const guint16 PAT_PID = 0;
+const guint16 NO_PID = 0x1fff;
+
+const size_t MAX_REQUEST_HEAD_SIZE = 8 * 1024;
+// every connection holds service thread until it's closed,
+// so slow or idle clients shouldn't keep it long
+const guint CONNECTION_TIMEOUT_SEC = 5;
+
+guint16 PacketPid(const guint8* packet)
+{
+    return ((packet[1] & 0x1f) << 8) | packet[2];
+}
+
+// returns PID of first program's PMT from PAT packet, or NO_PID
+guint16 ParsePmtPid(const guint8* packet)
+{
+    const bool payloadStart = packet[1] & 0x40;
+    const guint8 adaptationControl = (packet[3] >> 4) & 0x03;
+    if(!payloadStart || !(adaptationControl & 0x01))
+        return NO_PID;
+
+    size_t offset = 4;
+    if(adaptationControl & 0x02)
+        offset += 1 + packet[offset];
+    if(offset >= TS_PACKET_SIZE)
+        return NO_PID;
+
+    // pointer field
+    offset += 1 + packet[offset];
+    if(offset + 8 > TS_PACKET_SIZE)
+        return NO_PID;
+
+    const guint8* section = packet + offset;
+    const size_t sectionLength = ((section[1] & 0x0f) << 8) | section[2];
+    if(sectionLength < 9)
+        return NO_PID;
+    // programs are between 8 bytes header and 4 bytes CRC
+    const size_t end = std::min<size_t>(3 + sectionLength - 4, TS_PACKET_SIZE - offset);
+    for(size_t i = 8; i + 4 <= end; i += 4) {
+        const guint16 programNumber = (section[i] << 8) | section[i + 1];
+        if(programNumber != 0)
+            return ((section[i + 2] & 0x1f) << 8) | section[i + 3];
+    }
+
+    return NO_PID;
+}
+
+bool WriteResponse(
+    GOutputStream* out,
+    const char* status,
+    const char* contentType,
+    const std::string& body)
+{
+    const std::string head =
+        fmt::format(
+            "HTTP/1.1 {}\r\n"
+            "Content-Type: {}\r\n"
+            "Content-Length: {}\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            status, contentType, body.size());
+
+    return
+        g_output_stream_write_all(out, head.data(), head.size(), nullptr, nullptr, nullptr) &&
+        g_output_stream_write_all(out, body.data(), body.size(), nullptr, nullptr, nullptr);
+}
+
+}
+
+class HlsServer::Segmenter
+{
+public:
+    Segmenter(const HlsOptions&, const std::string& proxyName, unsigned streamIndex);
+    ~Segmenter();
+
+    std::string playlist() const;
+    // nullptr if segment is not available (anymore)
+    std::shared_ptr<const std::string> segment(unsigned sequence) const;
+
+private:
+    static GstFlowReturn onNewSample(GstAppSink*, gpointer userData);
+    void push(GstBuffer*);
+    void cacheTables(const guint8* data, size_t size);
+
+private:
+    struct Segment
+    {
+        unsigned sequence;
+        double duration;
+        std::shared_ptr<const std::string> data;
+    };
+
+    const HlsOptions _options;
+
+    GstElement* _pipeline;
+
+    mutable std::mutex _mutex;
+    std::deque<Segment> _segments;
+    unsigned _nextSequence = 0;
+
+    std::string _current;
+    gint64 _currentStart = 0;
+
+    // last PAT and PMT packets, every segment starts with them
+    // so it could be decoded independently
+    std::string _pat;
+    std::string _pmt;
+    guint16 _pmtPid = NO_PID;
+};
+
+HlsServer::Segmenter::Segmenter(
+    const HlsOptions& options,
+    const std::string& proxyName,
+    unsigned streamIndex) :
+    _options(options), _pipeline(gst_pipeline_new(nullptr))
+{
+    GstElement* src = MakeElement("interpipesrc");
+    if(src) {
+        g_object_set(src,
+            "listen-to", Private::StreamProxyName(proxyName, streamIndex).c_str(),
+            "format", GST_FORMAT_TIME,
+            "is-live", TRUE,
+            NULL);
+    }
+
+    GstElement* parse = MakeElement("h264parse");
+    if(parse)
+        g_object_set(parse, "config-interval", -1, NULL);
+
+    GstElement* mux = MakeElement("mpegtsmux");
+    if(mux)
+        g_object_set(mux, "alignment", 7, NULL);
+
+    // viewers are served from memory, so slow consumer is not possible here,
+    // but never block path's interpipesink anyway
+    GstElement* sink = MakeElement("appsink");
+    if(sink) {
+        g_object_set(sink,
+            "sync", FALSE,
+            "drop", TRUE,
+            "max-buffers", 256,
+            NULL);
+
+        GstAppSinkCallbacks callbacks = {};
+        callbacks.new_sample = onNewSample;
+        gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, this, nullptr);
+    }
+
+    if(!AddLinked(GST_BIN(_pipeline), { src, parse, mux, sink })) {
+        MediaLog()->critical("Fail to create HLS segmenter");
+        return;
+    }
+
+    gst_element_set_state(_pipeline, GST_STATE_PLAYING);
+}
+
+HlsServer::Segmenter::~Segmenter()
+{
+    gst_element_set_state(_pipeline, GST_STATE_NULL);
+    gst_object_unref(_pipeline);
+}
+
+GstFlowReturn HlsServer::Segmenter::onNewSample(GstAppSink* appSink, gpointer userData)
+{
+    Segmenter* self = static_cast<Segmenter*>(userData);
+
+    GstSample* sample = gst_app_sink_pull_sample(appSink);
+    if(!sample)
+        return GST_FLOW_OK;
+
+    if(GstBuffer* buffer = gst_sample_get_buffer(sample))
+        self->push(buffer);
+
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+// should be called with _mutex locked
+void HlsServer::Segmenter::cacheTables(const guint8* data, size_t size)
+{
+    for(size_t offset = 0; offset + TS_PACKET_SIZE <= size; offset += TS_PACKET_SIZE) {
+        const guint8* packet = data + offset;
+        const guint16 pid = PacketPid(packet);
+        if(PAT_PID == pid) {
+            _pat.assign(reinterpret_cast<const char*>(packet), TS_PACKET_SIZE);
+            _pmtPid = ParsePmtPid(packet);
+        } else if(_pmtPid != NO_PID && _pmtPid == pid) {
+            _pmt.assign(reinterpret_cast<const char*>(packet), TS_PACKET_SIZE);
+        }
+    }
+}
+
+// segments are cut on key frames, but not shorter than minSegmentMs
+void HlsServer::Segmenter::push(GstBuffer* buffer)
+{
+    const bool keyFrame = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    const gint64 now = g_get_monotonic_time();
+
+    GstMapInfo map;
+    if(!gst_buffer_map(buffer, &map, GST_MAP_READ))
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    cacheTables(map.data, map.size);
+
+    const bool startSegment =
+        keyFrame &&
+        (!_currentStart ||
+         now - _currentStart >= static_cast<gint64>(_options.minSegmentMs) * 1000);
+
+    size_t lastSize = 0;
+    if(startSegment && _currentStart) {
+        lastSize = _current.size();
+        _segments.push_back({
+            _nextSequence++,
+            static_cast<double>(now - _currentStart) / G_USEC_PER_SEC,
+            std::make_shared<const std::string>(std::move(_current)) });
+        while(_segments.size() > _options.segmentsCount)
+            _segments.pop_front();
+    }
+
+    if(startSegment) {
+        _current = _pat + _pmt;
+        // segments are usually of similar size
+        _current.reserve(lastSize + lastSize / 4);
+        _currentStart = now;
+    }
+
+    // waiting first key frame
+    if(_currentStart)
+        _current.append(reinterpret_cast<const char*>(map.data), map.size);
+
+    gst_buffer_unmap(buffer, &map);
+}
+
+std::string HlsServer::Segmenter::playlist() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    double maxDuration = _options.minSegmentMs / 1000.;
+    for(const Segment& segment: _segments)
+        maxDuration = std::max(maxDuration, segment.duration);
+
+    std::string playlist =
+        fmt::format(
+            "#EXTM3U\n"
+            "#EXT-X-VERSION:3\n"
+            "#EXT-X-TARGETDURATION:{}\n"
+            "#EXT-X-MEDIA-SEQUENCE:{}\n",
+            static_cast<unsigned>(std::ceil(maxDuration)),
+            _segments.empty() ? _nextSequence : _segments.front().sequence);
+    for(const Segment& segment: _segments) {
+        playlist +=
+            fmt::format(
+                "#EXTINF:{:.3f},\n"
+                "{}.ts\n",
+                segment.duration, segment.sequence);
+    }
+
+    return playlist;
+}
+
+std::shared_ptr<const std::string> HlsServer::Segmenter::segment(unsigned sequence) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(const Segment& segment: _segments) {
+        if(segment.sequence == sequence)
+            return segment.data;
+    }
+
+    return nullptr;
+}
+
+
+HlsServer::HlsServer(const HlsOptions& options) :
+    _options(options),
+    _service(g_threaded_socket_service_new(options.maxThreads))
+{
+}
+
+HlsServer::~HlsServer()
+{
+    g_socket_service_stop(_service);
+    g_socket_listener_close(G_SOCKET_LISTENER(_service));
+    g_object_unref(_service);
+}
+
+bool HlsServer::start()
+{
+    GError* error = nullptr;
+    if(!g_socket_listener_add_inet_port(
+        G_SOCKET_LISTENER(_service), _options.port, nullptr, &error))
+    {
+        GErrorPtr errorPtr(error);
+        Log()->critical(
+            "Fail to listen HLS port {}: {}",
+            _options.port, errorPtr->message);
+        return false;
+    }
+
+    g_signal_connect(_service, "run", G_CALLBACK(onRun), this);
+    g_socket_service_start(_service);
+
+    Log()->info("HLS server running on port {}", _options.port);
+
+    return true;
+}
+
+void HlsServer::addPath(
+    const std::string& path,
+    const std::string& proxyName,
+    unsigned streamIndex)
+{
+    std::shared_ptr<Segmenter> segmenter =
+        std::make_shared<Segmenter>(_options, proxyName, streamIndex);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _segmenters[path].swap(segmenter);
+    }
+
+    // replaced pipeline is stopped outside of lock
+    segmenter.reset();
+}
+
+void HlsServer::removePath(const std::string& path)
+{
+    std::shared_ptr<Segmenter> segmenter;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _segmenters.find(path);
+        if(it == _segmenters.end())
+            return;
+
+        segmenter = std::move(it->second);
+        _segmenters.erase(it);
+    }
+
+    // pipeline is stopped outside of lock
+    segmenter.reset();
+}
+
+std::shared_ptr<HlsServer::Segmenter> HlsServer::findSegmenter(const std::string& path) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _segmenters.find(path);
+    return it != _segmenters.end() ? it->second : nullptr;
+}
+
+gboolean HlsServer::onRun(
+    GThreadedSocketService* /*service*/,
+    GSocketConnection* connection,
+    GObject* /*sourceObject*/,
+    gpointer userData)
+{
+    HlsServer* self = static_cast<HlsServer*>(userData);
+    self->handleConnection(connection);
+
+    return TRUE;
+}
+
+// called from service thread, so blocking io is fine.
+// connection is closed after single response (no keep-alive),
+// so idle clients don't hold service threads
+void HlsServer::handleConnection(GSocketConnection* connection)
+{
+    g_socket_set_timeout(
+        g_socket_connection_get_socket(connection),
+        CONNECTION_TIMEOUT_SEC);
+
+    GInputStream* in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream* out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+    std::string received;
+    char buffer[4096];
+    size_t headEnd;
+    while((headEnd = received.find("\r\n\r\n")) == std::string::npos) {
+        if(received.size() > MAX_REQUEST_HEAD_SIZE)
+            return;
+
+        const gssize size =
+            g_input_stream_read(in, buffer, sizeof(buffer), nullptr, nullptr);
+        if(size <= 0)
+            return;
+
+        received.append(buffer, size);
+    }
+
+    handleRequest(received.substr(0, headEnd), out);
+}
+
+void HlsServer::handleRequest(const std::string& head, GOutputStream* out)
+{
+    const size_t lineEnd = head.find("\r\n");
+    const std::string requestLine = head.substr(0, lineEnd);
+
+    const size_t methodEnd = requestLine.find(' ');
+    const size_t targetEnd =
+        methodEnd == std::string::npos ?
+            std::string::npos :
+            requestLine.find(' ', methodEnd + 1);
+    if(targetEnd == std::string::npos) {
+        WriteResponse(out, "400 Bad Request", "text/plain", std::string());
+        return;
+    }
+
+    const std::string method = requestLine.substr(0, methodEnd);
+    std::string target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+
+    if(method != "GET") {
+        WriteResponse(out, "405 Method Not Allowed", "text/plain", std::string());
+        return;
+    }
+
+    const size_t queryStart = target.find('?');
+    if(queryStart != std::string::npos)
+        target.resize(queryStart);
+
+    const size_t fileStart = target.rfind('/');
+    const std::string path = fileStart == std::string::npos ? std::string() : target.substr(0, fileStart);
+    const std::string file = fileStart == std::string::npos ? std::string() : target.substr(fileStart + 1);
+
+    std::shared_ptr<Segmenter> segmenter = path.empty() ? nullptr : findSegmenter(path);
+    if(segmenter && file == "index.m3u8") {
+        WriteResponse(
+            out, "200 OK", "application/vnd.apple.mpegurl",
+            segmenter->playlist());
+        return;
+    }
+
+    if(segmenter && g_str_has_suffix(file.c_str(), ".ts")) {
+        gchar* end = nullptr;
+        const guint64 sequence = g_ascii_strtoull(file.c_str(), &end, 10);
+        std::shared_ptr<const std::string> segment;
+        if(end && 0 == g_strcmp0(end, ".ts"))
+            segment = segmenter->segment(static_cast<unsigned>(sequence));
+        if(segment) {
+            WriteResponse(out, "200 OK", "video/mp2t", *segment);
+            return;
+        }
+    }
+
+    WriteResponse(out, "404 Not Found", "text/plain", std::string());
+}
+
+}
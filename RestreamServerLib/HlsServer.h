@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <gio/gio.h>
+
+#include "Options.h"
+
+
+namespace RestreamServerLib
+{
+
+// Serves paths to browsers as HLS over plain HTTP:
+// GET /<path>/index.m3u8 and GET /<path>/<sequence>.ts.
+// Every path gets single segmenter shared by all viewers,
+// muxing H264 stream of path's interpipesink to MPEG-TS without re-encoding.
+// Segments are kept in memory only.
+// Thread safe.
+class HlsServer
+{
+public:
+    explicit HlsServer(const HlsOptions&);
+    ~HlsServer();
+
+    // returns false if port can't be listened
+    bool start();
+
+    // proxyName is interpipesink name prefix of path (see Private::StreamProxyName),
+    // streamIndex is index of H264 stream of path. replaces existing segmenter of path
+    void addPath(const std::string& path, const std::string& proxyName, unsigned streamIndex);
+    void removePath(const std::string& path);
+
+private:
+    class Segmenter;
+
+    static gboolean onRun(
+        GThreadedSocketService*,
+        GSocketConnection*,
+        GObject* sourceObject,
+        gpointer userData);
+    void handleConnection(GSocketConnection*);
+    void handleRequest(const std::string& head, GOutputStream*);
+
+    std::shared_ptr<Segmenter> findSegmenter(const std::string& path) const;
+
+private:
+    const HlsOptions _options;
+
+    GSocketService* _service;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::shared_ptr<Segmenter>> _segmenters;
+};
+
+}
@@ -1,32 +1,92 @@
 #include "Log.h"
 
+#include <mutex>
+
+#include <spdlog/async.h>
 #include <spdlog/sinks/stdout_sinks.h>
 
 
 namespace RestreamServerLib
 {
 
-static std::shared_ptr<spdlog::logger> RestreamServer;
+namespace
+{
+
+// async loggers keep only weak reference to thread pool
+std::shared_ptr<spdlog::details::thread_pool> LogThreadPool;
 
-void InitLoggers()
+// loggers are shared by all servers of process
+std::once_flag LoggingConfigured;
+
+std::shared_ptr<spdlog::logger> MakeLogger(
+    const std::string& name,
+    const spdlog::sink_ptr& sink,
+    spdlog::level::level_enum level,
+    bool async)
 {
-    spdlog::sink_ptr sink = std::make_shared<spdlog::sinks::stderr_sink_st>();
+    std::shared_ptr<spdlog::logger> logger;
+    if(async) {
+        // streaming threads shouldn't wait stderr,
+        // so oldest records are dropped on queue overflow
+        logger =
+            std::make_shared<spdlog::async_logger>(
+                name, sink, LogThreadPool,
+                spdlog::async_overflow_policy::overrun_oldest);
+    } else
+        logger = std::make_shared<spdlog::logger>(name, sink);
+
+    logger->set_level(level);
+    logger->flush_on(spdlog::level::err);
 
-    RestreamServer = std::make_shared<spdlog::logger>("RestreamServerLib", sink);
+    return logger;
+}
+
+spdlog::sink_ptr DefaultSink()
+{
+    static spdlog::sink_ptr sink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
+    return sink;
+}
 
-#ifndef NDEBUG
-    RestreamServer->set_level(spdlog::level::debug);
-#else
-    RestreamServer->set_level(spdlog::level::info);
-#endif
 }
 
-const std::shared_ptr<spdlog::logger>& Log()
+namespace Private
 {
-    if(!RestreamServer)
-        InitLoggers();
 
-    return RestreamServer;
+std::shared_ptr<spdlog::logger> ServerLogger =
+    MakeLogger("RestreamServerLib", DefaultSink(), DefaultLogLevel, false);
+std::shared_ptr<spdlog::logger> AuthLogger =
+    MakeLogger("RestreamServerLib.Auth", DefaultSink(), DefaultLogLevel, false);
+std::shared_ptr<spdlog::logger> MediaLogger =
+    MakeLogger("RestreamServerLib.Media", DefaultSink(), DefaultLogLevel, false);
+
+}
+
+void ConfigureLogging(const LogOptions& options)
+{
+    bool configured = false;
+    std::call_once(
+        LoggingConfigured,
+        [&options, &configured] () {
+            if(options.async) {
+                LogThreadPool =
+                    std::make_shared<spdlog::details::thread_pool>(
+                        options.queueSize, 1);
+            }
+
+            const spdlog::sink_ptr sink = DefaultSink();
+
+            Private::ServerLogger =
+                MakeLogger("RestreamServerLib", sink, options.serverLevel, options.async);
+            Private::AuthLogger =
+                MakeLogger("RestreamServerLib.Auth", sink, options.authLevel, options.async);
+            Private::MediaLogger =
+                MakeLogger("RestreamServerLib.Media", sink, options.mediaLevel, options.async);
+
+            configured = true;
+        });
+
+    if(!configured)
+        Log()->debug("Logging is already configured, log options are ignored");
 }
 
 }
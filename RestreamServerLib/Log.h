@@ -6,10 +6,39 @@
 #define SPDLOG_ENABLE_SYSLOG 1
 #include <spdlog/spdlog.h>
 
+#include "Options.h"
+
+
+// trace calls from per buffer code paths are compiled out in release builds
+#if defined(NDEBUG) && !defined(ENABLE_TRACE_LOG)
+#define TRACE_LOG(logger, ...) (void)0
+#else
+#define TRACE_LOG(logger, ...) (logger)->trace(__VA_ARGS__)
+#endif
+
 
 namespace RestreamServerLib
 {
 
-const std::shared_ptr<spdlog::logger>& Log();
+namespace Private
+{
+extern std::shared_ptr<spdlog::logger> ServerLogger;
+extern std::shared_ptr<spdlog::logger> AuthLogger;
+extern std::shared_ptr<spdlog::logger> MediaLogger;
+}
+
+// server, mount points
+inline const std::shared_ptr<spdlog::logger>& Log()
+    { return Private::ServerLogger; }
+// authentication and authorization
+inline const std::shared_ptr<spdlog::logger>& AuthLog()
+    { return Private::AuthLogger; }
+// media pipelines and streaming threads
+inline const std::shared_ptr<spdlog::logger>& MediaLog()
+    { return Private::MediaLogger; }
+
+// replaces loggers, so should be called before any other thread uses them.
+// loggers are process wide, so only first call (i.e. first Server) takes effect
+void ConfigureLogging(const LogOptions&);
 
 }
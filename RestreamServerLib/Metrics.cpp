@@ -0,0 +1,509 @@
+#include "Metrics.h"
+
+#include <cstdio>
+#include <functional>
+#include <map>
+
+#include <unistd.h>
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+void UpdateMax(std::atomic<guint64>* max, guint64 value)
+{
+    guint64 current = max->load(std::memory_order_relaxed);
+    while(value > current &&
+          !max->compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+#if GST_CHECK_VERSION(1, 14, 0)
+GstCaps* IngestTimeCaps()
+{
+    static GstCaps* caps = nullptr;
+
+    static gsize initialized = 0;
+    if(g_once_init_enter(&initialized)) {
+        caps = gst_caps_new_empty_simple("timestamp/x-restream-ingest");
+        GST_MINI_OBJECT_FLAG_SET(caps, GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);
+        g_once_init_leave(&initialized, 1);
+    }
+
+    return caps;
+}
+#endif
+
+struct StageProbeData
+{
+    std::shared_ptr<PathMetrics> metrics;
+    TraceStage stage;
+};
+
+struct TransitProbeData
+{
+    std::shared_ptr<PathMetrics> metrics;
+    TraceStage stage;
+    std::atomic<gint64> entryTime { 0 };
+};
+
+struct ElementsFootprintData
+{
+    std::shared_ptr<PathMetrics> metrics;
+    gint elements;
+};
+
+struct CountingProbeData
+{
+    std::shared_ptr<PathMetrics> metrics;
+    PathMetrics::Counter PathMetrics::* bytes;
+    PathMetrics::Counter PathMetrics::* packets;
+};
+
+// -1 if not available
+gint64 ResidentBytes()
+{
+    gchar* statm = nullptr;
+    if(!g_file_get_contents("/proc/self/statm", &statm, nullptr, nullptr))
+        return -1;
+
+    // size resident shared text lib data dt (in pages)
+    unsigned long long size = 0, resident = 0;
+    const bool parsed = 2 == sscanf(statm, "%llu %llu", &size, &resident);
+    g_free(statm);
+
+    return parsed ? static_cast<gint64>(resident * sysconf(_SC_PAGESIZE)) : -1;
+}
+
+std::string EscapeLabel(const std::string& value)
+{
+    std::string escaped;
+    escaped.reserve(value.size());
+    for(char c: value) {
+        switch(c) {
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            default:
+                escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+}
+
+const guint64 LatencyHistogram::BoundsUs[LatencyHistogram::BOUNDS_COUNT] = {
+    1000, 2000, 5000, 10000, 20000, 50000,
+    100000, 200000, 500000, 1000000, 2000000, 5000000,
+};
+
+void LatencyHistogram::observe(guint64 latencyUs)
+{
+    unsigned bucket = 0;
+    while(bucket < BOUNDS_COUNT && latencyUs > BoundsUs[bucket])
+        ++bucket;
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(latencyUs, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PathMetrics::observeStage(TraceStage stage, gint64 startUs, gint64 endUs)
+{
+    const gint64 latencyUs = endUs > startUs ? endUs - startUs : 0;
+    stageLatency[static_cast<unsigned>(stage)].observe(latencyUs);
+
+    if(tracer)
+        tracer->record(tracePathId, stage, startUs, latencyUs);
+}
+
+void PathMetrics::AddStageProbe(
+    GstPad* pad,
+    const std::shared_ptr<PathMetrics>& metrics,
+    TraceStage stage)
+{
+    gst_pad_add_probe(
+        pad,
+        GST_PAD_PROBE_TYPE_BUFFER,
+        [] (GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            const StageProbeData* data = static_cast<const StageProbeData*>(userData);
+
+            const gint64 ingestTime = Metrics::IngestTime(GST_PAD_PROBE_INFO_BUFFER(info));
+            if(ingestTime > 0)
+                data->metrics->observeStage(data->stage, ingestTime, g_get_monotonic_time());
+
+            return GST_PAD_PROBE_OK;
+        },
+        new StageProbeData { metrics, stage },
+        [] (gpointer userData) {
+            delete static_cast<StageProbeData*>(userData);
+        });
+}
+
+void PathMetrics::AddTransitProbes(
+    GstPad* entryPad,
+    GstPad* exitPad,
+    const std::shared_ptr<PathMetrics>& metrics,
+    TraceStage stage)
+{
+    // shared by both probes, freed with the last one
+    std::shared_ptr<TransitProbeData>* dataPtr =
+        new std::shared_ptr<TransitProbeData>(new TransitProbeData { metrics, stage });
+    auto destroy =
+        [] (gpointer userData) {
+            delete static_cast<std::shared_ptr<TransitProbeData>*>(userData);
+        };
+
+    gst_pad_add_probe(
+        entryPad,
+        GST_PAD_PROBE_TYPE_BUFFER,
+        [] (GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer userData) -> GstPadProbeReturn {
+            TransitProbeData& data = **static_cast<std::shared_ptr<TransitProbeData>*>(userData);
+            data.entryTime.store(g_get_monotonic_time(), std::memory_order_relaxed);
+
+            return GST_PAD_PROBE_OK;
+        },
+        dataPtr, destroy);
+    gst_pad_add_probe(
+        exitPad,
+        GST_PAD_PROBE_TYPE_BUFFER,
+        [] (GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer userData) -> GstPadProbeReturn {
+            TransitProbeData& data = **static_cast<std::shared_ptr<TransitProbeData>*>(userData);
+            const gint64 entryTime = data.entryTime.load(std::memory_order_relaxed);
+            if(entryTime > 0)
+                data.metrics->observeStage(data.stage, entryTime, g_get_monotonic_time());
+
+            return GST_PAD_PROBE_OK;
+        },
+        new std::shared_ptr<TransitProbeData>(*dataPtr), destroy);
+}
+
+void PathMetrics::observeLatency(guint64 latencyUs)
+{
+    latencySumUs.fetch_add(latencyUs, std::memory_order_relaxed);
+    latencyCount.fetch_add(1, std::memory_order_relaxed);
+    UpdateMax(&latencyMaxUs, latencyUs);
+}
+
+void PathMetrics::AddCountingProbe(
+    GstPad* pad,
+    const std::shared_ptr<PathMetrics>& metrics,
+    Counter PathMetrics::* bytes,
+    Counter PathMetrics::* packets)
+{
+    gst_pad_add_probe(
+        pad,
+        static_cast<GstPadProbeType>(
+            GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        [] (GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            const CountingProbeData* data = static_cast<const CountingProbeData*>(userData);
+            PathMetrics& metrics = *data->metrics;
+
+            if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+                GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+                (metrics.*data->bytes).fetch_add(
+                    gst_buffer_get_size(buffer), std::memory_order_relaxed);
+                (metrics.*data->packets).fetch_add(1, std::memory_order_relaxed);
+            } else if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+                GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+                (metrics.*data->bytes).fetch_add(
+                    gst_buffer_list_calculate_size(list), std::memory_order_relaxed);
+                (metrics.*data->packets).fetch_add(
+                    gst_buffer_list_length(list), std::memory_order_relaxed);
+            }
+
+            return GST_PAD_PROBE_OK;
+        },
+        new CountingProbeData { metrics, bytes, packets },
+        [] (gpointer userData) {
+            delete static_cast<CountingProbeData*>(userData);
+        });
+}
+
+void PathMetrics::TrackElements(
+    GstElement* bin,
+    const std::shared_ptr<PathMetrics>& metrics)
+{
+    if(!GST_IS_BIN(bin))
+        return;
+
+    // elements added later (f.e. by rtspsrc) are not counted
+    gint elements = 1;
+    GstIterator* it = gst_bin_iterate_recurse(GST_BIN(bin));
+    gst_iterator_foreach(
+        it,
+        [] (const GValue* /*item*/, gpointer userData) {
+            ++*static_cast<gint*>(userData);
+        },
+        &elements);
+    gst_iterator_free(it);
+
+    metrics->elements.fetch_add(elements, std::memory_order_relaxed);
+
+    g_object_weak_ref(
+        G_OBJECT(bin),
+        [] (gpointer userData, GObject* /*bin*/) {
+            ElementsFootprintData* data = static_cast<ElementsFootprintData*>(userData);
+            data->metrics->elements.fetch_sub(data->elements, std::memory_order_relaxed);
+            delete data;
+        },
+        new ElementsFootprintData { metrics, elements });
+}
+
+std::shared_ptr<PathMetrics> Metrics::addPath(
+    const std::string& path,
+    const std::shared_ptr<const GopCache>& gopCache)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::shared_ptr<PathMetrics>& metrics = _paths[path];
+    if(!metrics) {
+        metrics = std::make_shared<PathMetrics>();
+        metrics->path = path;
+        metrics->gopCache = gopCache;
+        metrics->tracing = _tracing;
+        metrics->tracer = _tracer;
+        if(_tracer)
+            metrics->tracePathId = _tracer->addPath(path);
+    }
+
+    return metrics;
+}
+
+void Metrics::enableTracing(unsigned maxEvents)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _tracing = true;
+    if(maxEvents)
+        _tracer = std::make_shared<Tracer>(maxEvents);
+}
+
+std::string Metrics::chromeTrace() const
+{
+    std::shared_ptr<Tracer> tracer;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        tracer = _tracer;
+    }
+
+    return tracer ? tracer->chromeTrace() : std::string();
+}
+
+void Metrics::removePath(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _paths.find(path);
+    if(it == _paths.end())
+        return;
+
+    if(it->second->tracer)
+        it->second->tracer->removePath(it->second->tracePathId);
+
+    _paths.erase(it);
+}
+
+void Metrics::observeAuthLatency(guint64 latencyUs)
+{
+    _authLatencySumUs.fetch_add(latencyUs, std::memory_order_relaxed);
+    _authLatencyCount.fetch_add(1, std::memory_order_relaxed);
+    UpdateMax(&_authLatencyMaxUs, latencyUs);
+}
+
+void Metrics::updateBitrates()
+{
+    const gint64 now = g_get_monotonic_time();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(const auto& pair: _paths) {
+        PathMetrics& metrics = *pair.second;
+
+        const guint64 bytesIn = metrics.bytesIn.load(std::memory_order_relaxed);
+        if(metrics.lastBitrateTime && now > metrics.lastBitrateTime) {
+            const guint64 bitrate =
+                (bytesIn - metrics.lastBytesIn) * 8 * G_USEC_PER_SEC /
+                    (now - metrics.lastBitrateTime);
+            const guint64 smoothed = metrics.bitrateIn.load(std::memory_order_relaxed);
+            // exponential moving average, to not react on every key frame
+            metrics.bitrateIn.store(
+                smoothed ? (smoothed * 3 + bitrate) / 4 : bitrate,
+                std::memory_order_relaxed);
+        }
+
+        metrics.lastBytesIn = bytesIn;
+        metrics.lastBitrateTime = now;
+    }
+}
+
+std::string Metrics::prometheus() const
+{
+    // sorted, to make output stable
+    std::map<std::string, std::shared_ptr<PathMetrics>> paths;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        paths.insert(_paths.begin(), _paths.end());
+    }
+
+    std::string out;
+
+    auto gauge =
+        [&out] (const char* name, const char* help, gint64 value) {
+            out += fmt::format(
+                "# HELP {0} {1}\n"
+                "# TYPE {0} gauge\n"
+                "{0} {2}\n",
+                name, help, value);
+        };
+    auto pathFamily =
+        [&out, &paths] (
+            const char* name,
+            const char* type,
+            const char* help,
+            const std::function<double (const PathMetrics&)>& value)
+        {
+            out += fmt::format(
+                "# HELP {0} {1}\n"
+                "# TYPE {0} {2}\n",
+                name, help, type);
+            for(const auto& pair: paths) {
+                out += fmt::format(
+                    "{}{{path=\"{}\"}} {}\n",
+                    name, EscapeLabel(pair.first), value(*pair.second));
+            }
+        };
+    auto load =
+        [] (const PathMetrics::Counter& counter) {
+            return static_cast<double>(counter.load(std::memory_order_relaxed));
+        };
+
+    gauge("restream_players", "Active play sessions", players.load());
+    gauge("restream_recorders", "Active record sessions", recorders.load());
+    gauge("restream_paths", "Paths having mount point", static_cast<gint64>(paths.size()));
+
+    pathFamily("restream_path_bytes_in_total", "counter", "Bytes received from recorder",
+        [&load] (const PathMetrics& m) { return load(m.bytesIn); });
+    pathFamily("restream_path_packets_in_total", "counter", "Buffers received from recorder",
+        [&load] (const PathMetrics& m) { return load(m.packetsIn); });
+    pathFamily("restream_path_bitrate_in_bps", "gauge", "Smoothed bitrate received from recorder",
+        [] (const PathMetrics& m) { return static_cast<double>(m.bitrateIn.load(std::memory_order_relaxed)); });
+    pathFamily("restream_path_bytes_out_total", "counter", "Bytes payloaded for players",
+        [&load] (const PathMetrics& m) { return load(m.bytesOut); });
+    pathFamily("restream_path_packets_out_total", "counter", "RTP packets payloaded for players",
+        [&load] (const PathMetrics& m) { return load(m.packetsOut); });
+    pathFamily("restream_path_latency_seconds_sum", "counter", "Recorder to player latency sum",
+        [&load] (const PathMetrics& m) { return load(m.latencySumUs) / G_USEC_PER_SEC; });
+    pathFamily("restream_path_latency_seconds_count", "counter", "Recorder to player latency samples",
+        [&load] (const PathMetrics& m) { return load(m.latencyCount); });
+    pathFamily("restream_path_latency_seconds_max", "gauge", "Max recorder to player latency",
+        [&load] (const PathMetrics& m) { return load(m.latencyMaxUs) / G_USEC_PER_SEC; });
+    pathFamily("restream_path_switches_to_source_total", "counter", "Switches from splash screen to source",
+        [&load] (const PathMetrics& m) { return load(m.switchesToSource); });
+    pathFamily("restream_path_switches_to_splash_total", "counter", "Switches from source to splash screen",
+        [&load] (const PathMetrics& m) { return load(m.switchesToSplash); });
+    pathFamily("restream_path_splash_active", "gauge", "Splash screen is shown to players",
+        [] (const PathMetrics& m) { return m.splashActive.load(std::memory_order_relaxed); });
+    pathFamily("restream_path_elements", "gauge", "Elements of record and play pipelines",
+        [] (const PathMetrics& m) { return m.elements.load(std::memory_order_relaxed); });
+    pathFamily("restream_path_gop_cache_bytes", "gauge", "Bytes held by GOP cache",
+        [] (const PathMetrics& m) {
+            const std::shared_ptr<const GopCache> gopCache = m.gopCache.lock();
+            return gopCache ? static_cast<double>(gopCache->bytes()) : 0.;
+        });
+    pathFamily("restream_path_pooled_access_units_total", "counter", "Access units copied to pooled buffers",
+        [&load] (const PathMetrics& m) { return load(m.pooledUnits); });
+    pathFamily("restream_path_unpooled_access_units_total", "counter", "Access units passed as is (too large or pool exhausted)",
+        [&load] (const PathMetrics& m) { return load(m.unpooledUnits); });
+
+    const gint64 residentBytes = ResidentBytes();
+    if(residentBytes >= 0)
+        gauge("restream_process_resident_bytes", "Resident set size of process", residentBytes);
+
+    bool tracing;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        tracing = _tracing;
+    }
+    if(tracing) {
+        out +=
+            "# HELP restream_path_stage_latency_seconds "
+            "Latency since ingest at pipeline stage (record stage: depayloading)\n"
+            "# TYPE restream_path_stage_latency_seconds histogram\n";
+        for(const auto& pair: paths) {
+            const std::string path = EscapeLabel(pair.first);
+            for(unsigned stage = 0; stage < static_cast<unsigned>(TraceStage::COUNT); ++stage) {
+                const LatencyHistogram& histogram = pair.second->stageLatency[stage];
+                const char* stageName = TraceStageName(static_cast<TraceStage>(stage));
+
+                guint64 cumulative = 0;
+                for(unsigned bucket = 0; bucket <= LatencyHistogram::BOUNDS_COUNT; ++bucket) {
+                    cumulative += histogram.buckets[bucket].load(std::memory_order_relaxed);
+                    const std::string le =
+                        bucket < LatencyHistogram::BOUNDS_COUNT ?
+                            fmt::format("{}", static_cast<double>(LatencyHistogram::BoundsUs[bucket]) / G_USEC_PER_SEC) :
+                            std::string("+Inf");
+                    out += fmt::format(
+                        "restream_path_stage_latency_seconds_bucket{{path=\"{}\",stage=\"{}\",le=\"{}\"}} {}\n",
+                        path, stageName, le, cumulative);
+                }
+                out += fmt::format(
+                    "restream_path_stage_latency_seconds_sum{{path=\"{}\",stage=\"{}\"}} {}\n"
+                    "restream_path_stage_latency_seconds_count{{path=\"{}\",stage=\"{}\"}} {}\n",
+                    path, stageName,
+                    static_cast<double>(histogram.sumUs.load(std::memory_order_relaxed)) / G_USEC_PER_SEC,
+                    path, stageName,
+                    histogram.count.load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    out += fmt::format(
+        "# HELP restream_auth_latency_seconds Authentication and authorization callbacks latency\n"
+        "# TYPE restream_auth_latency_seconds summary\n"
+        "restream_auth_latency_seconds_sum {}\n"
+        "restream_auth_latency_seconds_count {}\n"
+        "# HELP restream_auth_latency_seconds_max Max authentication and authorization callbacks latency\n"
+        "# TYPE restream_auth_latency_seconds_max gauge\n"
+        "restream_auth_latency_seconds_max {}\n",
+        static_cast<double>(_authLatencySumUs.load()) / G_USEC_PER_SEC,
+        _authLatencyCount.load(),
+        static_cast<double>(_authLatencyMaxUs.load()) / G_USEC_PER_SEC);
+
+    return out;
+}
+
+void Metrics::StampIngestTime(GstBuffer* buffer)
+{
+#if GST_CHECK_VERSION(1, 14, 0)
+    gst_buffer_add_reference_timestamp_meta(
+        buffer, IngestTimeCaps(),
+        g_get_monotonic_time() * GST_USECOND, GST_CLOCK_TIME_NONE);
+#endif
+}
+
+gint64 Metrics::IngestTime(GstBuffer* buffer)
+{
+#if GST_CHECK_VERSION(1, 14, 0)
+    GstReferenceTimestampMeta* meta =
+        gst_buffer_get_reference_timestamp_meta(buffer, IngestTimeCaps());
+    if(meta)
+        return meta->timestamp / GST_USECOND;
+#endif
+
+    return 0;
+}
+
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <gst/gst.h>
+
+#include "Tracing.h"
+#include "GopCache.h"
+
+
+namespace RestreamServerLib
+{
+
+// Fixed buckets from 1ms to 5s. Lock-free.
+struct LatencyHistogram
+{
+    static const unsigned BOUNDS_COUNT = 12;
+    // upper bounds, last bucket is +Inf
+    static const guint64 BoundsUs[BOUNDS_COUNT];
+
+    std::atomic<guint64> buckets[BOUNDS_COUNT + 1] {};
+    std::atomic<guint64> sumUs { 0 };
+    std::atomic<guint64> count { 0 };
+
+    void observe(guint64 latencyUs);
+};
+
+// Counters updated from streaming threads. Lock-free.
+struct PathMetrics
+{
+    typedef std::atomic<guint64> Counter;
+
+    // recorder -> server
+    Counter bytesIn { 0 };
+    Counter packetsIn { 0 };
+
+    // payloaded for players (play media is shared by all players of path)
+    Counter bytesOut { 0 };
+    Counter packetsOut { 0 };
+
+    // buffer ingest -> play media selector
+    Counter latencySumUs { 0 };
+    Counter latencyCount { 0 };
+    Counter latencyMaxUs { 0 };
+
+    // bits per second, smoothed. updated by Metrics::updateBitrates
+    std::atomic<guint64> bitrateIn { 0 };
+    // Metrics::updateBitrates only
+    guint64 lastBytesIn = 0;
+    gint64 lastBitrateTime = 0;
+
+    Counter switchesToSource { 0 };
+    Counter switchesToSplash { 0 };
+    std::atomic<gint> splashActive { 0 };
+
+    // footprint. elements of prepared record and play pipelines
+    std::atomic<gint> elements { 0 };
+    // access units copied to AccessUnitPool buffers or passed as is
+    Counter pooledUnits { 0 };
+    Counter unpooledUnits { 0 };
+
+    // set by Metrics::addPath
+    std::string path;
+    std::weak_ptr<const GopCache> gopCache;
+    bool tracing = false;
+    std::shared_ptr<Tracer> tracer;
+    uint32_t tracePathId = 0;
+    LatencyHistogram stageLatency[static_cast<unsigned>(TraceStage::COUNT)];
+
+    void observeLatency(guint64 latencyUs);
+    void observeStage(TraceStage, gint64 startUs, gint64 endUs);
+
+    // pad probe observing stage latency since buffer ingest time
+    static void AddStageProbe(GstPad*, const std::shared_ptr<PathMetrics>&, TraceStage);
+    // pad probes observing time from last buffer entered entryPad
+    // till buffer leaves exitPad (f.e. last RTP packet of frame -> depayloaded frame)
+    static void AddTransitProbes(
+        GstPad* entryPad,
+        GstPad* exitPad,
+        const std::shared_ptr<PathMetrics>&,
+        TraceStage);
+
+    // counts elements of bin (recursively) into elements while bin is alive
+    static void TrackElements(GstElement* bin, const std::shared_ptr<PathMetrics>&);
+
+    // pad probe counting buffers passing srcPad into given counters
+    static void AddCountingProbe(
+        GstPad*,
+        const std::shared_ptr<PathMetrics>&,
+        Counter PathMetrics::* bytes,
+        Counter PathMetrics::* packets);
+};
+
+class Metrics
+{
+public:
+    // path metrics live while path has mount point
+    std::shared_ptr<PathMetrics> addPath(
+        const std::string& path,
+        const std::shared_ptr<const GopCache>& = nullptr);
+    void removePath(const std::string& path);
+
+    std::atomic<gint> players { 0 };
+    std::atomic<gint> recorders { 0 };
+
+    // applies to paths added after call
+    void enableTracing(unsigned maxEvents);
+    // empty string if stage events are not kept
+    std::string chromeTrace() const;
+
+    void observeAuthLatency(guint64 latencyUs);
+
+    // should be called periodically (every second f.e.)
+    void updateBitrates();
+
+    // Prometheus text exposition format
+    std::string prometheus() const;
+
+    // marks buffer with ingest time to measure latency on play side.
+    // buffer should be writable
+    static void StampIngestTime(GstBuffer*);
+    // 0 if buffer is not marked
+    static gint64 IngestTime(GstBuffer*);
+
+private:
+    std::atomic<guint64> _authLatencySumUs { 0 };
+    std::atomic<guint64> _authLatencyCount { 0 };
+    std::atomic<guint64> _authLatencyMaxUs { 0 };
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::shared_ptr<PathMetrics>> _paths;
+    bool _tracing = false;
+    std::shared_ptr<Tracer> _tracer;
+};
+
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <spdlog/common.h>
+
+namespace RestreamServerLib
+{
+
+struct ThreadPoolOptions
+{
+    // max count of threads used to handle clients connections.
+    // 0 means clients are handled in server's main context
+    unsigned maxThreads = 1;
+
+    // every client gets own thread (maxThreads is ignored)
+    bool threadPerClient = false;
+};
+
+enum class SplashMode {
+    // splash screen is pulled from static server via rtsp
+    LOOPBACK,
+    // splash screen is taken from interpipesink shared by all paths
+    INTERPIPE,
+};
+
+enum class H264EncoderType {
+    // first working of hardware encoders, x264enc if none
+    AUTO,
+    X264,
+    VAAPI,
+    NVENC,
+    V4L2,
+};
+
+struct SplashOptions
+{
+    SplashMode mode = SplashMode::LOOPBACK;
+
+    // encoder of static sources and splash screens.
+    // not available encoder falls back to x264enc
+    H264EncoderType encoder = H264EncoderType::AUTO;
+
+    // splash screens are encoded once at startup
+    // and replayed from memory instead of live encoding
+    bool cached = false;
+
+    // h264 elementary stream used as splash screen instead of encoded one.
+    // used only if cached is set
+    std::string file;
+};
+
+struct SourceOptions
+{
+    // splash screen is shown if source didn't produce data for this time
+    unsigned timeoutMs = 2000;
+    // how often all sources are checked for timeout
+    unsigned checkPeriodMs = 500;
+};
+
+struct GopCacheOptions
+{
+    // keep access units since last key frame of recorded H264 stream
+    // to prime new players with it
+    bool enabled = false;
+    size_t maxPathBytes = 8 * 1024 * 1024;
+    size_t maxTotalBytes = 256 * 1024 * 1024;
+};
+
+struct AuthCacheOptions
+{
+    // how long authentication and authorization results are reused.
+    // 0 disables cache
+    unsigned ttlMs = 30000;
+    size_t maxEntries = 10000;
+};
+
+struct MulticastOptions
+{
+    // address pool for paths with multicast enabled by Callbacks::multicast.
+    // every stream of such path gets own group from pool
+    std::string minAddress = "224.3.0.0";
+    std::string maxAddress = "224.3.0.255";
+    unsigned short minPort = 5000;
+    unsigned short maxPort = 5999;
+    unsigned ttl = 16;
+};
+
+struct TransportOptions
+{
+    // RTP packets of every video frame are passed to UDP sink as one buffer list,
+    // so it's sent to all UDP players of shared play media with single sendmmsg call
+    // instead of one syscall per packet per player
+    bool batchUdp = false;
+
+    // every TCP interleaved player gets own queue instead of
+    // pushing back on media shared with other players.
+    // on overflow non-reference frames are dropped first,
+    // then everything up to next key frame.
+    // applied to players started after change. 0 disables queue
+    size_t tcpQueueBytes = 0;
+    unsigned tcpQueueLatencyMs = 2000;
+};
+
+#ifndef NDEBUG
+const spdlog::level::level_enum DefaultLogLevel = spdlog::level::debug;
+#else
+const spdlog::level::level_enum DefaultLogLevel = spdlog::level::info;
+#endif
+
+// process wide, applied by first Server only
+struct LogOptions
+{
+    // records are formatted and written to stderr from separate thread
+    bool async = true;
+    // records queue size (power of 2). oldest records are dropped on overflow
+    size_t queueSize = 8192;
+
+    spdlog::level::level_enum serverLevel = DefaultLogLevel;
+    spdlog::level::level_enum authLevel = DefaultLogLevel;
+    spdlog::level::level_enum mediaLevel = DefaultLogLevel;
+};
+
+struct BandwidthOptions
+{
+    // PLAY and RECORD are rejected with 453 Not Enough Bandwidth
+    // if projected bitrate (measured bitrate of recorded paths multiplied by players count)
+    // would exceed budget. 0 disables check
+    unsigned egressBudgetKbps = 0;
+    unsigned ingressBudgetKbps = 0;
+    // assumed bitrate of recorder until it's measured
+    unsigned defaultRecordKbps = 4000;
+};
+
+enum class ClusterMode {
+    // every node serves only paths recorded to it
+    DISABLED,
+    // players of paths owned by other node are redirected to it
+    REDIRECT,
+    // paths owned by other node are pulled from it once and fanned out locally
+    RELAY,
+};
+
+struct ClusterOptions
+{
+    // path owner is resolved with Callbacks::pathOwner
+    ClusterMode mode = ClusterMode::DISABLED;
+};
+
+struct MediaPoolOptions
+{
+    // mount point of path is kept this long after last client left,
+    // so reconnecting clients reuse it
+    unsigned lingerMs = 0;
+    // pre-built pipelines kept per pipeline description
+    // for prebuiltDescriptions most recently used descriptions.
+    // Used only by mount points reused later (lingerMs > 0 or preregisteredPaths).
+    // 0 disables pool
+    unsigned prebuiltPerDescription = 0;
+    unsigned prebuiltDescriptions = 64;
+    // mount points created on start and kept without clients,
+    // so recorders reconnecting after restart don't build them.
+    // Such paths are considered recorded to this node
+    std::vector<std::string> preregisteredPaths;
+};
+
+enum class ArchiveFormat {
+    MPEG_TS,
+    // fragments are flushed as they are written,
+    // so unfinished segment stays playable
+    FRAGMENTED_MP4,
+};
+
+struct ArchiveOptions
+{
+    // applied to paths selected by Callbacks::archive
+    ArchiveFormat format = ArchiveFormat::MPEG_TS;
+    // segments are rotated on first key frame after this time
+    unsigned segmentDurationSec = 60;
+    // archive branch drops data instead of blocking live stream
+    // if disk doesn't keep up for this time
+    unsigned maxQueueMs = 5000;
+    // files are written with chunks of this size
+    unsigned writeBufferBytes = 1024 * 1024;
+};
+
+// selected per path by Callbacks::latencyProfile
+struct LatencyProfile
+{
+    // jitterbuffer latency of RECORD streams receive
+    // and of rtspsrc pulling splash screen or remote source.
+    // -1 keeps defaults
+    int jitterLatencyMs = -1;
+    // recorded stream is synced to clock before passing it to players.
+    // without sync frames are passed as soon as they are received
+    bool sync = true;
+    // lost packets are requested from recorder or remote source,
+    // and are kept for players to request them.
+    // false keeps defaults
+    bool retransmission = false;
+};
+
+struct HlsOptions
+{
+    // HTTP port paths selected by Callbacks::hls are served on. 0 disables HLS
+    unsigned short port = 0;
+    // threads handling HTTP connections
+    unsigned maxThreads = 16;
+    // segments kept in memory and listed in playlist per path
+    unsigned segmentsCount = 6;
+    // segments are cut on first key frame after this time
+    unsigned minSegmentMs = 2000;
+};
+
+struct MemoryOptions
+{
+    // parsed video access units of recorded paths are copied to buffers
+    // recycled from pool shared by all paths, instead of allocating every frame.
+    // Access units larger than poolBufferBytes or not fitting to exhausted pool
+    // are passed as is. 0 disables pool
+    unsigned poolBuffers = 0;
+    size_t poolBufferBytes = 64 * 1024;
+    // splash screen input-selector keeps buffers of inactive input
+    // to switch without gap. Could be disabled to save memory of every play media
+    // (GOP cache primes players switched to source anyway)
+    bool selectorCacheBuffers = true;
+    // freed heap memory is returned to system this often (glibc only). 0 disables
+    unsigned trimIntervalSec = 0;
+};
+
+struct TracingOptions
+{
+    // per-stage latency histograms of record and play pipelines.
+    // Pad probes are not installed if disabled
+    bool enabled = false;
+    // last stage events kept for Server::chromeTrace. 0 - histograms only
+    unsigned maxEvents = 0;
+};
+
+struct ListenOptions
+{
+    // already listening sockets used instead of ports, -1 if not given.
+    // F.e. from systemd socket activation or from instance handing over it's sockets
+    int staticFd = -1;
+    int restreamFd = -1;
+    // ports are listened with SO_REUSEPORT, so several processes could share them
+    bool reusePort = false;
+    // additional restream port unique to this process,
+    // f.e. for players redirected between workers sharing port. 0 - disabled
+    unsigned short directPort = 0;
+};
+
+struct DrainOptions
+{
+    // players are sent REDIRECT to redirectUrl + path (f.e. "rtsp://node2:8001")
+    // before disconnect if set
+    std::string redirectUrl;
+    // players are disconnected this long after REDIRECT
+    unsigned playersGraceMs = 1000;
+    // recorders are disconnected if they don't leave in this time
+    unsigned timeoutMs = 30000;
+};
+
+// limits and timeouts which could be changed by Server::reconfigure without restart
+struct RuntimeOptions
+{
+    // 0 means unlimited.
+    // preregistered paths are counted only while they have clients
+    unsigned maxPathsCount = 0;
+    unsigned maxClientsPerPath = 0;
+
+    SourceOptions source;
+    // applied to paths mounted after change
+    TransportOptions transport;
+    BandwidthOptions bandwidth;
+};
+
+struct Options
+{
+    ThreadPoolOptions threadPool;
+    SplashOptions splash;
+    SourceOptions source;
+    GopCacheOptions gopCache;
+    AuthCacheOptions authCache;
+    LogOptions log;
+    MulticastOptions multicast;
+    TransportOptions transport;
+    BandwidthOptions bandwidth;
+    ClusterOptions cluster;
+    MediaPoolOptions mediaPool;
+    ArchiveOptions archive;
+    HlsOptions hls;
+    ListenOptions listen;
+    TracingOptions tracing;
+    MemoryOptions memory;
+};
+
+}
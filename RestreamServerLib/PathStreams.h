@@ -0,0 +1,54 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+
+namespace RestreamServerLib
+{
+
+enum class Codec {
+    H264,
+    H265,
+    AAC,
+    OPUS,
+};
+
+typedef std::vector<Codec> Codecs;
+
+// Streams of the path as announced by recorder.
+// Filled by record factory and used by play factory to mirror record streams.
+// Reset when record media is unprepared.
+class PathStreams
+{
+public:
+    // returns generation to reset exactly these codecs later
+    unsigned set(const Codecs& codecs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _codecs = codecs;
+        return ++_generation;
+    }
+
+    // does nothing if codecs were set again after generation
+    void reset(unsigned generation)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(generation == _generation)
+            _codecs.clear();
+    }
+
+    // empty if recorder didn't announce streams yet
+    Codecs get() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _codecs;
+    }
+
+private:
+    mutable std::mutex _mutex;
+    Codecs _codecs;
+    unsigned _generation = 0;
+};
+
+}
@@ -0,0 +1,448 @@
+#include "PlayerQueue.h"
+
+#include <iterator>
+
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+enum {
+    H264_NAL_IDR = 5,
+    H264_NAL_SPS = 7,
+    H264_NAL_STAP_A = 24,
+    H264_NAL_FU_A = 28,
+};
+
+// RTP payload of H264 (RFC 6184)
+void ClassifyH264(
+    GstBuffer* buffer,
+    bool* keyFrameStart,
+    bool* nonReference,
+    guint32* timestamp)
+{
+    *keyFrameStart = false;
+    *nonReference = false;
+    *timestamp = 0;
+
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if(!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+        return;
+
+    // all packets of frame have the same timestamp
+    *timestamp = gst_rtp_buffer_get_timestamp(&rtp);
+
+    const guint8* payload = static_cast<const guint8*>(gst_rtp_buffer_get_payload(&rtp));
+    const guint size = gst_rtp_buffer_get_payload_len(&rtp);
+    if(size > 0) {
+        const guint8 type = payload[0] & 0x1f;
+        *nonReference = 0 == (payload[0] & 0x60);
+
+        if(H264_NAL_FU_A == type) {
+            *keyFrameStart =
+                size > 1 &&
+                (payload[1] & 0x80) &&
+                H264_NAL_IDR == (payload[1] & 0x1f);
+        } else if(H264_NAL_STAP_A == type) {
+            // first aggregated NAL goes after 2 bytes size
+            const guint8 firstType = size > 3 ? payload[3] & 0x1f : 0;
+            *keyFrameStart = H264_NAL_SPS == firstType || H264_NAL_IDR == firstType;
+        } else {
+            *keyFrameStart = H264_NAL_SPS == type || H264_NAL_IDR == type;
+        }
+    }
+
+    gst_rtp_buffer_unmap(&rtp);
+}
+
+GQuark PlayerQueueQuark()
+{
+    static GQuark quark = g_quark_from_static_string("restream-player-queue");
+    return quark;
+}
+
+typedef std::shared_ptr<PlayerQueue> PlayerQueuePtr;
+typedef std::weak_ptr<PlayerQueue> PlayerQueueWeakPtr;
+
+#if GST_CHECK_VERSION(1, 18, 0)
+// kept as qdata of client's transport, so lives as long as it
+struct QueueTransport
+{
+    GstRTSPStreamTransport* transport;
+    PlayerQueueWeakPtr queue;
+};
+
+bool IsH264(GstRTSPStream* stream)
+{
+    GstCaps* caps = gst_rtsp_stream_get_caps(stream);
+    if(!caps)
+        return false;
+
+    const GstStructure* structure = gst_caps_get_structure(caps, 0);
+    const bool h264 =
+        structure &&
+        0 == g_strcmp0(gst_structure_get_string(structure, "encoding-name"), "H264");
+    gst_caps_unref(caps);
+
+    return h264;
+}
+
+// only fields used by stream for TCP interleaved transport
+GstRTSPTransport* CopyTcpTransport(const GstRTSPTransport* transport)
+{
+    GstRTSPTransport* copy = nullptr;
+    gst_rtsp_transport_new(&copy);
+
+    copy->trans = transport->trans;
+    copy->profile = transport->profile;
+    copy->lower_transport = transport->lower_transport;
+    copy->mode_play = transport->mode_play;
+    copy->mode_record = transport->mode_record;
+    copy->interleaved = transport->interleaved;
+
+    return copy;
+}
+#endif
+
+}
+
+void PlayerQueue::Attach(
+    GstRTSPClient*,
+    GstRTSPSessionMedia* sessionMedia,
+    const TransportOptions& options)
+{
+#if GST_CHECK_VERSION(1, 18, 0)
+    GstRTSPMedia* media = gst_rtsp_session_media_get_media(sessionMedia);
+    const guint streamsCount = gst_rtsp_media_n_streams(media);
+    for(guint i = 0; i < streamsCount; ++i) {
+        GstRTSPStreamTransport* transport =
+            gst_rtsp_session_media_get_transport(sessionMedia, i);
+        if(!transport)
+            continue;
+
+        const GstRTSPTransport* rtspTransport =
+            gst_rtsp_stream_transport_get_transport(transport);
+        if(!rtspTransport || GST_RTSP_LOWER_TRANS_TCP != rtspTransport->lower_transport)
+            continue;
+
+        QueueTransport* queueTransport =
+            static_cast<QueueTransport*>(
+                g_object_get_qdata(G_OBJECT(transport), PlayerQueueQuark()));
+        if(!queueTransport) {
+            GstRTSPStream* stream = gst_rtsp_stream_transport_get_stream(transport);
+
+            const PlayerQueuePtr queue =
+                std::make_shared<PlayerQueue>(transport, IsH264(stream), options);
+
+            queueTransport = new QueueTransport {
+                gst_rtsp_stream_transport_new(stream, CopyTcpTransport(rtspTransport)),
+                queue };
+
+            // lists are sent packet by packet through sendRtp,
+            // and queue transport never pushes back on shared media
+            gst_rtsp_stream_transport_set_callbacks(
+                queueTransport->transport, sendRtp, sendRtcp,
+                new PlayerQueuePtr(queue),
+                [] (gpointer userData) {
+                    delete static_cast<PlayerQueuePtr*>(userData);
+                });
+
+            g_object_set_qdata_full(
+                G_OBJECT(transport), PlayerQueueQuark(), queueTransport,
+                [] (gpointer data) {
+                    QueueTransport* queueTransport = static_cast<QueueTransport*>(data);
+                    gst_rtsp_stream_transport_set_active(queueTransport->transport, FALSE);
+                    g_object_unref(queueTransport->transport);
+                    delete queueTransport;
+                });
+        }
+
+        const PlayerQueuePtr queue = queueTransport->queue.lock();
+        if(!queue)
+            continue;
+
+        // queue transport is activated first,
+        // so packet could be sent twice but not lost
+        gst_rtsp_stream_transport_set_active(queueTransport->transport, TRUE);
+        gst_rtsp_stream_transport_set_active(transport, FALSE);
+
+        // stream replaces it while client's transport is active
+        gst_rtsp_stream_transport_set_message_sent(
+            transport, onMessageSent,
+            new PlayerQueueWeakPtr(queue),
+            [] (gpointer userData) {
+                delete static_cast<PlayerQueueWeakPtr*>(userData);
+            });
+    }
+#else
+    (void)sessionMedia;
+    (void)options;
+
+    MediaLog()->debug(
+        "PlayerQueue. GStreamer 1.18 is required, player is served without queue");
+#endif
+}
+
+void PlayerQueue::Detach(GstRTSPSessionMedia* sessionMedia)
+{
+#if GST_CHECK_VERSION(1, 18, 0)
+    GstRTSPMedia* media = gst_rtsp_session_media_get_media(sessionMedia);
+    const guint streamsCount = gst_rtsp_media_n_streams(media);
+    for(guint i = 0; i < streamsCount; ++i) {
+        GstRTSPStreamTransport* transport =
+            gst_rtsp_session_media_get_transport(sessionMedia, i);
+        if(!transport)
+            continue;
+
+        QueueTransport* queueTransport =
+            static_cast<QueueTransport*>(
+                g_object_get_qdata(G_OBJECT(transport), PlayerQueueQuark()));
+        if(!queueTransport)
+            continue;
+
+        gst_rtsp_stream_transport_set_active(queueTransport->transport, FALSE);
+
+        // queued packets are stale on next PLAY
+        if(const PlayerQueuePtr queue = queueTransport->queue.lock()) {
+            std::lock_guard<std::mutex> lock(queue->_mutex);
+            queue->clear();
+        }
+    }
+#else
+    (void)sessionMedia;
+#endif
+}
+
+PlayerQueue::PlayerQueue(
+    GstRTSPStreamTransport* transport,
+    bool h264,
+    const TransportOptions& options) :
+    _context(g_main_context_ref_thread_default()),
+    _h264(h264),
+    _maxBytes(options.tcpQueueBytes),
+    _maxLatencyUs(static_cast<gint64>(options.tcpQueueLatencyMs) * 1000),
+    _drainScheduled(false)
+{
+    // client's transport owns queue transport owning queue
+    g_weak_ref_init(&_transport, transport);
+}
+
+PlayerQueue::~PlayerQueue()
+{
+    g_main_context_unref(_context);
+
+    clear();
+
+    g_weak_ref_clear(&_transport);
+}
+
+// returns false if client's transport doesn't accept data now
+bool PlayerQueue::send(GstBuffer* buffer, bool rtp)
+{
+#if GST_CHECK_VERSION(1, 18, 0)
+    GstRTSPStreamTransport* transport =
+        GST_RTSP_STREAM_TRANSPORT(g_weak_ref_get(&_transport));
+    if(!transport)
+        return false;
+
+    // client has not sent previous message of channel yet
+    bool sent = false;
+    if(!gst_rtsp_stream_transport_check_back_pressure(transport, rtp)) {
+        sent =
+            rtp ?
+                gst_rtsp_stream_transport_send_rtp(transport, buffer) :
+                gst_rtsp_stream_transport_send_rtcp(transport, buffer);
+    }
+
+    g_object_unref(transport);
+
+    return sent;
+#else
+    (void)buffer;
+    (void)rtp;
+
+    return false;
+#endif
+}
+
+// should be called with _mutex locked
+void PlayerQueue::flush()
+{
+    while(!_packets.empty()) {
+        Packet& packet = _packets.front();
+        if(!send(packet.buffer, true))
+            return;
+
+        _bytes -= gst_buffer_get_size(packet.buffer);
+        gst_buffer_unref(packet.buffer);
+        _packets.pop_front();
+    }
+}
+
+// should be called with _mutex locked
+void PlayerQueue::clear()
+{
+    for(Packet& packet: _packets)
+        gst_buffer_unref(packet.buffer);
+    _packets.clear();
+    _bytes = 0;
+    _dropFrame = false;
+}
+
+// should be called with _mutex locked
+void PlayerQueue::shrink(gint64 now)
+{
+    auto overflow =
+        [this, now] () {
+            return
+                !_packets.empty() &&
+                ((_maxBytes && _bytes > _maxBytes) ||
+                 (_maxLatencyUs && now - _packets.front().time > _maxLatencyUs));
+        };
+
+    if(!overflow())
+        return;
+
+    // nothing references such frames, so they could be lost silently.
+    // frame at queue head could be sent partially already,
+    // so only whole frames are dropped from queue tail
+    while(_h264 && overflow()) {
+        const guint32 timestamp = _packets.back().timestamp;
+
+        auto frameBegin = _packets.end();
+        bool nonReference = true;
+        while(frameBegin != _packets.begin() &&
+              std::prev(frameBegin)->timestamp == timestamp)
+        {
+            --frameBegin;
+            nonReference = nonReference && frameBegin->nonReference;
+        }
+
+        if(!nonReference || frameBegin == _packets.begin())
+            break;
+
+        // rest of the latest frame is not received yet
+        if(!_dropFrame) {
+            _dropFrame = true;
+            _dropTimestamp = timestamp;
+        }
+
+        for(auto it = frameBegin; it != _packets.end(); ++it) {
+            _bytes -= gst_buffer_get_size(it->buffer);
+            gst_buffer_unref(it->buffer);
+        }
+        _packets.erase(frameBegin, _packets.end());
+    }
+
+    if(!overflow())
+        return;
+
+    MediaLog()->debug(
+        "PlayerQueue. Player is too slow, skipping to next key frame. queued: {} bytes",
+        _bytes);
+
+    clear();
+
+    // only H264 is inspected, other streams are resumed with next packet
+    _waitKeyFrame = _h264;
+}
+
+void PlayerQueue::push(GstBuffer* buffer)
+{
+    bool keyFrameStart = true;
+    bool nonReference = false;
+    guint32 timestamp = 0;
+    if(_h264)
+        ClassifyH264(buffer, &keyFrameStart, &nonReference, &timestamp);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_dropFrame) {
+        if(timestamp == _dropTimestamp)
+            return;
+        _dropFrame = false;
+    }
+
+    if(_waitKeyFrame) {
+        if(!keyFrameStart)
+            return;
+        _waitKeyFrame = false;
+    }
+
+    flush();
+
+    if(_packets.empty() && send(buffer, true))
+        return;
+
+    // queue is drained when client reports previous message is sent
+    const gint64 now = g_get_monotonic_time();
+    _packets.push_back({ gst_buffer_ref(buffer), timestamp, now, nonReference });
+    _bytes += gst_buffer_get_size(buffer);
+
+    shrink(now);
+}
+
+// could be called from inside of send, so doesn't lock _mutex
+void PlayerQueue::scheduleDrain()
+{
+    if(_drainScheduled.exchange(true))
+        return;
+
+    GSource* source = g_idle_source_new();
+    g_source_set_callback(
+        source, onDrain,
+        new PlayerQueueWeakPtr(shared_from_this()),
+        [] (gpointer userData) {
+            delete static_cast<PlayerQueueWeakPtr*>(userData);
+        });
+    g_source_attach(source, _context);
+    g_source_unref(source);
+}
+
+gboolean PlayerQueue::onMessageSent(gpointer userData)
+{
+    if(const PlayerQueuePtr queue = static_cast<PlayerQueueWeakPtr*>(userData)->lock())
+        queue->scheduleDrain();
+
+    return TRUE;
+}
+
+// client's context
+gboolean PlayerQueue::onDrain(gpointer userData)
+{
+    // keeps queue alive while draining
+    const PlayerQueuePtr queue = static_cast<PlayerQueueWeakPtr*>(userData)->lock();
+    if(!queue)
+        return G_SOURCE_REMOVE;
+
+    queue->_drainScheduled = false;
+
+    std::lock_guard<std::mutex> lock(queue->_mutex);
+    queue->flush();
+
+    return G_SOURCE_REMOVE;
+}
+
+gboolean PlayerQueue::sendRtp(GstBuffer* buffer, guint8 /*channel*/, gpointer userData)
+{
+    (*static_cast<PlayerQueuePtr*>(userData))->push(buffer);
+
+    // dropped packets are not an error for shared media
+    return TRUE;
+}
+
+gboolean PlayerQueue::sendRtcp(GstBuffer* buffer, guint8 /*channel*/, gpointer userData)
+{
+    // RTCP is not worth queuing, it's resent periodically anyway
+    (*static_cast<PlayerQueuePtr*>(userData))->send(buffer, false);
+
+    return TRUE;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include <gst/rtsp-server/rtsp-server.h>
+
+#include "Options.h"
+
+
+namespace RestreamServerLib
+{
+
+// Bounded queue of RTP packets for single TCP interleaved player of shared media.
+// Packets are passed to client without ever blocking media streaming thread,
+// so slow player can't stall other players of the same path.
+// Client's own transport is replaced in stream by queue transport,
+// and queue forwards packets to client's transport while it has no back pressure.
+// On overflow (TransportOptions::tcpQueueBytes or tcpQueueLatencyMs)
+// non-reference H264 frames are dropped from queue tail first, then everything up to next key frame.
+// Queued packets are drained from client's main context when client reports sent message.
+// Requires GStreamer 1.18 (back pressure API), otherwise players are served by RTSP server itself.
+class PlayerQueue : public std::enable_shared_from_this<PlayerQueue>
+{
+public:
+    // should be called from client's thread after transports are activated
+    // (i.e. from play-request). Queues are reused on PLAY after PAUSE
+    static void Attach(
+        GstRTSPClient*,
+        GstRTSPSessionMedia*,
+        const TransportOptions&);
+    // should be called from client's thread after transports are deactivated
+    // (i.e. from pause-request)
+    static void Detach(GstRTSPSessionMedia*);
+
+    PlayerQueue(GstRTSPStreamTransport*, bool h264, const TransportOptions&);
+    ~PlayerQueue();
+
+private:
+    static gboolean sendRtp(GstBuffer*, guint8 channel, gpointer userData);
+    static gboolean sendRtcp(GstBuffer*, guint8 channel, gpointer userData);
+    static gboolean onMessageSent(gpointer userData);
+    static gboolean onDrain(gpointer userData);
+
+    bool send(GstBuffer*, bool rtp);
+    void push(GstBuffer*);
+    void flush();
+    void shrink(gint64 now);
+    void clear();
+    void scheduleDrain();
+
+private:
+    struct Packet
+    {
+        GstBuffer* buffer;
+        guint32 timestamp;
+        gint64 time;
+        bool nonReference;
+    };
+
+    // client's transport
+    GWeakRef _transport;
+    // client's context
+    GMainContext* _context;
+    const bool _h264;
+    const size_t _maxBytes;
+    const gint64 _maxLatencyUs;
+
+    // could be set from inside of send
+    std::atomic<bool> _drainScheduled;
+
+    std::mutex _mutex;
+    std::deque<Packet> _packets;
+    size_t _bytes = 0;
+    bool _waitKeyFrame = false;
+    // rest of frame dropped from queue tail
+    bool _dropFrame = false;
+    guint32 _dropTimestamp = 0;
+};
+
+}
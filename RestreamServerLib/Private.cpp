@@ -24,5 +24,10 @@ bool IsRecordUrl(GstRTSPMethod method, const GstRTSPUrl* url)
     return record;
 }
 
+std::string StreamProxyName(const std::string& proxyName, unsigned streamIndex)
+{
+    return proxyName + "_" + std::to_string(streamIndex);
+}
+
 }
 }
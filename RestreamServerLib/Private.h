@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include <glib.h>
 #include <gst/rtsp/gstrtspdefs.h>
 #include <gst/rtsp/gstrtspurl.h>
@@ -14,5 +16,8 @@ extern const gchar* RecordSuffix;
 
 bool IsRecordUrl(GstRTSPMethod, const GstRTSPUrl*);
 
+// name of interpipesink carrying path stream with given index
+std::string StreamProxyName(const std::string& proxyName, unsigned streamIndex);
+
 }
 }
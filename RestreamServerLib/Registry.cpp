@@ -0,0 +1,306 @@
+#include "Registry.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+const uint32_t ERASED = UINT32_MAX;
+const size_t MIN_CAPACITY = 16;
+
+// FNV-1a
+uint32_t PathHash(const gchar* path)
+{
+    uint32_t hash = 2166136261u;
+    for(; *path; ++path) {
+        hash ^= static_cast<guint8>(*path);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+uint32_t ClientHash(const void* client)
+{
+    uint64_t key = reinterpret_cast<uintptr_t>(client);
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return static_cast<uint32_t>(key);
+}
+
+bool Remove(std::vector<PathId>* ids, PathId id)
+{
+    auto it = std::find(ids->begin(), ids->end(), id);
+    if(ids->end() == it)
+        return false;
+
+    *it = ids->back();
+    ids->pop_back();
+
+    return true;
+}
+
+}
+
+FlatIndex::FlatIndex() :
+    _used(0), _erased(0)
+{
+}
+
+void FlatIndex::insert(uint32_t hash, uint32_t index)
+{
+    assert(index != 0 && index != ERASED);
+
+    // keep load factor (erased slots included) below 3/4
+    if((_used + _erased + 1) * 4 > _slots.size() * 3) {
+        size_t capacity = std::max(MIN_CAPACITY, _slots.size());
+        while((_used + 1) * 2 > capacity)
+            capacity *= 2;
+        rehash(capacity);
+    }
+
+    const size_t mask = _slots.size() - 1;
+    for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Slot& slot = _slots[i];
+        if(0 == slot.index || ERASED == slot.index) {
+            if(ERASED == slot.index)
+                --_erased;
+            slot.hash = hash;
+            slot.index = index;
+            ++_used;
+            return;
+        }
+    }
+}
+
+void FlatIndex::erase(uint32_t hash, uint32_t index)
+{
+    if(_slots.empty())
+        return;
+
+    const size_t mask = _slots.size() - 1;
+    for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Slot& slot = _slots[i];
+        if(0 == slot.index)
+            return;
+        if(index == slot.index) {
+            slot.index = ERASED;
+            --_used;
+            ++_erased;
+            return;
+        }
+    }
+}
+
+void FlatIndex::rehash(size_t capacity)
+{
+    std::vector<Slot> slots(capacity, Slot { 0, 0 });
+    slots.swap(_slots);
+    _used = 0;
+    _erased = 0;
+
+    for(const Slot& slot: slots) {
+        if(slot.index != 0 && slot.index != ERASED)
+            insert(slot.hash, slot.index);
+    }
+}
+
+
+PathId Registry::findPath(const gchar* path) const
+{
+    return
+        _pathsIndex.find(
+            PathHash(path),
+            [this, path] (uint32_t id) {
+                return 0 == strcmp(_paths[id - 1].name.c_str(), path);
+            });
+}
+
+PathId Registry::internPath(const gchar* path)
+{
+    PathId id = findPath(path);
+    if(id != NO_PATH)
+        return id;
+
+    if(_freePaths.empty()) {
+        _paths.emplace_back();
+        id = static_cast<PathId>(_paths.size());
+    } else {
+        id = _freePaths.back();
+        _freePaths.pop_back();
+    }
+
+    PathInfo& info = _paths[id - 1];
+    info.name.assign(path);
+    info.mountRefs = 0;
+    info.multicast = false;
+    info.sessionRefs = 0;
+    info.playCount = 0;
+    info.recordClient = nullptr;
+    info.recordSessionId.clear();
+    info.metrics.reset();
+
+    _pathsIndex.insert(PathHash(path), id);
+
+    return id;
+}
+
+void Registry::releasePathIfUnused(PathId id)
+{
+    PathInfo& info = path(id);
+    if(info.mountRefs > 0 || info.sessionRefs > 0)
+        return;
+
+    _pathsIndex.erase(PathHash(info.name.c_str()), id);
+    // name capacity is kept for reuse
+    info.name.clear();
+    info.metrics.reset();
+    _freePaths.push_back(id);
+}
+
+uint32_t Registry::findClientIndex(const void* client) const
+{
+    return
+        _clientsIndex.find(
+            ClientHash(client),
+            [this, client] (uint32_t index) {
+                return _clients[index - 1].client == client;
+            });
+}
+
+Registry::ClientInfo& Registry::internClient(const void* client)
+{
+    uint32_t index = findClientIndex(client);
+    if(index != 0)
+        return _clients[index - 1];
+
+    if(_freeClients.empty()) {
+        _clients.emplace_back();
+        index = static_cast<uint32_t>(_clients.size());
+    } else {
+        index = _freeClients.back();
+        _freeClients.pop_back();
+    }
+
+    ClientInfo& info = _clients[index - 1];
+    info.client = client;
+    assert(info.mountPaths.empty() && info.sessionPaths.empty());
+
+    _clientsIndex.insert(ClientHash(client), index);
+
+    return info;
+}
+
+void Registry::releaseClientIfUnused(uint32_t index)
+{
+    ClientInfo& info = _clients[index - 1];
+    if(!info.mountPaths.empty() || !info.sessionPaths.empty())
+        return;
+
+    _clientsIndex.erase(ClientHash(info.client), index);
+    info.client = nullptr;
+    _freeClients.push_back(index);
+}
+
+bool Registry::addMountRef(const void* client, PathId id)
+{
+    ClientInfo& clientInfo = internClient(client);
+    if(std::find(clientInfo.mountPaths.begin(), clientInfo.mountPaths.end(), id) !=
+       clientInfo.mountPaths.end())
+    {
+        return false;
+    }
+
+    clientInfo.mountPaths.push_back(id);
+
+    PathInfo& pathInfo = path(id);
+    if(0 == pathInfo.mountRefs++)
+        ++_mountedPathsCount;
+
+    return true;
+}
+
+bool Registry::addSessionRef(const void* client, PathId id)
+{
+    ClientInfo& clientInfo = internClient(client);
+    if(std::find(clientInfo.sessionPaths.begin(), clientInfo.sessionPaths.end(), id) !=
+       clientInfo.sessionPaths.end())
+    {
+        return false;
+    }
+
+    clientInfo.sessionPaths.push_back(id);
+    ++path(id).sessionRefs;
+
+    return true;
+}
+
+void Registry::removeSessionRef(const void* client, PathId id)
+{
+    const uint32_t index = findClientIndex(client);
+    if(0 == index)
+        return;
+
+    if(Remove(&_clients[index - 1].sessionPaths, id)) {
+        --path(id).sessionRefs;
+        releasePathIfUnused(id);
+    }
+
+    releaseClientIfUnused(index);
+}
+
+const std::vector<PathId>* Registry::mountPaths(const void* client) const
+{
+    const uint32_t index = findClientIndex(client);
+    return index != 0 ? &_clients[index - 1].mountPaths : nullptr;
+}
+
+const std::vector<PathId>* Registry::sessionPaths(const void* client) const
+{
+    const uint32_t index = findClientIndex(client);
+    return index != 0 ? &_clients[index - 1].sessionPaths : nullptr;
+}
+
+void Registry::releaseMountPaths(const void* client)
+{
+    const uint32_t index = findClientIndex(client);
+    if(0 == index)
+        return;
+
+    std::vector<PathId>& paths = _clients[index - 1].mountPaths;
+    for(PathId id: paths) {
+        PathInfo& info = path(id);
+        if(0 == --info.mountRefs)
+            --_mountedPathsCount;
+        releasePathIfUnused(id);
+    }
+    paths.clear();
+
+    releaseClientIfUnused(index);
+}
+
+void Registry::releaseSessionPaths(const void* client)
+{
+    const uint32_t index = findClientIndex(client);
+    if(0 == index)
+        return;
+
+    std::vector<PathId>& paths = _clients[index - 1].sessionPaths;
+    for(PathId id: paths) {
+        --path(id).sessionRefs;
+        releasePathIfUnused(id);
+    }
+    paths.clear();
+
+    releaseClientIfUnused(index);
+}
+
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+
+namespace RestreamServerLib
+{
+
+struct PathMetrics;
+
+typedef uint32_t PathId;
+const PathId NO_PATH = 0;
+
+// Open addressing hash index (linear probing) over externally stored entries.
+// Entries are referenced by 1-based index, so slots are plain integers.
+class FlatIndex
+{
+public:
+    FlatIndex();
+
+    // match(index) should return true if entry with given index has the key
+    template<typename Match>
+    uint32_t find(uint32_t hash, const Match& match) const;
+    // key should not be in index already
+    void insert(uint32_t hash, uint32_t index);
+    void erase(uint32_t hash, uint32_t index);
+
+    size_t size() const { return _used; }
+
+private:
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t index;
+    };
+
+    void rehash(size_t capacity);
+
+private:
+    std::vector<Slot> _slots;
+    size_t _used;
+    size_t _erased;
+};
+
+// Paths and clients shared by Server and RtspMountPoints, with paths interned as PathId.
+// Not thread safe by itself, every call should be made with mutex() locked.
+// Freed entries are reused, so steady state doesn't allocate.
+class Registry
+{
+public:
+    struct PathInfo
+    {
+        std::string name;
+
+        // clients requested path from mount points
+        unsigned mountRefs;
+        // path is offered to players as multicast
+        bool multicast;
+
+        // clients having play or record session on path
+        unsigned sessionRefs;
+        unsigned playCount;
+        const void* recordClient;
+        std::string recordSessionId;
+
+        // set while path has mount point
+        std::shared_ptr<PathMetrics> metrics;
+    };
+
+    std::mutex& mutex() { return _mutex; }
+
+    // NO_PATH if path is not registered
+    PathId findPath(const gchar* path) const;
+    // registers path if it's not registered yet
+    PathId internPath(const gchar* path);
+
+    // reference stays valid until path is released
+    PathInfo& path(PathId id) { return _paths[id - 1]; }
+    const PathInfo& path(PathId id) const { return _paths[id - 1]; }
+
+    // paths having mount points
+    size_t mountedPathsCount() const { return _mountedPathsCount; }
+
+    // visits all registered paths
+    template<typename Visitor>
+    void forEachPath(const Visitor&) const;
+
+    // return false if client already referenced path
+    bool addMountRef(const void* client, PathId);
+    bool addSessionRef(const void* client, PathId);
+    void removeSessionRef(const void* client, PathId);
+
+    // paths are still referenced by client until releasePaths
+    const std::vector<PathId>* mountPaths(const void* client) const;
+    const std::vector<PathId>* sessionPaths(const void* client) const;
+
+    // drops all client references of given kind and unused paths
+    void releaseMountPaths(const void* client);
+    void releaseSessionPaths(const void* client);
+
+private:
+    struct ClientInfo
+    {
+        const void* client;
+        std::vector<PathId> mountPaths;
+        std::vector<PathId> sessionPaths;
+    };
+
+    uint32_t findClientIndex(const void* client) const;
+    ClientInfo& internClient(const void* client);
+    void releaseClientIfUnused(uint32_t index);
+    void releasePathIfUnused(PathId);
+
+private:
+    std::mutex _mutex;
+
+    // deque keeps references valid on grow
+    std::deque<PathInfo> _paths;
+    std::vector<PathId> _freePaths;
+    FlatIndex _pathsIndex;
+    size_t _mountedPathsCount = 0;
+
+    std::deque<ClientInfo> _clients;
+    std::vector<uint32_t> _freeClients;
+    FlatIndex _clientsIndex;
+};
+
+
+template<typename Visitor>
+void Registry::forEachPath(const Visitor& visitor) const
+{
+    // released entries have empty name
+    for(const PathInfo& info: _paths) {
+        if(!info.name.empty())
+            visitor(info);
+    }
+}
+
+template<typename Match>
+uint32_t FlatIndex::find(uint32_t hash, const Match& match) const
+{
+    if(_slots.empty())
+        return 0;
+
+    const size_t mask = _slots.size() - 1;
+    for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const Slot& slot = _slots[i];
+        if(0 == slot.index)
+            return 0;
+        if(slot.index != UINT32_MAX && slot.hash == hash && match(slot.index))
+            return slot.index;
+    }
+}
+
+}
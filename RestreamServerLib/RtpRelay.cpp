@@ -0,0 +1,382 @@
+#include "RtpRelay.h"
+
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+enum
+{
+    PROP_0,
+    PROP_PT,
+    PROP_SEQNUM,
+    PROP_TIMESTAMP,
+    PROP_SSRC,
+    PROP_MTU,
+    PROP_REWRITE,
+    PROP_BATCH,
+};
+
+// flush batch even if frame is not finished yet
+#define MAX_BATCH_SIZE 64
+
+struct _RtpRelay
+{
+    GstElement parent_instance;
+
+    GstPad* sinkPad;
+    GstPad* srcPad;
+
+    // guarded by object lock
+    guint pt;
+    guint16 seqnum;
+    guint32 timestamp;
+    guint32 ssrc;
+    guint mtu;
+    gboolean rewrite;
+    gboolean batch;
+
+    // streaming thread only
+    bool sourceKnown;
+    guint32 sourceSsrc;
+    guint16 seqOffset;
+    GstBufferList* pending;
+};
+
+G_DEFINE_TYPE(
+    RtpRelay,
+    rtp_relay,
+    GST_TYPE_ELEMENT)
+
+
+static GstStaticPadTemplate sinkTemplate =
+    GST_STATIC_PAD_TEMPLATE(
+        "sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+        GST_STATIC_CAPS("application/x-rtp"));
+
+static GstStaticPadTemplate srcTemplate =
+    GST_STATIC_PAD_TEMPLATE(
+        "src", GST_PAD_SRC, GST_PAD_ALWAYS,
+        GST_STATIC_CAPS("application/x-rtp"));
+
+
+gboolean
+rtp_relay_register()
+{
+    static gsize registered = 0;
+    if(g_once_init_enter(&registered)) {
+        const gboolean result =
+            gst_element_register(
+                nullptr, RTP_RELAY_NAME, GST_RANK_NONE, TYPE_RTP_RELAY);
+        if(!result)
+            MediaLog()->critical("Fail to register " RTP_RELAY_NAME);
+        g_once_init_leave(&registered, result ? 1 : 2);
+    }
+
+    return 1 == registered;
+}
+
+static GstFlowReturn
+push_pending(RtpRelay* self)
+{
+    if(!self->pending)
+        return GST_FLOW_OK;
+
+    GstBufferList* list = self->pending;
+    self->pending = nullptr;
+
+    return gst_pad_push_list(self->srcPad, list);
+}
+
+static GstFlowReturn
+chain(GstPad* /*pad*/, GstObject* parent, GstBuffer* buffer)
+{
+    RtpRelay* self = _RTP_RELAY(parent);
+
+    GST_OBJECT_LOCK(self);
+    const gboolean rewrite = self->rewrite;
+    const gboolean batch = self->batch;
+    GST_OBJECT_UNLOCK(self);
+
+    if(rewrite)
+        buffer = gst_buffer_make_writable(buffer);
+
+    GstRTPBuffer rtpBuffer = GST_RTP_BUFFER_INIT;
+    if(!gst_rtp_buffer_map(buffer, rewrite ? GST_MAP_READWRITE : GST_MAP_READ, &rtpBuffer)) {
+        MediaLog()->debug("RtpRelay. Dropping invalid RTP packet.");
+        gst_buffer_unref(buffer);
+        return GST_FLOW_OK;
+    }
+
+    const guint16 seqnum = gst_rtp_buffer_get_seq(&rtpBuffer);
+    const guint32 sourceSsrc = gst_rtp_buffer_get_ssrc(&rtpBuffer);
+    const bool marker = gst_rtp_buffer_get_marker(&rtpBuffer);
+
+    GST_OBJECT_LOCK(self);
+
+    if(rewrite) {
+        if(!self->sourceKnown || sourceSsrc != self->sourceSsrc) {
+            // new source (recorder reconnected f.e.) continues current sequence
+            self->seqOffset = static_cast<guint16>(self->seqnum + 1 - seqnum);
+            self->sourceSsrc = sourceSsrc;
+            self->sourceKnown = true;
+        }
+
+        self->seqnum = static_cast<guint16>(seqnum + self->seqOffset);
+
+        gst_rtp_buffer_set_seq(&rtpBuffer, self->seqnum);
+        gst_rtp_buffer_set_ssrc(&rtpBuffer, self->ssrc);
+    } else {
+        self->seqnum = seqnum;
+        self->ssrc = sourceSsrc;
+    }
+
+    self->timestamp = gst_rtp_buffer_get_timestamp(&rtpBuffer);
+
+    GST_OBJECT_UNLOCK(self);
+
+    gst_rtp_buffer_unmap(&rtpBuffer);
+
+    if(!batch) {
+        GstFlowReturn ret = push_pending(self);
+        if(ret != GST_FLOW_OK) {
+            gst_buffer_unref(buffer);
+            return ret;
+        }
+
+        return gst_pad_push(self->srcPad, buffer);
+    }
+
+    if(!self->pending)
+        self->pending = gst_buffer_list_new_sized(MAX_BATCH_SIZE);
+    gst_buffer_list_add(self->pending, buffer);
+
+    // marker is set on last packet of frame
+    if(marker || gst_buffer_list_length(self->pending) >= MAX_BATCH_SIZE)
+        return push_pending(self);
+
+    return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+chain_list(GstPad* pad, GstObject* parent, GstBufferList* list)
+{
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    const guint length = gst_buffer_list_length(list);
+    for(guint i = 0; i < length && GST_FLOW_OK == ret; ++i)
+        ret = chain(pad, parent, gst_buffer_ref(gst_buffer_list_get(list, i)));
+
+    gst_buffer_list_unref(list);
+
+    return ret;
+}
+
+static gboolean
+sink_event(GstPad* pad, GstObject* parent, GstEvent* event)
+{
+    RtpRelay* self = _RTP_RELAY(parent);
+
+    if(GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP && self->pending) {
+        gst_buffer_list_unref(self->pending);
+        self->pending = nullptr;
+    } else if(GST_EVENT_IS_SERIALIZED(event)) {
+        // keep order of buffers and events
+        push_pending(self);
+    }
+
+    if(GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+        return gst_pad_event_default(pad, parent, event);
+
+    GstCaps* caps = nullptr;
+    gst_event_parse_caps(event, &caps);
+
+    GST_OBJECT_LOCK(self);
+    const gboolean rewrite = self->rewrite;
+    GST_OBJECT_UNLOCK(self);
+
+    if(!rewrite) {
+        const GstStructure* structure = gst_caps_get_structure(caps, 0);
+
+        gint pt = 0;
+        guint ssrc = 0;
+        GST_OBJECT_LOCK(self);
+        if(gst_structure_get_int(structure, "payload", &pt))
+            self->pt = pt;
+        if(gst_structure_get_uint(structure, "ssrc", &ssrc))
+            self->ssrc = ssrc;
+        GST_OBJECT_UNLOCK(self);
+
+        return gst_pad_event_default(pad, parent, event);
+    }
+
+    GstCaps* outCaps = gst_caps_copy(caps);
+    gst_event_unref(event);
+
+    GstStructure* structure = gst_caps_get_structure(outCaps, 0);
+
+    gint pt = 0;
+    GST_OBJECT_LOCK(self);
+    if(gst_structure_get_int(structure, "payload", &pt))
+        self->pt = pt;
+    gst_structure_set(structure, "ssrc", G_TYPE_UINT, self->ssrc, NULL);
+    GST_OBJECT_UNLOCK(self);
+
+    // sequence is rewritten, so original base is meaningless
+    gst_structure_remove_field(structure, "seqnum-base");
+
+    const gboolean result = gst_pad_push_event(self->srcPad, gst_event_new_caps(outCaps));
+    gst_caps_unref(outCaps);
+
+    return result;
+}
+
+static void
+get_property(GObject* object, guint propId, GValue* value, GParamSpec* pspec)
+{
+    RtpRelay* self = _RTP_RELAY(object);
+
+    GST_OBJECT_LOCK(self);
+    switch(propId) {
+        case PROP_PT:
+            g_value_set_uint(value, self->pt);
+            break;
+        case PROP_SEQNUM:
+            g_value_set_uint(value, self->seqnum);
+            break;
+        case PROP_TIMESTAMP:
+            g_value_set_uint(value, self->timestamp);
+            break;
+        case PROP_SSRC:
+            g_value_set_uint(value, self->ssrc);
+            break;
+        case PROP_MTU:
+            g_value_set_uint(value, self->mtu);
+            break;
+        case PROP_REWRITE:
+            g_value_set_boolean(value, self->rewrite);
+            break;
+        case PROP_BATCH:
+            g_value_set_boolean(value, self->batch);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propId, pspec);
+            break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void
+set_property(GObject* object, guint propId, const GValue* value, GParamSpec* pspec)
+{
+    RtpRelay* self = _RTP_RELAY(object);
+
+    GST_OBJECT_LOCK(self);
+    switch(propId) {
+        case PROP_SSRC:
+            self->ssrc = g_value_get_uint(value);
+            break;
+        case PROP_MTU:
+            // packets are relayed as is
+            self->mtu = g_value_get_uint(value);
+            break;
+        case PROP_REWRITE:
+            self->rewrite = g_value_get_boolean(value);
+            break;
+        case PROP_BATCH:
+            self->batch = g_value_get_boolean(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propId, pspec);
+            break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void
+finalize(GObject* object)
+{
+    RtpRelay* self = _RTP_RELAY(object);
+    if(self->pending) {
+        gst_buffer_list_unref(self->pending);
+        self->pending = nullptr;
+    }
+
+    G_OBJECT_CLASS(rtp_relay_parent_class)->finalize(object);
+}
+
+static void
+rtp_relay_class_init(RtpRelayClass* klass)
+{
+    GObjectClass* objectKlass = G_OBJECT_CLASS(klass);
+    objectKlass->get_property = get_property;
+    objectKlass->set_property = set_property;
+    objectKlass->finalize = finalize;
+
+    const GParamFlags readable =
+        static_cast<GParamFlags>(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    const GParamFlags readWrite =
+        static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+    g_object_class_install_property(objectKlass, PROP_PT,
+        g_param_spec_uint("pt", "Payload type", "Payload type of relayed stream",
+            0, 0x7F, 0, readable));
+    g_object_class_install_property(objectKlass, PROP_SEQNUM,
+        g_param_spec_uint("seqnum", "Sequence number", "Last sent sequence number",
+            0, G_MAXUINT16, 0, readable));
+    g_object_class_install_property(objectKlass, PROP_TIMESTAMP,
+        g_param_spec_uint("timestamp", "Timestamp", "Last sent RTP timestamp",
+            0, G_MAXUINT32, 0, readable));
+    g_object_class_install_property(objectKlass, PROP_SSRC,
+        g_param_spec_uint("ssrc", "SSRC", "SSRC of relayed stream",
+            0, G_MAXUINT32, 0, readWrite));
+    g_object_class_install_property(objectKlass, PROP_MTU,
+        g_param_spec_uint("mtu", "MTU", "Ignored. Packets are relayed as is",
+            28, G_MAXUINT, 1400, readWrite));
+    g_object_class_install_property(objectKlass, PROP_REWRITE,
+        g_param_spec_boolean("rewrite", "Rewrite", "Rewrite sequence number and SSRC",
+            TRUE, readWrite));
+    g_object_class_install_property(objectKlass, PROP_BATCH,
+        g_param_spec_boolean("batch", "Batch", "Push packets of every frame as buffer list",
+            FALSE, readWrite));
+
+    GstElementClass* elementKlass = GST_ELEMENT_CLASS(klass);
+    gst_element_class_add_static_pad_template(elementKlass, &sinkTemplate);
+    gst_element_class_add_static_pad_template(elementKlass, &srcTemplate);
+    gst_element_class_set_static_metadata(elementKlass,
+        "RTP relay", "Codec/Payloader/Network/RTP",
+        "Relays RTP packets rewriting sequence number and SSRC",
+        "RtspRestreamServer");
+}
+
+static void
+rtp_relay_init(RtpRelay* self)
+{
+    self->sinkPad = gst_pad_new_from_static_template(&sinkTemplate, "sink");
+    gst_pad_set_chain_function(self->sinkPad, chain);
+    gst_pad_set_chain_list_function(self->sinkPad, chain_list);
+    gst_pad_set_event_function(self->sinkPad, sink_event);
+    GST_PAD_SET_PROXY_ALLOCATION(self->sinkPad);
+    gst_element_add_pad(GST_ELEMENT(self), self->sinkPad);
+
+    self->srcPad = gst_pad_new_from_static_template(&srcTemplate, "src");
+    gst_element_add_pad(GST_ELEMENT(self), self->srcPad);
+
+    self->pt = 0;
+    self->seqnum = static_cast<guint16>(g_random_int());
+    self->timestamp = 0;
+    self->ssrc = g_random_int();
+    self->mtu = 1400;
+    self->rewrite = TRUE;
+    self->batch = FALSE;
+
+    self->sourceKnown = false;
+    self->sourceSsrc = 0;
+    self->seqOffset = 0;
+    self->pending = nullptr;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gst/gst.h>
+
+
+namespace RestreamServerLib
+{
+
+G_BEGIN_DECLS
+
+// Forwards RTP packets as is, rewriting only sequence number and SSRC,
+// so reconnected recorder looks like the same continuous RTP stream to players.
+// Exposes "pt", "seqnum", "timestamp" and "ssrc" properties
+// gst-rtsp-server expects from payloaders.
+// With "rewrite=false" it only passes packets (placed after real payloader).
+// With "batch=true" packets of every frame are pushed downstream as one buffer list,
+// so multiudpsink sends them to all players with single sendmmsg call.
+#define TYPE_RTP_RELAY rtp_relay_get_type()
+G_DECLARE_FINAL_TYPE(
+    RtpRelay,
+    rtp_relay,
+    ,
+    RTP_RELAY,
+    GstElement)
+
+#define RTP_RELAY_NAME "restreamrtprelay"
+
+// registers element as RTP_RELAY_NAME to make it usable from pipeline descriptions
+gboolean
+rtp_relay_register();
+
+G_END_DECLS
+
+}
@@ -2,20 +2,156 @@
 
 #include <cassert>
 
+#include <mutex>
+#include <unordered_map>
+
 #include <CxxPtr/GstRtspServerPtr.h>
 
 #include "Log.h"
 #include "Private.h"
 
+#if GST_CHECK_VERSION(1, 14, 0)
+#define ENABLE_ASYNC_AUTH 1
+#endif
+
+// async results not picked up by resumed request during this time are dropped
+#define RESUME_TTL_MS 5000
+
 
 namespace RestreamServerLib
 {
 
+namespace
+{
+
+// async results passed to resumed request only (identified by client and CSeq),
+// independently of cache. Request could be suspended several times
+// (authentication, then authorization), so results are kept until expired.
+// Thread safe.
+class ResumeResults
+{
+public:
+    static std::string RequestKey(const GstRTSPContext* ctx)
+    {
+        gchar* cseq = nullptr;
+        gst_rtsp_message_get_header(ctx->request, GST_RTSP_HDR_CSEQ, &cseq, 0);
+
+        return fmt::format("{}:{}", static_cast<const void*>(ctx->client), cseq ? cseq : "");
+    }
+
+    void store(const std::string& requestKey, const std::string& key, bool result)
+    {
+        const gint64 now = g_get_monotonic_time();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for(auto it = _results.begin(); it != _results.end();) {
+            if(it->second.expireTime <= now)
+                it = _results.erase(it);
+            else
+                ++it;
+        }
+
+        _results[requestKey + '\0' + key] =
+            Result { result, now + gint64(RESUME_TTL_MS) * 1000 };
+    }
+
+    bool find(const std::string& requestKey, const std::string& key, bool* result)
+    {
+        const gint64 now = g_get_monotonic_time();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _results.find(requestKey + '\0' + key);
+        if(it == _results.end() || it->second.expireTime <= now)
+            return false;
+
+        *result = it->second.result;
+
+        return true;
+    }
+
+private:
+    struct Result
+    {
+        bool result;
+        gint64 expireTime;
+    };
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, Result> _results;
+};
+
 struct CxxPrivate
 {
     AuthCallbacks callbacks;
     bool useTls;
+    std::shared_ptr<AuthCache> cache;
+    std::shared_ptr<ResumeResults> resumeResults;
+    std::shared_ptr<Metrics> metrics;
+};
+
+enum class AuthResult {
+    ALLOWED,
+    DENIED,
+    // waiting async callback completion, request will be handled again
+    PENDING,
+};
+
+inline AuthResult ToAuthResult(bool allowed)
+{
+    return allowed ? AuthResult::ALLOWED : AuthResult::DENIED;
+}
+
+#if ENABLE_ASYNC_AUTH
+// copy of client request to handle it again after async callback completion
+struct SuspendedRequest
+{
+    SuspendedRequest(GstRTSPContext* ctx) :
+        client(GST_RTSP_CLIENT(g_object_ref(ctx->client))),
+        request(nullptr),
+        context(nullptr)
+    {
+        gst_rtsp_message_copy(ctx->request, &request);
+
+        // client messages are dispatched from client's watch
+        GSource* source = g_main_current_source();
+        context = g_main_context_ref(
+            source ? g_source_get_context(source) : g_main_context_default());
+    }
+
+    ~SuspendedRequest()
+    {
+        g_main_context_unref(context);
+        gst_rtsp_message_free(request);
+        g_object_unref(client);
+    }
+
+    void resume(const std::shared_ptr<SuspendedRequest>& self)
+    {
+        g_main_context_invoke_full(
+            context,
+            G_PRIORITY_DEFAULT,
+            [] (gpointer userData) -> gboolean {
+                SuspendedRequest* request =
+                    static_cast<std::shared_ptr<SuspendedRequest>*>(userData)->get();
+                AuthLog()->debug("Resuming suspended request");
+                gst_rtsp_client_handle_message(request->client, request->request);
+                return G_SOURCE_REMOVE;
+            },
+            new std::shared_ptr<SuspendedRequest>(self),
+            [] (gpointer userData) {
+                delete static_cast<std::shared_ptr<SuspendedRequest>*>(userData);
+            });
+    }
+
+    GstRTSPClient* client;
+    GstRTSPMessage* request;
+    GMainContext* context;
 };
+#endif
+
+}
 
 struct _RtspAuth
 {
@@ -44,13 +180,29 @@ static gboolean
 authenticate(GstRTSPAuth*, GstRTSPContext*);
 
 RtspAuth*
-rtsp_auth_new(const AuthCallbacks& callbacks, bool useTls)
+rtsp_auth_new(
+    const AuthCallbacks& callbacks,
+    bool useTls,
+    const std::shared_ptr<AuthCache>& cache,
+    const std::shared_ptr<Metrics>& metrics)
 {
     RtspAuth* instance = (RtspAuth*)g_object_new(TYPE_RTSP_AUTH, NULL);
 
     if(instance) {
         instance->p->callbacks = callbacks;
         instance->p->useTls = useTls;
+        instance->p->cache = cache;
+        instance->p->metrics = metrics;
+
+#if !ENABLE_ASYNC_AUTH
+        if(callbacks.authenticateAsync || callbacks.authorizeAsync)
+            AuthLog()->critical("Async auth callbacks require GStreamer 1.14. Ignoring.");
+        instance->p->callbacks.authenticateAsync = nullptr;
+        instance->p->callbacks.authorizeAsync = nullptr;
+#endif
+
+        if(instance->p->callbacks.authenticateAsync || instance->p->callbacks.authorizeAsync)
+            instance->p->resumeResults = std::make_shared<ResumeResults>();
 
         if(useTls) {
             gst_rtsp_auth_set_tls_authentication_mode(
@@ -119,6 +271,19 @@ send_response(
     gst_rtsp_client_send_message(ctx->client, ctx->session, ctx->response);
 }
 
+static void
+send_redirect(
+    GstRTSPContext* ctx,
+    const std::string& location)
+{
+    gst_rtsp_message_init_response(
+        ctx->response, GST_RTSP_STS_MOVED_TEMPORARILY,
+        gst_rtsp_status_as_text(GST_RTSP_STS_MOVED_TEMPORARILY), ctx->request);
+    gst_rtsp_message_add_header(ctx->response, GST_RTSP_HDR_LOCATION, location.c_str());
+
+    gst_rtsp_client_send_message(ctx->client, ctx->session, ctx->response);
+}
+
 static gboolean
 verify_certificate(
     GstRTSPAuth* auth,
@@ -151,39 +316,144 @@ authentication_required(
         return false;
 }
 
-static bool
+static AuthResult
 authenticate(
     RtspAuth* auth,
+    GstRTSPContext* ctx,
     const gchar* login,
     const gchar* pass)
 {
-    if(auth->p->callbacks.authenticate)
-        return auth->p->callbacks.authenticate(login, pass);
-    else if(login[0] == '\0')
-        return true;
-    else
-        return false;
+    if(!login || !pass)
+        return AuthResult::DENIED;
+
+    const AuthCallbacks& callbacks = auth->p->callbacks;
+    AuthCache* cache = auth->p->cache.get();
+
+    if(!callbacks.authenticate && !callbacks.authenticateAsync)
+        return ToAuthResult(login[0] == '\0');
+
+    bool result = false;
+#if ENABLE_ASYNC_AUTH
+    const std::string requestKey =
+        auth->p->resumeResults ? ResumeResults::RequestKey(ctx) : std::string();
+    if(auth->p->resumeResults &&
+       auth->p->resumeResults->find(
+           requestKey, AuthCache::AuthenticationKey(login, pass), &result))
+    {
+        return ToAuthResult(result);
+    }
+#endif
+
+    if(cache && cache->findAuthentication(login, pass, &result))
+        return ToAuthResult(result);
+
+#if ENABLE_ASYNC_AUTH
+    if(callbacks.authenticateAsync) {
+        AuthLog()->debug("Suspending request until authentication. user: {}", login);
+
+        std::shared_ptr<SuspendedRequest> request =
+            std::make_shared<SuspendedRequest>(ctx);
+        const std::shared_ptr<AuthCache> cachePtr = auth->p->cache;
+        const std::shared_ptr<ResumeResults> resumeResults = auth->p->resumeResults;
+        const std::string user = login;
+        const std::string password = pass;
+        const std::shared_ptr<Metrics> metrics = auth->p->metrics;
+        const gint64 startTime = g_get_monotonic_time();
+        callbacks.authenticateAsync(
+            user, password,
+            [request, cachePtr, resumeResults, requestKey, metrics, startTime, user, password] (bool result) {
+                if(metrics)
+                    metrics->observeAuthLatency(g_get_monotonic_time() - startTime);
+                resumeResults->store(requestKey, AuthCache::AuthenticationKey(user, password), result);
+                if(cachePtr)
+                    cachePtr->storeAuthentication(user, password, result);
+                request->resume(request);
+            });
+
+        return AuthResult::PENDING;
+    }
+#endif
+
+    const gint64 startTime = g_get_monotonic_time();
+    result = callbacks.authenticate(login, pass);
+    if(auth->p->metrics)
+        auth->p->metrics->observeAuthLatency(g_get_monotonic_time() - startTime);
+    if(cache)
+        cache->storeAuthentication(login, pass, result);
+
+    return ToAuthResult(result);
 }
 
-static bool
+static AuthResult
 authorize(
     RtspAuth* auth,
+    GstRTSPContext* ctx,
     const gchar* userName,
-    Action action,
-    GstRTSPMethod method,
-    const GstRTSPUrl* url)
+    Action action)
 {
-    if(auth->p->callbacks.authorize)
-        return
-            auth->p->callbacks.authorize(
-                userName,
-                action,
-                url->abspath,
-                Private::IsRecordUrl(method, url));
-    else if(userName[0] == '\0')
-        return true;
-    else
-        return false;
+    const AuthCallbacks& callbacks = auth->p->callbacks;
+    AuthCache* cache = auth->p->cache.get();
+
+    if(!callbacks.authorize && !callbacks.authorizeAsync)
+        return ToAuthResult(userName[0] == '\0');
+
+    const bool record = Private::IsRecordUrl(ctx->method, ctx->uri);
+
+    bool result = false;
+#if ENABLE_ASYNC_AUTH
+    const std::string requestKey =
+        auth->p->resumeResults ? ResumeResults::RequestKey(ctx) : std::string();
+    if(auth->p->resumeResults &&
+       auth->p->resumeResults->find(
+           requestKey,
+           AuthCache::AuthorizationKey(userName, action, ctx->uri->abspath, record),
+           &result))
+    {
+        return ToAuthResult(result);
+    }
+#endif
+
+    if(cache && cache->findAuthorization(userName, action, ctx->uri->abspath, record, &result))
+        return ToAuthResult(result);
+
+#if ENABLE_ASYNC_AUTH
+    if(callbacks.authorizeAsync) {
+        AuthLog()->debug(
+            "Suspending request until authorization. user: {}, path: {}",
+            userName, ctx->uri->abspath);
+
+        std::shared_ptr<SuspendedRequest> request =
+            std::make_shared<SuspendedRequest>(ctx);
+        const std::shared_ptr<AuthCache> cachePtr = auth->p->cache;
+        const std::shared_ptr<ResumeResults> resumeResults = auth->p->resumeResults;
+        const std::string user = userName;
+        const std::string path = ctx->uri->abspath;
+        const std::shared_ptr<Metrics> metrics = auth->p->metrics;
+        const gint64 startTime = g_get_monotonic_time();
+        callbacks.authorizeAsync(
+            user, action, path, record,
+            [request, cachePtr, resumeResults, requestKey, metrics, startTime, user, action, path, record] (bool result) {
+                if(metrics)
+                    metrics->observeAuthLatency(g_get_monotonic_time() - startTime);
+                resumeResults->store(
+                    requestKey, AuthCache::AuthorizationKey(user, action, path, record), result);
+                if(cachePtr)
+                    cachePtr->storeAuthorization(user, action, path, record, result);
+                request->resume(request);
+            });
+
+        return AuthResult::PENDING;
+    }
+#endif
+
+    const gint64 startTime = g_get_monotonic_time();
+    result = callbacks.authorize(userName, action, ctx->uri->abspath, record);
+    if(auth->p->metrics)
+        auth->p->metrics->observeAuthLatency(g_get_monotonic_time() - startTime);
+    if(cache)
+        cache->storeAuthorization(userName, action, ctx->uri->abspath, record, result);
+
+    return ToAuthResult(result);
 }
 
 static bool
@@ -195,13 +465,13 @@ authenticate_by_certificate(
 
     GTlsConnection* tlsConnection = gst_rtsp_connection_get_tls(ctx->conn, nullptr);
     if(!tlsConnection) {
-        Log()->error("gst_rtsp_connection_get_tls failed");
+        AuthLog()->error("gst_rtsp_connection_get_tls failed");
         return false;
     }
 
     GTlsCertificate* peerCert = g_tls_connection_get_peer_certificate(tlsConnection);
     if(!peerCert) {
-        Log()->error("g_tls_connection_get_peer_certificate failed");
+        AuthLog()->error("g_tls_connection_get_peer_certificate failed");
         return false;
     }
 
@@ -218,15 +488,15 @@ authenticate_by_certificate(
 }
 
 #if GST_CHECK_VERSION(1, 12, 0)
-static void
+static AuthResult
 basic_authenticate(
     RtspAuth* auth,
     GstRTSPAuthCredential* credential,
     GstRTSPContext* ctx)
 {
     if(ctx->token) {
-        Log()->debug("Already authenticated. Skipping.");
-        return;
+        AuthLog()->debug("Already authenticated. Skipping.");
+        return AuthResult::ALLOWED;
     }
 
     gchar* loginAndPass = NULL;
@@ -238,6 +508,9 @@ basic_authenticate(
         g_free(decoded);
     }
 
+    if(!loginAndPass)
+        return AuthResult::DENIED;
+
     gchar** tokens = g_strsplit(loginAndPass, ":", 2);
     g_free(loginAndPass);
 
@@ -254,7 +527,8 @@ basic_authenticate(
         }
     }
 
-    if(authenticate(auth, login, pass)) {
+    const AuthResult result = authenticate(auth, ctx, login, pass);
+    if(AuthResult::ALLOWED == result) {
         ctx->token =
             gst_rtsp_token_new(
                 GST_RTSP_TOKEN_MEDIA_FACTORY_ROLE, G_TYPE_STRING,
@@ -262,17 +536,19 @@ basic_authenticate(
     }
 
     g_strfreev(tokens);
+
+    return result;
 }
 #else
-static void
+static AuthResult
 basic_authenticate(
     RtspAuth* auth,
     gchar* authorization,
     GstRTSPContext* ctx)
 {
     if(ctx->token) {
-        Log()->debug("Already authenticated. Skipping.");
-        return;
+        AuthLog()->debug("Already authenticated. Skipping.");
+        return AuthResult::ALLOWED;
     }
 
     gchar* loginAndPass = NULL;
@@ -284,6 +560,9 @@ basic_authenticate(
         g_free(decoded);
     }
 
+    if(!loginAndPass)
+        return AuthResult::DENIED;
+
     gchar** tokens = g_strsplit(loginAndPass, ":", 2);
     g_free(loginAndPass);
 
@@ -300,7 +579,8 @@ basic_authenticate(
         }
     }
 
-    if(authenticate(auth, login, pass)) {
+    const AuthResult result = authenticate(auth, ctx, login, pass);
+    if(AuthResult::ALLOWED == result) {
         ctx->token =
             gst_rtsp_token_new(
                 GST_RTSP_TOKEN_MEDIA_FACTORY_ROLE, G_TYPE_STRING,
@@ -308,26 +588,30 @@ basic_authenticate(
     }
 
     g_strfreev(tokens);
+
+    return result;
 }
 #endif
 
-static gboolean
-authenticate(
+static AuthResult
+authenticate_context(
     GstRTSPAuth* auth,
     GstRTSPContext* ctx)
 {
     if(ctx->token) {
-        Log()->debug("Already authenticated. Skipping.");
-        return TRUE;
+        AuthLog()->debug("Already authenticated. Skipping.");
+        return AuthResult::ALLOWED;
     }
 
     RtspAuth* self = _RTSP_AUTH(auth);
 
     if(self->p->useTls && authenticate_by_certificate(self, ctx)) {
-        Log()->debug("authenticate. authenticated by certificate");
-        return TRUE;
+        AuthLog()->debug("authenticate. authenticated by certificate");
+        return AuthResult::ALLOWED;
     }
 
+    AuthResult result = AuthResult::DENIED;
+
     GstRTSPToken* defaultToken = gst_rtsp_auth_get_default_token(auth);
     // FIXME! it looks like we shouldn't add ref to token. Look rtsp-auth.c:747
     gst_rtsp_token_unref(defaultToken);
@@ -343,11 +627,11 @@ authenticate(
 
     for(GstRTSPAuthCredential** credential = credentials; *credential; ++credential) {
         if((*credential)->scheme == GST_RTSP_AUTH_BASIC) {
-            basic_authenticate(self, *credential, ctx);
+            result = basic_authenticate(self, *credential, ctx);
         } else if((*credential)->scheme == GST_RTSP_AUTH_DIGEST) {
         }
 
-        if(ctx->token)
+        if(ctx->token || AuthResult::PENDING == result)
             break;
     }
 
@@ -364,44 +648,54 @@ authenticate(
     }
 
     if(g_ascii_strncasecmp(authorization, "basic ", 6) == 0) {
-        basic_authenticate(self, authorization + 6, ctx);
+        result = basic_authenticate(self, authorization + 6, ctx);
     } else if(g_ascii_strncasecmp(authorization, "digest ", 7) == 0) {
     }
 #endif
 
+    if(AuthResult::PENDING == result)
+        return result;
+
     if(!ctx->token) {
         ctx->token = defaultToken;
-        Log()->debug("authenticate. Default token used");
+        AuthLog()->debug("authenticate. Default token used");
     }
 
-    return TRUE;
+    return AuthResult::ALLOWED;
 
 no_auth:
     {
         GST_DEBUG_OBJECT(auth, "no authorization header found");
-        return TRUE;
+        return AuthResult::ALLOWED;
     }
 }
 
 static gboolean
-ensure_authenticated(
+authenticate(
     GstRTSPAuth* auth,
     GstRTSPContext* ctx)
 {
-    GstRTSPAuthClass* klass = GST_RTSP_AUTH_GET_CLASS(auth);
+    authenticate_context(auth, ctx);
+
+    return TRUE;
+}
 
+static AuthResult
+ensure_authenticated(
+    GstRTSPAuth* auth,
+    GstRTSPContext* ctx)
+{
     /* we need a token to check */
     if(ctx->token == NULL) {
-        if(klass->authenticate) {
-            if(!klass->authenticate(auth, ctx))
-                return FALSE;
-        }
+        const AuthResult result = authenticate_context(auth, ctx);
+        if(result != AuthResult::ALLOWED)
+            return result;
     }
 
     if(!ctx->token)
-        return FALSE;
+        return AuthResult::DENIED;
 
-    return TRUE;
+    return AuthResult::ALLOWED;
 }
 
 static gboolean
@@ -410,21 +704,49 @@ check(
     GstRTSPContext* ctx,
     const gchar* check)
 {
-    Log()->trace(">> RtspAuth.check. {}", check);
+    AuthLog()->trace(">> RtspAuth.check. {}", check);
 
     RtspAuth* self = _RTSP_AUTH(auth);
 
     GstRTSPTokenPtr defaultTokenPtr(gst_rtsp_auth_get_default_token(auth));
     GstRTSPToken* defaultToken = defaultTokenPtr.get();
 
-    gboolean success = FALSE;
+    AuthResult result = AuthResult::DENIED;
 
     if(g_str_equal(check, GST_RTSP_AUTH_CHECK_URL)) {
-        if(ensure_authenticated(auth, ctx) && ctx->token) {
+        result = ensure_authenticated(auth, ctx);
+        if(AuthResult::ALLOWED == result) {
             const bool authRequired = authentication_required(self, ctx->method, ctx->uri);
             const bool authenticated = (ctx->token != defaultToken);
-            if(!authRequired || authenticated)
-               success = TRUE;
+            if(authRequired && !authenticated)
+                result = AuthResult::DENIED;
+        }
+
+        if(AuthResult::ALLOWED == result &&
+           GST_RTSP_DESCRIBE == ctx->method &&
+           self->p->callbacks.redirect &&
+           !Private::IsRecordUrl(ctx->method, ctx->uri))
+        {
+            const std::string location = self->p->callbacks.redirect(ctx->uri->abspath);
+            if(!location.empty()) {
+                // response is already sent, so request processing should stop
+                send_redirect(ctx, location);
+                AuthLog()->debug("\"{}\" redirected to \"{}\"", ctx->uri->abspath, location);
+                return FALSE;
+            }
+        }
+
+        const bool requestsMedia =
+            GST_RTSP_DESCRIBE == ctx->method ||
+            GST_RTSP_ANNOUNCE == ctx->method ||
+            GST_RTSP_SETUP == ctx->method;
+        if(AuthResult::ALLOWED == result && requestsMedia && self->p->callbacks.authorizeAsync) {
+            // mount points check access synchronously and can't wait for decision,
+            // so denied request is rejected before path is requested
+            // (to not take mount point, count against paths limit, etc.)
+            const gchar* user =
+                gst_rtsp_token_get_string(ctx->token, GST_RTSP_TOKEN_MEDIA_FACTORY_ROLE);
+            result = authorize(self, ctx, user ? user : "", Action::ACCESS);
         }
     } else if(g_str_has_prefix(check, "auth.check.media.factory.")) {
         if(ctx->token) {
@@ -432,18 +754,22 @@ check(
                 gst_rtsp_token_get_string(ctx->token, GST_RTSP_TOKEN_MEDIA_FACTORY_ROLE);
 
             if(g_str_equal(check, GST_RTSP_AUTH_CHECK_MEDIA_FACTORY_ACCESS))
-                success = authorize(self, user, Action::ACCESS, ctx->method, ctx->uri);
+                result = authorize(self, ctx, user, Action::ACCESS);
             else if(g_str_equal(check, GST_RTSP_AUTH_CHECK_MEDIA_FACTORY_CONSTRUCT))
-                success = authorize(self, user, Action::CONSTRUCT, ctx->method, ctx->uri);
+                result = authorize(self, ctx, user, Action::CONSTRUCT);
         }
     } else
         return GST_RTSP_AUTH_CLASS(rtsp_auth_parent_class)->check(auth, ctx, check);
 
-    if(success)
+    if(AuthResult::ALLOWED == result)
         return TRUE;
-    else {
+    else if(AuthResult::PENDING == result) {
+        // response will be sent when suspended request is handled again
+        AuthLog()->debug("\"{}\" suspended", ctx->uri->abspath);
+        return FALSE;
+    } else {
         send_response(auth, GST_RTSP_STS_UNAUTHORIZED, ctx);
-        Log()->debug("\"{}\" unauthorized", ctx->uri->abspath);
+        AuthLog()->debug("\"{}\" unauthorized", ctx->uri->abspath);
         return FALSE;
     }
 
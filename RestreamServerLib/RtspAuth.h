@@ -1,10 +1,13 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 
 #include <gst/rtsp-server/rtsp-server.h>
 
 #include "Action.h"
+#include "AuthCache.h"
+#include "Metrics.h"
 
 
 namespace RestreamServerLib
@@ -16,6 +19,15 @@ struct AuthCallbacks
     std::function<bool (GstRTSPMethod method, const std::string& path, bool record)> authenticationRequired;
     std::function<bool (const std::string& user, const std::string& pass)> authenticate;
     std::function<bool (const std::string& user, Action, const std::string& path, bool record)> authorize;
+
+    // asynchronous variants, used instead of synchronous ones if set.
+    // request is suspended until completion is called (once, from any thread)
+    typedef std::function<void (bool result)> Completion;
+    std::function<void (const std::string& user, const std::string& pass, const Completion&)> authenticateAsync;
+    std::function<void (const std::string& user, Action, const std::string& path, bool record, const Completion&)> authorizeAsync;
+
+    // url to redirect authorized DESCRIBE of path to, or empty string to serve it locally
+    std::function<std::string (const std::string& path)> redirect;
 };
 
 G_BEGIN_DECLS
@@ -29,7 +41,11 @@ G_DECLARE_FINAL_TYPE(
     GstRTSPAuth)
 
 RtspAuth*
-rtsp_auth_new(const AuthCallbacks&, bool useTls);
+rtsp_auth_new(
+    const AuthCallbacks&,
+    bool useTls,
+    const std::shared_ptr<AuthCache>&,
+    const std::shared_ptr<Metrics>&);
 
 G_END_DECLS
 
@@ -1,9 +1,13 @@
 #include "RtspMountPoints.h"
 
+#include <algorithm>
 #include <cassert>
 
-#include <set>
-#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <CxxPtr/GlibPtr.h>
 #include <CxxPtr/GstRtspServerPtr.h>
@@ -13,6 +17,8 @@
 #include "RtspPlayMediaFactory.h"
 #include "StaticSources.h"
 #include "Private.h"
+#include "ElementPool.h"
+#include "AccessUnitPool.h"
 
 
 namespace RestreamServerLib
@@ -24,12 +30,99 @@ namespace
 struct CxxPrivate
 {
     MountPointsCallbacks callbacks;
+    SplashMode splashMode;
     std::string splashSource;
+    std::shared_ptr<SourceWatchdog> watchdog;
+    std::shared_ptr<GopCacheLimits> gopCacheLimits;
+    std::shared_ptr<Metrics> metrics;
+    std::shared_ptr<HlsServer> hlsServer;
+    GstRTSPAddressPool* multicastPool;
+
+    // make_path and client_closed are called from thread pool threads,
+    // so registry mutex should be locked
+    std::shared_ptr<Registry> registry;
+
+    // guarded by registry mutex (could be changed at runtime)
+    TransportOptions transport;
     unsigned maxPathsCount;
     unsigned maxClientsPerPath;
 
-    std::map<std::string, uint32_t> pathsRefs;
-    std::map<GstRTSPClient*, std::set<std::string> > clientsToPaths;
+    unsigned lingerMs;
+    std::shared_ptr<ElementPool> elementPool;
+
+    ArchiveOptions archive;
+
+    std::shared_ptr<AccessUnitPool> accessUnitPool;
+    bool selectorCacheBuffers;
+
+    struct LingeringPath
+    {
+        // 0 for preregistered path
+        guint timer;
+        // monotonic time lingering started, to evict oldest first
+        gint64 since;
+        bool multicast;
+        std::shared_ptr<PathMetrics> metrics;
+    };
+    // path -> mount point without clients, waiting to be removed.
+    // counted against maxPathsCount, except of preregistered ones (never evicted).
+    // guarded by registry mutex
+    std::unordered_map<std::string, LingeringPath> lingeringPaths;
+
+    // paths never removed, not guarded (set on construction only)
+    std::unordered_set<std::string> preregisteredPaths;
+
+    struct PlayFactory
+    {
+        std::string proxyName;
+        std::shared_ptr<PathStreams> streams;
+        std::shared_ptr<GopCache> gopCache;
+        std::shared_ptr<PathMetrics> metrics;
+        bool rtpRelay;
+        bool multicast;
+        LatencyProfile latencyProfile;
+        // empty for local recorder, re-resolved on ownership change
+        std::string remoteSource;
+        // factory of recorded path is added on first play request,
+        // since most of recorders have no players
+        bool added;
+        // owned by mount points while added
+        RtspPlayMediaFactory* factory;
+        bool hls;
+        // H264 stream served by HLS segmenter, -1 - no segmenter
+        int hlsStream;
+    };
+    // path -> play factory parameters of mounted path.
+    // guarded by registry mutex
+    std::unordered_map<std::string, PlayFactory> playFactories;
+};
+
+struct LingerTimeoutData
+{
+    RtspMountPoints* mountPoints;
+    std::string path;
+};
+
+// path configuration requested from user callbacks,
+// resolved without registry mutex locked
+struct PathParams
+{
+    std::string remoteSource;
+    bool rtpRelay;
+    bool multicast;
+    std::string archiveDir;
+    LatencyProfile latencyProfile;
+    bool hls;
+};
+
+// HLS segmenter pipeline is built/stopped from default main context,
+// since mount points are changed with registry mutex locked
+struct HlsTaskData
+{
+    std::shared_ptr<HlsServer> hlsServer;
+    std::string path;
+    std::string proxyName; // empty to remove path
+    unsigned streamIndex;
 };
 
 }
@@ -52,12 +145,29 @@ G_DEFINE_TYPE(
 
 static gchar*
 make_path(GstRTSPMountPoints* mountPoints, const GstRTSPUrl* url);
+static void
+resolve_path_params(RtspMountPoints*, const std::string& path, bool isRecord, PathParams*);
+static void
+create_mount_point(RtspMountPoints*, Registry::PathInfo&, bool isRecord, const PathParams&);
+static void
+linger_mount_point(RtspMountPoints*, const Registry::PathInfo&);
 
 
 RtspMountPoints*
 rtsp_mount_points_new(
     const MountPointsCallbacks& callbacks,
+    SplashMode splashMode,
     const std::string& splashSource,
+    const std::shared_ptr<SourceWatchdog>& watchdog,
+    const std::shared_ptr<Registry>& registry,
+    const std::shared_ptr<Metrics>& metrics,
+    const std::shared_ptr<HlsServer>& hlsServer,
+    const std::shared_ptr<GopCacheLimits>& gopCacheLimits,
+    GstRTSPAddressPool* multicastPool,
+    const TransportOptions& transport,
+    const MediaPoolOptions& mediaPool,
+    const ArchiveOptions& archive,
+    const MemoryOptions& memory,
     unsigned maxPathsCount,
     unsigned maxClientsPerPath)
 {
@@ -66,14 +176,77 @@ rtsp_mount_points_new(
 
     if(instance) {
         instance->p->callbacks = callbacks;
+        instance->p->splashMode = splashMode;
         instance->p->splashSource = splashSource;
+        instance->p->watchdog = watchdog;
+        instance->p->registry = registry;
+        instance->p->metrics = metrics;
+        instance->p->hlsServer = hlsServer;
+        instance->p->gopCacheLimits = gopCacheLimits;
+        instance->p->multicastPool =
+            multicastPool ?
+                GST_RTSP_ADDRESS_POOL(g_object_ref(multicastPool)) :
+                nullptr;
+        instance->p->transport = transport;
+        instance->p->lingerMs = mediaPool.lingerMs;
+        if(mediaPool.prebuiltPerDescription > 0) {
+            instance->p->elementPool =
+                std::make_shared<ElementPool>(
+                    mediaPool.prebuiltPerDescription,
+                    mediaPool.prebuiltDescriptions);
+        }
+        instance->p->archive = archive;
+        if(memory.poolBuffers > 0) {
+            instance->p->accessUnitPool =
+                std::make_shared<AccessUnitPool>(
+                    memory.poolBufferBytes,
+                    memory.poolBuffers);
+        }
+        instance->p->selectorCacheBuffers = memory.selectorCacheBuffers;
         instance->p->maxPathsCount = maxPathsCount;
-        instance->p->maxClientsPerPath = maxPathsCount;
+        instance->p->maxClientsPerPath = maxClientsPerPath;
+
+        std::vector<std::pair<std::string, PathParams>> preregistered;
+        for(const std::string& path: mediaPool.preregisteredPaths) {
+            if(!instance->p->preregisteredPaths.insert(path).second)
+                continue;
+
+            PathParams params {};
+            resolve_path_params(instance, path, true, &params);
+            preregistered.emplace_back(path, std::move(params));
+        }
+
+        std::lock_guard<std::mutex> lock(registry->mutex());
+        for(const auto& pathParams: preregistered) {
+            Log()->debug("Preregistering mount point. path: {}", pathParams.first);
+
+            // path is interned on first request only
+            Registry::PathInfo pathInfo {};
+            pathInfo.name = pathParams.first;
+            create_mount_point(instance, pathInfo, true, pathParams.second);
+            linger_mount_point(instance, pathInfo);
+        }
     }
 
     return instance;
 }
 
+void
+rtsp_mount_points_reconfigure(
+    RtspMountPoints* mountPoints,
+    const TransportOptions& transport,
+    unsigned maxPathsCount,
+    unsigned maxClientsPerPath)
+{
+    CxxPrivate* p = mountPoints->p;
+
+    std::lock_guard<std::mutex> lock(p->registry->mutex());
+
+    p->transport = transport;
+    p->maxPathsCount = maxPathsCount;
+    p->maxClientsPerPath = maxClientsPerPath;
+}
+
 static void
 rtsp_mount_points_class_init(RtspMountPointsClass* klass)
 {
@@ -86,6 +259,8 @@ rtsp_mount_points_class_init(RtspMountPointsClass* klass)
     object_klass->finalize =
         [] (GObject* object) {
             RtspMountPoints* self = _RTSP_MOUNT_POINTS(object);
+            if(self->p->multicastPool)
+                g_object_unref(self->p->multicastPool);
             delete self->p;
             self->p = nullptr;
 
@@ -98,6 +273,140 @@ rtsp_mount_points_init(RtspMountPoints* self)
 {
     self->proxy = 0;
     self->p = new CxxPrivate;
+    self->p->multicastPool = nullptr;
+    self->p->lingerMs = 0;
+    self->p->selectorCacheBuffers = true;
+}
+
+static gboolean
+on_hls_task(gpointer userData)
+{
+    const HlsTaskData* data = static_cast<const HlsTaskData*>(userData);
+
+    if(data->proxyName.empty())
+        data->hlsServer->removePath(data->path);
+    else
+        data->hlsServer->addPath(data->path, data->proxyName, data->streamIndex);
+
+    return G_SOURCE_REMOVE;
+}
+
+// should be called with registry mutex locked,
+// tasks are run in posting order
+static void
+post_hls_task(
+    const std::shared_ptr<HlsServer>& hlsServer,
+    const std::string& path,
+    const std::string& proxyName,
+    unsigned streamIndex = 0)
+{
+    g_idle_add_full(
+        G_PRIORITY_DEFAULT_IDLE,
+        on_hls_task,
+        new HlsTaskData { hlsServer, path, proxyName, streamIndex },
+        [] (gpointer userData) {
+            delete static_cast<HlsTaskData*>(userData);
+        });
+}
+
+static void
+remove_mount_point(GstRTSPMountPoints* mountPoints, const std::string& path)
+{
+    gst_rtsp_mount_points_remove_factory(mountPoints, path.c_str());
+    GCharPtr recordUrl(g_strconcat(path.c_str(), "?", Private::RecordSuffix, nullptr));
+    gst_rtsp_mount_points_remove_factory(mountPoints, recordUrl.get());
+
+    RtspMountPoints* self = _RTSP_MOUNT_POINTS(mountPoints);
+    self->p->playFactories.erase(path);
+    if(self->p->hlsServer)
+        post_hls_task(self->p->hlsServer, path, std::string());
+}
+
+// should be called with registry mutex locked
+static void
+remove_lingering_mount_point(RtspMountPoints* self, const std::string& path)
+{
+    CxxPrivate* p = self->p;
+
+    Log()->debug(
+        "Removing lingering mount point. path: {}",
+        path);
+    remove_mount_point(GST_RTSP_MOUNT_POINTS(self), path);
+    if(p->metrics)
+        p->metrics->removePath(path);
+    p->lingeringPaths.erase(path);
+}
+
+// should be called with registry mutex locked.
+// preregistered paths are never evicted
+static bool
+evict_oldest_lingering_mount_point(RtspMountPoints* self)
+{
+    CxxPrivate* p = self->p;
+
+    auto oldestIt = p->lingeringPaths.end();
+    for(auto it = p->lingeringPaths.begin(); it != p->lingeringPaths.end(); ++it) {
+        if(!it->second.timer)
+            continue;
+        if(oldestIt == p->lingeringPaths.end() || it->second.since < oldestIt->second.since)
+            oldestIt = it;
+    }
+
+    if(oldestIt == p->lingeringPaths.end())
+        return false;
+
+    g_source_remove(oldestIt->second.timer);
+    const std::string path = oldestIt->first;
+    remove_lingering_mount_point(self, path);
+
+    return true;
+}
+
+static gboolean
+on_linger_timeout(gpointer userData)
+{
+    const LingerTimeoutData* data = static_cast<const LingerTimeoutData*>(userData);
+    CxxPrivate* p = data->mountPoints->p;
+
+    std::lock_guard<std::mutex> lock(p->registry->mutex());
+
+    auto it = p->lingeringPaths.find(data->path);
+    // path could be reused and left again meanwhile
+    if(it != p->lingeringPaths.end() &&
+       it->second.timer == g_source_get_id(g_main_current_source()))
+    {
+        remove_lingering_mount_point(data->mountPoints, data->path);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+// should be called with registry mutex locked
+static void
+linger_mount_point(RtspMountPoints* self, const Registry::PathInfo& pathInfo)
+{
+    CxxPrivate::LingeringPath& lingering = self->p->lingeringPaths[pathInfo.name];
+    lingering.since = g_get_monotonic_time();
+    lingering.multicast = pathInfo.multicast;
+    lingering.metrics = pathInfo.metrics;
+
+    // preregistered path lingers forever
+    if(self->p->preregisteredPaths.count(pathInfo.name)) {
+        lingering.timer = 0;
+        return;
+    }
+
+    lingering.timer =
+        g_timeout_add_full(
+            G_PRIORITY_DEFAULT,
+            self->p->lingerMs,
+            on_linger_timeout,
+            new LingerTimeoutData { _RTSP_MOUNT_POINTS(g_object_ref(self)), pathInfo.name },
+            [] (gpointer userData) {
+                LingerTimeoutData* data = static_cast<LingerTimeoutData*>(userData);
+                g_object_unref(data->mountPoints);
+                delete data;
+            });
 }
 
 static void
@@ -105,42 +414,46 @@ client_closed(GstRTSPClient* client, gpointer userData)
 {
     RtspMountPoints* self = _RTSP_MOUNT_POINTS(userData);
 
-    CxxPrivate& p = *self->p;
+    Registry& registry = *self->p->registry;
+
+    std::lock_guard<std::mutex> lock(registry.mutex());
 
-    auto clientPathsIt = p.clientsToPaths.find(client);
-    if(clientPathsIt == p.clientsToPaths.end()) {
+    const std::vector<PathId>* mountPaths = registry.mountPaths(client);
+    if(!mountPaths || mountPaths->empty()) {
         Log()->debug(
             "Client didn't use any path. client: {}",
             static_cast<const void*>(client));
         return;
-    } else {
-        for(const std::string& path: clientPathsIt->second) {
-            auto pathRefsIt = p.pathsRefs.find(path);
-            if(pathRefsIt == p.pathsRefs.end())
-                Log()->critical("Inconsistent data in mount points reference counting");
-            else {
-                --pathRefsIt->second;
-                if(0 == pathRefsIt->second) {
-                    Log()->debug(
-                        "Removing unused mount point. last client: {}, path: {}",
-                        static_cast<const void*>(client), path);
-                    gst_rtsp_mount_points_remove_factory(
-                        GST_RTSP_MOUNT_POINTS(self),
-                        path.data());
-                    const std::string recordPath = path + Private::RecordSuffix;
-                    gst_rtsp_mount_points_remove_factory(
-                        GST_RTSP_MOUNT_POINTS(self),
-                        recordPath.data());
-                    p.pathsRefs.erase(pathRefsIt);
-                } else {
-                    Log()->debug(
-                        "Path ref count decreased. client: {}, path: {}, refs: {}",
-                        static_cast<const void*>(client), path, pathRefsIt->second);
-                }
-            }
+    }
+
+    for(PathId pathId: *mountPaths) {
+        Registry::PathInfo& pathInfo = registry.path(pathId);
+        if(0 == pathInfo.mountRefs)
+            Log()->critical("Inconsistent data in mount points reference counting");
+        else if(1 == pathInfo.mountRefs &&
+                (self->p->lingerMs > 0 || self->p->preregisteredPaths.count(pathInfo.name)))
+        {
+            Log()->debug(
+                "Mount point is unused, lingering. last client: {}, path: {}",
+                static_cast<const void*>(client), pathInfo.name);
+            linger_mount_point(self, pathInfo);
+            pathInfo.metrics.reset();
+        } else if(1 == pathInfo.mountRefs) {
+            Log()->debug(
+                "Removing unused mount point. last client: {}, path: {}",
+                static_cast<const void*>(client), pathInfo.name);
+            remove_mount_point(GST_RTSP_MOUNT_POINTS(self), pathInfo.name);
+            if(self->p->metrics)
+                self->p->metrics->removePath(pathInfo.name);
+            pathInfo.metrics.reset();
+        } else {
+            Log()->debug(
+                "Path ref count decreased. client: {}, path: {}, refs: {}",
+                static_cast<const void*>(client), pathInfo.name, pathInfo.mountRefs - 1);
         }
-        p.clientsToPaths.erase(clientPathsIt);
     }
+
+    registry.releaseMountPaths(client);
 }
 
 static bool
@@ -175,6 +488,198 @@ authorize_access(
         return true;
 }
 
+// pool keys include proxyName unique for every mount point,
+// so pre-built elements are useful only if mount point is reused
+static std::shared_ptr<ElementPool>
+path_element_pool(RtspMountPoints* self, const std::string& path)
+{
+    CxxPrivate* p = self->p;
+
+    if(p->lingerMs > 0 || p->preregisteredPaths.count(path))
+        return p->elementPool;
+
+    return nullptr;
+}
+
+// should be called with registry mutex locked
+static void
+add_play_factory(
+    RtspMountPoints* self,
+    const std::string& path,
+    CxxPrivate::PlayFactory* params)
+{
+    CxxPrivate* p = self->p;
+
+    RtspPlayMediaFactory* playFactory =
+        rtsp_play_media_factory_new(
+            p->splashMode,
+            p->splashSource.c_str(),
+            params->proxyName.c_str(),
+            params->streams,
+            p->watchdog,
+            params->gopCache,
+            params->metrics,
+            params->rtpRelay,
+            params->multicast ? p->multicastPool : nullptr,
+            p->transport.batchUdp,
+            params->remoteSource,
+            path_element_pool(self, path),
+            params->latencyProfile,
+            p->selectorCacheBuffers);
+
+    gst_rtsp_mount_points_add_factory(
+        GST_RTSP_MOUNT_POINTS(self), path.c_str(), GST_RTSP_MEDIA_FACTORY(playFactory));
+
+    params->added = true;
+    params->factory = playFactory;
+}
+
+// should be called without registry mutex locked
+static void
+resolve_path_params(
+    RtspMountPoints* self,
+    const std::string& path,
+    bool isRecord,
+    PathParams* params)
+{
+    CxxPrivate* p = self->p;
+
+    // path requested by recorder is owned by this node
+    params->remoteSource =
+        !isRecord && p->callbacks.remoteSource ?
+            p->callbacks.remoteSource(path) :
+            std::string();
+    if(!params->remoteSource.empty()) {
+        Log()->info(
+            "Path is pulled from other node. path: {}, source: {}",
+            path, params->remoteSource);
+    }
+
+    // RTP relay requires local recorder
+    params->rtpRelay =
+        params->remoteSource.empty() &&
+        p->callbacks.rtpRelay &&
+        p->callbacks.rtpRelay(path);
+    if(params->rtpRelay) {
+        Log()->debug(
+            "RTP relay enabled for path. path: {}",
+            path);
+    }
+
+    params->multicast =
+        p->multicastPool &&
+        p->callbacks.multicast &&
+        p->callbacks.multicast(path);
+    if(params->multicast) {
+        Log()->debug(
+            "Multicast enabled for path. path: {}",
+            path);
+    }
+
+    // archiving requires local depayloaded stream
+    params->archiveDir =
+        params->remoteSource.empty() && !params->rtpRelay && p->callbacks.archive ?
+            p->callbacks.archive(path) :
+            std::string();
+    if(!params->archiveDir.empty()) {
+        Log()->debug(
+            "Archiving enabled for path. path: {}, dir: {}",
+            path, params->archiveDir);
+    }
+
+    params->latencyProfile =
+        p->callbacks.latencyProfile ?
+            p->callbacks.latencyProfile(path) :
+            LatencyProfile();
+
+    // segmenter requires local depayloaded stream
+    params->hls =
+        p->hlsServer &&
+        params->remoteSource.empty() && !params->rtpRelay &&
+        p->callbacks.hls && p->callbacks.hls(path);
+    if(params->hls) {
+        Log()->debug(
+            "HLS enabled for path. path: {}",
+            path);
+    }
+}
+
+// should be called with registry mutex locked
+static void
+create_mount_point(
+    RtspMountPoints* self,
+    Registry::PathInfo& pathInfo,
+    bool isRecord,
+    const PathParams& params)
+{
+    GstRTSPMountPoints* mountPoints = GST_RTSP_MOUNT_POINTS(self);
+    CxxPrivate* p = self->p;
+    const gchar* path = pathInfo.name.c_str();
+
+    const std::string proxyName =
+        fmt::format("proxy{}", self->proxy++);
+
+    std::shared_ptr<PathStreams> streams = std::make_shared<PathStreams>();
+    std::shared_ptr<GopCache> gopCache;
+    if(p->gopCacheLimits)
+        gopCache = std::make_shared<GopCache>(p->gopCacheLimits);
+
+    std::shared_ptr<PathMetrics> pathMetrics;
+    if(p->metrics)
+        pathMetrics = p->metrics->addPath(pathInfo.name, gopCache);
+    pathInfo.metrics = pathMetrics;
+
+    pathInfo.multicast = params.multicast;
+
+    CxxPrivate::PlayFactory& playFactory =
+        p->playFactories[pathInfo.name] = CxxPrivate::PlayFactory {
+            proxyName,
+            streams,
+            gopCache,
+            pathMetrics,
+            params.rtpRelay,
+            params.multicast,
+            params.latencyProfile,
+            params.remoteSource,
+            false,
+            nullptr,
+            params.hls,
+            -1,
+        };
+    if(!isRecord)
+        add_play_factory(self, pathInfo.name, &playFactory);
+
+    RtspRecordMediaFactory* recordFactory =
+        rtsp_record_media_factory_new(
+            proxyName.c_str(),
+            streams,
+            gopCache,
+            pathMetrics,
+            params.rtpRelay,
+            path_element_pool(self, pathInfo.name),
+            params.archiveDir,
+            p->archive,
+            params.latencyProfile,
+            p->accessUnitPool);
+
+    GCharPtr recordUrl(g_strconcat(path, "?", Private::RecordSuffix, nullptr));
+    gst_rtsp_mount_points_add_factory(
+        mountPoints, recordUrl.get(), GST_RTSP_MEDIA_FACTORY(recordFactory));
+}
+
+// should be called with registry mutex locked
+static bool
+has_mount_point(RtspMountPoints* self, const gchar* path)
+{
+    Registry& registry = *self->p->registry;
+
+    const PathId pathId = registry.findPath(path);
+    if(pathId != NO_PATH && registry.path(pathId).mountRefs > 0)
+        return true;
+
+    return self->p->lingeringPaths.count(path) > 0;
+}
+
 static gchar*
 make_path(GstRTSPMountPoints* mountPoints, const GstRTSPUrl* url)
 {
@@ -188,29 +693,62 @@ make_path(GstRTSPMountPoints* mountPoints, const GstRTSPUrl* url)
     if(!authorize_access(self, context, url))
         return nullptr;
 
-    const std::string path = url->abspath;
+    const gchar* path = url->abspath;
     const bool isRecord = (g_strcmp0(url->query, "record") == 0);
 
     Log()->debug("make_path. client: {}, path: {}",
         static_cast<const void*>(context->client), path);
 
-    CxxPrivate& p = *self->p;
+    Registry& registry = *self->p->registry;
+
+    std::unique_lock<std::mutex> lock(registry.mutex());
+
+    PathParams params {};
+    if(!has_mount_point(self, path)) {
+        // user callbacks are called without registry mutex locked,
+        // mount point state is checked again below
+        lock.unlock();
+        resolve_path_params(self, path, isRecord, &params);
+        lock.lock();
+    }
 
-    auto pathRefsIt = p.pathsRefs.find(path);
+    const PathId existingPathId = registry.findPath(path);
+    const unsigned pathRefs =
+        existingPathId != NO_PATH ? registry.path(existingPathId).mountRefs : 0;
+    // lingering mount points are counted too,
+    // but make room for new ones if limit is reached.
+    // idle preregistered paths can't be evicted, so they are not counted
+    const auto mountPointsCount =
+        [&registry, self] () {
+            const auto& lingeringPaths = self->p->lingeringPaths;
+            return
+                registry.mountedPathsCount() +
+                static_cast<size_t>(std::count_if(
+                    lingeringPaths.begin(), lingeringPaths.end(),
+                    [] (const std::pair<const std::string, CxxPrivate::LingeringPath>& lingering) {
+                        return lingering.second.timer != 0;
+                    }));
+        };
     if(self->p->maxPathsCount > 0 &&
-       pathRefsIt == p.pathsRefs.end() &&
-       p.pathsRefs.size() >= self->p->maxPathsCount)
+       0 == pathRefs &&
+       0 == self->p->lingeringPaths.count(path))
     {
-        Log()->info(
-            "Max paths count reached. client: {}, path: {}, count {}",
-            static_cast<const void*>(context->client), path, self->p->maxPathsCount);
+        while(mountPointsCount() >= self->p->maxPathsCount) {
+            if(!evict_oldest_lingering_mount_point(self)) {
+                Log()->info(
+                    "Max paths count reached. client: {}, path: {}, count {}",
+                    static_cast<const void*>(context->client), path, self->p->maxPathsCount);
 
-        return nullptr;
+                return nullptr;
+            }
+        }
     }
 
+    const bool multicastPath =
+        existingPathId != NO_PATH && registry.path(existingPathId).multicast;
     if(self->p->maxClientsPerPath > 0 &&
-       pathRefsIt != p.pathsRefs.end() &&
-       pathRefsIt->second >= self->p->maxClientsPerPath)
+       !multicastPath &&
+       pathRefs >= self->p->maxClientsPerPath)
     {
         Log()->info(
             "Max clients count per path reached. client: {}, path: {}, count {}",
@@ -219,52 +757,59 @@ make_path(GstRTSPMountPoints* mountPoints, const GstRTSPUrl* url)
         return nullptr;
     }
 
-    bool addPathRef = false;
-    auto clientPathsIt = p.clientsToPaths.find(context->client);
-    if(clientPathsIt == p.clientsToPaths.end()) {
+    const std::vector<PathId>* clientPaths = registry.mountPaths(context->client);
+    if(!clientPaths || clientPaths->empty()) {
         Log()->debug(
             "Path request from new client. client: {}, path: {}",
             static_cast<const void*>(context->client), path);
 
         g_signal_connect(context->client, "closed", GCallback(client_closed), mountPoints);
-        p.clientsToPaths.emplace(context->client, std::set<std::string>{path});
-        addPathRef = true;
     } else {
         Log()->debug(
             "Client requesting path. client: {}, path: {}",
             static_cast<const void*>(context->client), path);
-        addPathRef = clientPathsIt->second.insert(path).second;
     }
 
-    if(p.pathsRefs.end() == pathRefsIt) {
-        Log()->debug(
-            "Creating mount point. client: {}, path: {}",
-            static_cast<const void*>(context->client), path);
+    const PathId pathId = registry.internPath(path);
+    const bool addPathRef = registry.addMountRef(context->client, pathId);
 
+    if(0 == pathRefs) {
         assert(addPathRef);
 
-        const std::string proxyName =
-            fmt::format("proxy{}", self->proxy++);
-
-        RtspPlayMediaFactory* playFactory =
-            rtsp_play_media_factory_new(
-                self->p->splashSource.c_str(),
-                proxyName.c_str());
-        RtspRecordMediaFactory* recordFactory =
-            rtsp_record_media_factory_new(proxyName.c_str());
-
-        gst_rtsp_mount_points_add_factory(
-            mountPoints, url->abspath, GST_RTSP_MEDIA_FACTORY(playFactory));
-        GCharPtr recordUrl(g_strconcat(url->abspath, "?", Private::RecordSuffix, nullptr));
-        gst_rtsp_mount_points_add_factory(
-            mountPoints, recordUrl.get(), GST_RTSP_MEDIA_FACTORY(recordFactory));
-
-        p.pathsRefs.emplace(path, 1);
-    } else {
-        ++(pathRefsIt->second);
+        Registry::PathInfo& pathInfo = registry.path(pathId);
+        auto lingeringIt = self->p->lingeringPaths.find(pathInfo.name);
+        if(lingeringIt != self->p->lingeringPaths.end()) {
+            Log()->debug(
+                "Reusing lingering mount point. client: {}, path: {}",
+                static_cast<const void*>(context->client), path);
+
+            if(lingeringIt->second.timer)
+                g_source_remove(lingeringIt->second.timer);
+            pathInfo.multicast = lingeringIt->second.multicast;
+            pathInfo.metrics = lingeringIt->second.metrics;
+            self->p->lingeringPaths.erase(lingeringIt);
+        } else {
+            Log()->debug(
+                "Creating mount point. client: {}, path: {}",
+                static_cast<const void*>(context->client), path);
+
+            create_mount_point(self, pathInfo, isRecord, params);
+        }
+    } else if(addPathRef) {
         Log()->debug(
             "Path ref count increased. client: {}, path: {}, refs: {}",
-            static_cast<const void*>(context->client), path, pathRefsIt->second);
+            static_cast<const void*>(context->client), path, registry.path(pathId).mountRefs);
+    }
+
+    if(!isRecord) {
+        auto playFactoryIt = self->p->playFactories.find(registry.path(pathId).name);
+        if(playFactoryIt != self->p->playFactories.end() && !playFactoryIt->second.added) {
+            Log()->debug(
+                "Creating play factory. client: {}, path: {}",
+                static_cast<const void*>(context->client), path);
+
+            add_play_factory(self, playFactoryIt->first, &playFactoryIt->second);
+        }
     }
 
     return
@@ -273,4 +818,112 @@ make_path(GstRTSPMountPoints* mountPoints, const GstRTSPUrl* url)
             g_strdup(url->abspath);
 }
 
+// segmenter is created when recorder announced streams,
+// since it requires H264 one.
+// should be called with registry mutex locked
+static void
+update_hls(
+    RtspMountPoints* self,
+    const std::string& path,
+    CxxPrivate::PlayFactory* params)
+{
+    CxxPrivate* p = self->p;
+
+    // recorder disconnected or didn't announce streams yet
+    const Codecs codecs = params->streams->get();
+    if(!params->hls || codecs.empty())
+        return;
+
+    const auto h264It = std::find(codecs.begin(), codecs.end(), Codec::H264);
+    const int hlsStream =
+        h264It != codecs.end() ? static_cast<int>(h264It - codecs.begin()) : -1;
+    if(hlsStream == params->hlsStream)
+        return;
+
+    if(hlsStream < 0) {
+        Log()->warn("Path has no H264 stream, HLS skipped. path: {}", path);
+        post_hls_task(p->hlsServer, path, std::string());
+    } else {
+        post_hls_task(p->hlsServer, path, params->proxyName, hlsStream);
+    }
+
+    params->hlsStream = hlsStream;
+}
+
+bool
+rtsp_mount_points_refresh_path(RtspMountPoints* self, const std::string& path)
+{
+    CxxPrivate* p = self->p;
+
+    // user callback is called without registry mutex locked
+    const std::string remoteSource =
+        p->callbacks.remoteSource ? p->callbacks.remoteSource(path) : std::string();
+
+    Registry& registry = *p->registry;
+
+    std::lock_guard<std::mutex> lock(registry.mutex());
+
+    auto it = p->playFactories.find(path);
+    if(it == p->playFactories.end())
+        return false;
+
+    // local recorder has priority
+    const PathId pathId = registry.findPath(path);
+    const bool recording = pathId != NO_PATH && registry.path(pathId).recordClient;
+
+    CxxPrivate::PlayFactory& playFactory = it->second;
+    update_hls(self, path, &playFactory);
+
+    const std::string source = recording ? std::string() : remoteSource;
+    if(source != playFactory.remoteSource) {
+        Log()->info(
+            "Path source changed. path: {}, source: {}",
+            path, source.empty() ? std::string("local") : source);
+
+        playFactory.remoteSource = source;
+    } else if(!playFactory.added ||
+              !rtsp_play_media_factory_is_stale(playFactory.factory))
+    {
+        return false;
+    } else {
+        // shared media was built before recorder announced its streams
+        Log()->info("Path streams changed. path: {}", path);
+    }
+
+    // pending factory is added with actual source and streams on first play request
+    if(!playFactory.added)
+        return false;
+
+    gst_rtsp_mount_points_remove_factory(GST_RTSP_MOUNT_POINTS(self), path.c_str());
+    add_play_factory(self, path, &playFactory);
+
+    return true;
+}
+
+std::vector<std::string>
+rtsp_mount_points_refresh_paths(RtspMountPoints* self)
+{
+    CxxPrivate* p = self->p;
+
+    std::vector<std::string> paths;
+    if(!p->callbacks.remoteSource)
+        return paths;
+
+    {
+        std::lock_guard<std::mutex> lock(p->registry->mutex());
+
+        paths.reserve(p->playFactories.size());
+        for(const auto& playFactory: p->playFactories)
+            paths.push_back(playFactory.first);
+    }
+
+    std::vector<std::string> replaced;
+    for(const std::string& path: paths) {
+        if(rtsp_mount_points_refresh_path(self, path))
+            replaced.push_back(path);
+    }
+
+    return replaced;
+}
+
 }
@@ -1,9 +1,18 @@
 #pragma once
 
 #include <functional>
+#include <string>
+#include <vector>
 
 #include <gst/rtsp-server/rtsp-server.h>
 
+#include "Options.h"
+#include "SourceWatchdog.h"
+#include "GopCache.h"
+#include "Registry.h"
+#include "Metrics.h"
+#include "HlsServer.h"
+
 
 namespace RestreamServerLib
 {
@@ -11,6 +20,16 @@ namespace RestreamServerLib
 struct MountPointsCallbacks
 {
     std::function<bool (const std::string& user, const std::string& path, bool record)> authorizeAccess;
+    std::function<bool (const std::string& path)> rtpRelay;
+    std::function<bool (const std::string& path)> multicast;
+    // rtsp url path should be pulled from instead of local recorder, or empty string
+    std::function<std::string (const std::string& path)> remoteSource;
+    // directory recorded path is archived to, or empty string
+    std::function<std::string (const std::string& path)> archive;
+    // path is also served by HlsServer
+    std::function<bool (const std::string& path)> hls;
+    // jitterbuffer and sync settings of path, default profile if not set
+    std::function<LatencyProfile (const std::string& path)> latencyProfile;
 };
 
 G_BEGIN_DECLS
@@ -26,10 +45,42 @@ G_DECLARE_FINAL_TYPE(
 RtspMountPoints*
 rtsp_mount_points_new(
     const MountPointsCallbacks&,
+    SplashMode splashMode,
     const std::string& splashSource,
+    const std::shared_ptr<SourceWatchdog>&,
+    const std::shared_ptr<Registry>&,
+    const std::shared_ptr<Metrics>&,
+    const std::shared_ptr<HlsServer>&, // nullptr disables HLS
+    const std::shared_ptr<GopCacheLimits>& gopCacheLimits, // nullptr disables GOP cache
+    GstRTSPAddressPool* multicastPool, // used for paths selected by MountPointsCallbacks::multicast
+    const TransportOptions&,
+    const MediaPoolOptions&,
+    const ArchiveOptions&,
+    const MemoryOptions&,
+    unsigned maxPathsCount,
+    unsigned maxClientsPerPath);
+
+// could be called from any thread.
+// transport is applied to paths mounted after call
+void
+rtsp_mount_points_reconfigure(
+    RtspMountPoints*,
+    const TransportOptions&,
     unsigned maxPathsCount,
     unsigned maxClientsPerPath);
 
+// re-resolves MountPointsCallbacks::remoteSource of mounted path
+// (f.e. after recorder connected or path changed owner)
+// and replaces play factory built for other streams than recorder announced.
+// should be called without registry mutex locked.
+// returns true if play factory was replaced, i.e. players of path play stale source
+bool
+rtsp_mount_points_refresh_path(RtspMountPoints*, const std::string& path);
+
+// refreshes all mounted paths, returns paths having play factory replaced
+std::vector<std::string>
+rtsp_mount_points_refresh_paths(RtspMountPoints*);
+
 G_END_DECLS
 
 }
@@ -1,21 +1,55 @@
 #include "RtspPlayMedia.h"
 
+#include <atomic>
+
 #include <glib.h>
 
+#include <gst/video/video.h>
+
 #include <CxxPtr/GlibPtr.h>
 #include <CxxPtr/GstPtr.h>
 
 #include "Log.h"
+#include "Private.h"
+#include "RtpRelay.h"
+#include "Elements.h"
 
 
 namespace RestreamServerLib
 {
 
+namespace
+{
+
+struct CxxPrivate
+{
+    std::shared_ptr<SourceWatchdog> watchdog;
+    std::shared_ptr<SourceWatchdog::Source> source;
+    std::shared_ptr<GopCache> gopCache;
+    std::shared_ptr<PathMetrics> metrics;
+
+    // timestamp of last splash screen buffer,
+    // cached GOP is retimed to follow it on switch to source
+    std::atomic<GstClockTime> lastSplashTime { GST_CLOCK_TIME_NONE };
+    // monotonic time of last key frame request for joined session
+    std::atomic<gint64> lastKeyUnitRequest { 0 };
+};
+
+// limits key frame requests from recorder when many sessions join at once
+const gint64 KEY_UNIT_REQUEST_INTERVAL_US = G_USEC_PER_SEC;
+
+}
+
 struct _RtspPlayMedia
 {
     GstRTSPMedia parent_instance;
 
-    bool sourceSelected;
+    CxxPrivate* p;
+
+    // accessed from main context and streaming thread
+    gint sourceSelected;
+    // switch to source will happen on next source key frame
+    gint sourceSwitchPending;
     GstElement* selector;
 
     GstPad* selectorTestCardPad;
@@ -24,9 +58,7 @@ struct _RtspPlayMedia
     GstPad* sourcePad;
 
     gulong sourcePadProbe;
-    guint checkTimeout;
-
-    GstClockTime lastBufferTime;
+    gulong selectorTestCardPadProbe;
 };
 
 
@@ -36,45 +68,342 @@ G_DEFINE_TYPE(
     GST_TYPE_RTSP_MEDIA)
 
 
+namespace
+{
+
+struct StreamDesc
+{
+    Codec codec;
+    const char* parse;
+    const char* pay;
+    // payloader has "config-interval" property
+    bool configInterval;
+    // frames are terminated by RTP marker bit, so packets can be batched per frame
+    bool batchable;
+};
+
+const StreamDesc StreamDescs[] = {
+    { Codec::H264, "h264parse", "rtph264pay", true, true },
+    { Codec::H265, "h265parse", "rtph265pay", true, true },
+    { Codec::AAC, "aacparse", "rtpmp4gpay", false, false },
+    { Codec::OPUS, "opusparse", "rtpopuspay", false, false },
+};
+
+const StreamDesc* FindStreamDesc(Codec codec)
+{
+    for(const StreamDesc& desc: StreamDescs) {
+        if(desc.codec == codec)
+            return &desc;
+    }
+
+    return nullptr;
+}
+
+// splash screen switching elements, attached to bin on creation,
+// so media doesn't have to search them
+struct SelectorPads
+{
+    GstElement* selector;
+    GstPad* selectorTestCardPad;
+    GstPad* selectorSourcePad;
+    GstPad* sourcePad;
+};
+
+GQuark SelectorPadsQuark()
+{
+    static GQuark quark = g_quark_from_static_string("restream-selector-pads");
+    return quark;
+}
+
+void FreeSelectorPads(gpointer data)
+{
+    SelectorPads* pads = static_cast<SelectorPads*>(data);
+    gst_object_unref(pads->selector);
+    gst_object_unref(pads->selectorTestCardPad);
+    gst_object_unref(pads->selectorSourcePad);
+    gst_object_unref(pads->sourcePad);
+    delete pads;
+}
+
+GstPad* RequestPad(GstElement* element, const gchar* templateName)
+{
+#if GST_CHECK_VERSION(1, 20, 0)
+    return gst_element_request_pad_simple(element, templateName);
+#else
+    return gst_element_get_request_pad(element, templateName);
+#endif
+}
+
+// gst-rtsp-server takes payN src pad as stream output,
+// so batching relay takes payN name instead of payloader
+bool AddPayloader(
+    GstBin* bin,
+    GstElement* upstream,
+    const StreamDesc* desc,
+    unsigned i,
+    bool batch)
+{
+    const std::string payName = fmt::format("pay{}", i);
+    const std::string parseName = fmt::format("parse{}", i);
+    const bool batched = batch && desc->batchable;
+
+    GstElement* parse = MakeElement(desc->parse, parseName.c_str());
+    GstElement* pay = MakeElement(desc->pay, batched ? nullptr : payName.c_str());
+    if(pay) {
+        g_object_set(pay, "pt", 96 + i, NULL);
+        if(desc->configInterval)
+            g_object_set(pay, "config-interval", -1, NULL);
+    }
+
+    if(!batched)
+        return AddLinked(bin, { upstream, parse, pay });
+
+    GstElement* relay = MakeElement(RTP_RELAY_NAME, payName.c_str());
+    if(relay)
+        g_object_set(relay, "rewrite", FALSE, "batch", TRUE, NULL);
+
+    return AddLinked(bin, { upstream, parse, pay, relay });
+}
+
+GstElement* MakeInterpipeSrc(const std::string& listenTo, const gchar* name = nullptr)
+{
+    GstElement* src = MakeElement("interpipesrc", name);
+    if(src)
+        g_object_set(src, "format", GST_FORMAT_TIME, "listen-to", listenTo.c_str(), NULL);
+
+    return src;
+}
+
+// adds rtspsrc depayloading single H264 stream, returns last element.
+// latencyMs < 0 keeps rtspsrc default
+GstElement* AddRtspH264Source(
+    GstBin* bin,
+    const std::string& location,
+    gint latencyMs,
+    bool retransmission,
+    const gchar* name,
+    const gchar* lastName = nullptr)
+{
+    GstElement* rtspsrc = MakeElement("rtspsrc", name);
+    GstElement* depay = MakeElement("rtph264depay");
+    GstElement* parse = MakeElement("h264parse", lastName);
+
+    if(rtspsrc) {
+        g_object_set(rtspsrc, "location", location.c_str(), NULL);
+        // rtspsrc retransmits by default
+        if(retransmission)
+            g_object_set(rtspsrc, "do-retransmission", TRUE, NULL);
+        if(latencyMs >= 0)
+            g_object_set(rtspsrc, "latency", static_cast<guint>(latencyMs), NULL);
+    }
+    AddElement(bin, rtspsrc);
+    if(!AddLinked(bin, { depay, parse }) || !rtspsrc)
+        return nullptr;
+
+    LinkAddedPads(rtspsrc, depay);
+
+    return parse;
+}
+
+// testCard and source are switched by input-selector followed by payloader
+bool AddSplashStream(
+    GstBin* bin,
+    SplashMode splashMode,
+    const std::string& splashSource,
+    const std::string& listenTo,
+    const std::string& remoteSource,
+    const LatencyProfile& latencyProfile,
+    const StreamDesc* desc,
+    unsigned i,
+    bool batch)
+{
+    // remote source is low latency by default
+    const gint remoteLatencyMs =
+        latencyProfile.jitterLatencyMs >= 0 ? latencyProfile.jitterLatencyMs : 0;
+
+    GstElement* testCard =
+        SplashMode::INTERPIPE == splashMode ?
+            AddElement(bin, MakeInterpipeSrc(splashSource, "testCard")) :
+            AddRtspH264Source(
+                bin, splashSource,
+                latencyProfile.jitterLatencyMs, latencyProfile.retransmission,
+                "src", "testCard");
+    const std::string sourceName = fmt::format("source{}", i);
+    GstElement* source =
+        remoteSource.empty() ?
+            AddElement(bin, MakeInterpipeSrc(listenTo, sourceName.c_str())) :
+            AddRtspH264Source(
+                bin, remoteSource,
+                remoteLatencyMs, latencyProfile.retransmission,
+                "remote");
+    GstElement* selector = AddElement(bin, MakeElement("input-selector", "selector"));
+    if(!testCard || !source || !selector)
+        return false;
+
+    g_object_set(selector, "cache-buffers", TRUE, "sync-mode", 1, NULL);
+
+    SelectorPads* pads = new SelectorPads;
+    pads->selector = GST_ELEMENT(gst_object_ref(selector));
+    pads->selectorTestCardPad = RequestPad(selector, "sink_%u");
+    pads->selectorSourcePad = RequestPad(selector, "sink_%u");
+    pads->sourcePad = gst_element_get_static_pad(source, "src");
+    g_object_set_qdata_full(
+        G_OBJECT(bin), SelectorPadsQuark(), pads, FreeSelectorPads);
+
+    GstPadPtr testCardPadPtr(gst_element_get_static_pad(testCard, "src"));
+    if(GST_PAD_LINK_FAILED(gst_pad_link(testCardPadPtr.get(), pads->selectorTestCardPad)) ||
+       GST_PAD_LINK_FAILED(gst_pad_link(pads->sourcePad, pads->selectorSourcePad)))
+    {
+        MediaLog()->critical("Fail to link splash screen selector");
+        return false;
+    }
+
+    return AddPayloader(bin, selector, desc, i, batch);
+}
+
+GstElement*
+BuildPlayElement(
+    SplashMode splashMode,
+    const std::string& splashSource,
+    const std::string& proxyName,
+    const Codecs& streamCodecs,
+    bool batch,
+    const std::string& remoteSource,
+    const LatencyProfile& latencyProfile)
+{
+    GstElement* bin = gst_bin_new(nullptr);
+
+    bool success = true;
+    bool splashAdded = false;
+    for(unsigned i = 0; success && i < streamCodecs.size(); ++i) {
+        const StreamDesc* desc = FindStreamDesc(streamCodecs[i]);
+        const std::string listenTo = Private::StreamProxyName(proxyName, i);
+
+        if(Codec::H264 == desc->codec && !splashAdded) {
+            splashAdded = true;
+            success =
+                AddSplashStream(
+                    GST_BIN(bin),
+                    splashMode, splashSource,
+                    listenTo, remoteSource, latencyProfile,
+                    desc, i, batch);
+        } else {
+            const std::string sourceName = fmt::format("source{}", i);
+            success =
+                AddPayloader(
+                    GST_BIN(bin),
+                    MakeInterpipeSrc(listenTo, sourceName.c_str()),
+                    desc, i, batch);
+        }
+    }
+
+    if(!success) {
+        MediaLog()->critical("Fail to create play pipeline");
+        ReleaseElement(bin);
+        return nullptr;
+    }
+
+    return bin;
+}
+
+GstElement*
+BuildRelayElement(
+    const std::string& proxyName,
+    const Codecs& codecs,
+    bool batch)
+{
+    GstElement* bin = gst_bin_new(nullptr);
+
+    for(unsigned i = 0; i < codecs.size(); ++i) {
+        const StreamDesc* desc = FindStreamDesc(codecs[i]);
+
+        GstElement* src = MakeInterpipeSrc(Private::StreamProxyName(proxyName, i));
+        if(src)
+            g_object_set(src, "is-live", TRUE, NULL);
+
+        const std::string payName = fmt::format("pay{}", i);
+        GstElement* relay = MakeElement(RTP_RELAY_NAME, payName.c_str());
+        if(relay)
+            g_object_set(relay, "batch", batch && desc && desc->batchable ? TRUE : FALSE, NULL);
+
+        if(!AddLinked(GST_BIN(bin), { src, relay })) {
+            MediaLog()->critical("Fail to create relay pipeline");
+            ReleaseElement(bin);
+            return nullptr;
+        }
+    }
+
+    return bin;
+}
+
+}
+
 GstElement*
 rtsp_play_media_create_element(
-    const URL& splashSource,
-    const std::string& listenTo)
+    SplashMode splashMode,
+    const std::string& splashSource,
+    const std::string& proxyName,
+    const Codecs& codecs,
+    bool batch,
+    const std::string& remoteSource,
+    ElementPool* pool,
+    const LatencyProfile& latencyProfile)
 {
-    const std::string pipeline =
+    // recorder is not connected yet, so assume it will be single H264 stream.
+    // streams of remote recorder are not known either
+    const Codecs streamCodecs =
+        codecs.empty() || !remoteSource.empty() ? Codecs{Codec::H264} : codecs;
+
+    std::string key =
         fmt::format(
-           "rtspsrc name=src ! rtph264depay ! h264parse name=testCardParse ! selector. "
-           "interpipesrc format=time listen-to={} ! selector. "
-           "input-selector cache-buffers=true sync-mode=1 name=selector "
-           "selector. ! h264parse ! rtph264pay config-interval=-1 pt=96 name=pay0 ",
-           listenTo);
-
-    GError* error = nullptr;
-    GstElement* element =
-        gst_parse_launch_full(
-            pipeline.c_str(), NULL, GST_PARSE_FLAG_PLACE_IN_BIN,
-            &error);
-    GErrorPtr errorPtr(error);
-
-    if(errorPtr)
-        Log()->critical(
-            "Fail to create play pipeline: {}",
-            errorPtr->message);
-
-    if(element) {
-        GstElementPtr rtspsrcPtr(gst_bin_get_by_name(GST_BIN(element), "src"));
-        GstElement* rtspsrc = rtspsrcPtr.get();
-        if(rtspsrc)
-            g_object_set(rtspsrc, "location", splashSource.c_str(), NULL);
+            "play {} {} {} {} {} {} {}",
+            static_cast<int>(splashMode), splashSource, proxyName, batch, remoteSource,
+            latencyProfile.jitterLatencyMs, latencyProfile.retransmission);
+    for(Codec codec: streamCodecs) {
+        if(!FindStreamDesc(codec))
+            return nullptr;
+        key += fmt::format(" {}", static_cast<int>(codec));
+    }
+
+    return
+        ElementPool::Launch(
+            pool, key,
+            [=] () {
+                return
+                    BuildPlayElement(
+                        splashMode, splashSource, proxyName,
+                        streamCodecs, batch, remoteSource, latencyProfile);
+            });
+}
+
+GstElement*
+rtsp_play_media_create_relay_element(
+    const std::string& proxyName,
+    const Codecs& codecs,
+    bool batch,
+    ElementPool* pool)
+{
+    if(codecs.empty()) {
+        MediaLog()->debug("RTP relay is not possible without recorder");
+        return nullptr;
     }
 
-    return element;
+    std::string key = fmt::format("relay {} {}", proxyName, batch);
+    for(Codec codec: codecs)
+        key += fmt::format(" {}", static_cast<int>(codec));
+
+    return
+        ElementPool::Launch(
+            pool, key,
+            [=] () {
+                return BuildRelayElement(proxyName, codecs, batch);
+            });
 }
 
 static void
 constructed(GObject* object)
 {
-    Log()->trace(">> RtspPlayMedia.constructed");
+    MediaLog()->trace(">> RtspPlayMedia.constructed");
 
     RtspPlayMedia* self = _RTSP_PLAY_MEDIA(object);
 
@@ -83,50 +412,130 @@ constructed(GObject* object)
     GstElementPtr pipelinePtr(gst_rtsp_media_get_element(selfMedia));
     GstElement* pipeline = pipelinePtr.get();
 
-    GstElementPtr selectorPtr(gst_bin_get_by_name(GST_BIN(pipeline), "selector"));
-    self->selector = selectorPtr.get(); // FIXME! should we keep ref?
+    const SelectorPads* pads =
+        static_cast<const SelectorPads*>(
+            g_object_get_qdata(G_OBJECT(pipeline), SelectorPadsQuark()));
+    if(!pads) {
+        MediaLog()->debug("RtspPlayMedia. No splash screen for streams.");
+        return;
+    }
 
-    GstElementPtr testCardParsePtr(gst_bin_get_by_name(GST_BIN(pipeline), "testCardParse"));
-    GstElement* testCardParse = testCardParsePtr.get();
+    self->selector = GST_ELEMENT(gst_object_ref(pads->selector));
+    self->selectorTestCardPad = GST_PAD(gst_object_ref(pads->selectorTestCardPad));
+    self->selectorSourcePad = GST_PAD(gst_object_ref(pads->selectorSourcePad));
+    self->sourcePad = GST_PAD(gst_object_ref(pads->sourcePad));
 
-    GstPadPtr testCardParseSrcPadPtr(gst_element_get_static_pad(testCardParse, "src"));
-    GstPad* testCardParseSrcPad = testCardParseSrcPadPtr.get();
+    MediaLog()->trace("<< RtspPlayMedia.constructed");
+}
 
-    GstPadPtr selectorTestCardPadPtr(gst_pad_get_peer(testCardParseSrcPad));
-    self->selectorTestCardPad = selectorTestCardPadPtr.get(); // FIXME! should we keep ref?
+void
+rtsp_play_media_set_source_watchdog(
+    RtspPlayMedia* self,
+    const std::shared_ptr<SourceWatchdog>& watchdog)
+{
+    self->p->watchdog = watchdog;
+}
 
-#if GST_CHECK_VERSION(1, 14, 0)
-    gst_element_foreach_sink_pad(self->selector,
-        [] (GstElement* /*element*/,
-            GstPad* pad,
-            gpointer userData) -> gboolean
-        {
-            RtspPlayMedia* selfMedia = static_cast<RtspPlayMedia*>(userData);
-            if(pad != selfMedia->selectorTestCardPad) {
-                selfMedia->selectorSourcePad = pad;
-                return FALSE;
-            }
-            return TRUE;
-        }, self);
-#else
-    GstIterator* it = gst_element_iterate_sink_pads(self->selector);
-    GValue item = G_VALUE_INIT;
-    while(gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
-        GstPad* pad = GST_PAD(g_value_get_object(&item));
-        if(pad != self->selectorTestCardPad) {
-            self->selectorSourcePad = pad;
-            break;
-        }
-        g_value_reset(&item);
-    }
-    g_value_unset(&item);
-    gst_iterator_free(it);
-#endif
+namespace
+{
+
+struct SourceProbeData
+{
+    RtspPlayMedia* media;
+    std::shared_ptr<SourceWatchdog::Source> source;
+};
+
+}
+
+void
+rtsp_play_media_set_gop_cache(
+    RtspPlayMedia* self,
+    const std::shared_ptr<GopCache>& gopCache)
+{
+    self->p->gopCache = gopCache;
+}
+
+void
+rtsp_play_media_set_metrics(
+    RtspPlayMedia* self,
+    const std::shared_ptr<PathMetrics>& metrics)
+{
+    self->p->metrics = metrics;
+}
+
+static inline GstClockTime
+BufferTime(GstBuffer* buffer)
+{
+    return
+        GST_BUFFER_DTS_IS_VALID(buffer) ?
+            GST_BUFFER_DTS(buffer) :
+            GST_BUFFER_PTS(buffer);
+}
 
-    GstPadPtr sourcePadPtr(gst_pad_get_peer(self->selectorSourcePad));
-    self->sourcePad = sourcePadPtr.get(); // FIXME! should we keep ref?
+// pushes cached GOP of recorder preceding current buffer
+// to not make players wait next key frame
+static void
+primeFromGopCache(
+    RtspPlayMedia* self,
+    const std::vector<GstBuffer*>& gop,
+    GstBuffer* current)
+{
+    const GstClockTime playTime = BufferTime(current);
+    const GstClockTime recordTime = GopCache::RecordTime(current);
+    const GstClockTime firstRecordTime = GopCache::RecordTime(gop.front());
+    const GstClockTime lastSplashTime = self->p->lastSplashTime.load();
+
+    if(!GST_CLOCK_TIME_IS_VALID(playTime) ||
+       !GST_CLOCK_TIME_IS_VALID(firstRecordTime) ||
+       firstRecordTime > recordTime)
+    {
+        for(GstBuffer* cached: gop)
+            gst_buffer_unref(cached);
+        return;
+    }
 
-    Log()->trace("<< RtspPlayMedia.constructed");
+    MediaLog()->debug(
+        "RtspPlayMedia. Priming from GOP cache. frames: {}",
+        gop.size());
+
+    // recorder timeline -> player timeline.
+    // cached GOP is squeezed between last splash screen buffer and current one
+    // if it doesn't fit, to not make player timestamps go backwards
+    const GstClockTime origin = firstRecordTime;
+    const GstClockTime span = recordTime - firstRecordTime;
+    GstClockTime base;
+    GstClockTime target;
+    if(GST_CLOCK_TIME_IS_VALID(lastSplashTime) &&
+       lastSplashTime < playTime &&
+       (playTime < span || playTime - span <= lastSplashTime))
+    {
+        base = lastSplashTime + 1;
+        target = playTime - base;
+    } else if(playTime < span) {
+        base = 0;
+        target = playTime;
+    } else {
+        base = playTime - span;
+        target = span;
+    }
+    auto rebase =
+        [origin, base, span, target] (GstClockTime time) -> GstClockTime {
+            if(!GST_CLOCK_TIME_IS_VALID(time))
+                return time;
+            const GstClockTime elapsed = time > origin ? time - origin : 0;
+            return
+                base + (span > 0 ? gst_util_uint64_scale(elapsed, target, span) : 0);
+        };
+
+    for(GstBuffer* cached: gop) {
+        GstBuffer* buffer = gst_buffer_copy(cached);
+        gst_buffer_unref(cached);
+
+        GST_BUFFER_PTS(buffer) = rebase(GST_BUFFER_PTS(buffer));
+        GST_BUFFER_DTS(buffer) = rebase(GST_BUFFER_DTS(buffer));
+
+        gst_pad_chain(self->selectorSourcePad, buffer);
+    }
 }
 
 static GstPadProbeReturn
@@ -134,74 +543,136 @@ onSourcePadData(GstPad* pad,
                 GstPadProbeInfo* info,
                 gpointer userData)
 {
-    Log()->trace(
+    TRACE_LOG(
+        MediaLog(),
         ">> RtspPlayMedia.onSourcePadData. pad: {}",
         static_cast<void*>(pad));
 
-    RtspPlayMedia* self = _RTSP_PLAY_MEDIA(userData);
+    SourceProbeData* data = static_cast<SourceProbeData*>(userData);
 
     GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
     if(!buffer)
         return GST_PAD_PROBE_OK;
 
+    data->source->touch();
+
+    RtspPlayMedia* self = data->media;
+
+    if(PathMetrics* metrics = self->p->metrics.get()) {
+        const gint64 ingestTime = Metrics::IngestTime(buffer);
+        if(ingestTime > 0) {
+            const gint64 latency = g_get_monotonic_time() - ingestTime;
+            metrics->observeLatency(latency > 0 ? latency : 0);
+        }
+    }
+    if(g_atomic_int_get(&self->sourceSwitchPending)) {
+        const bool keyFrame = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
 
-    GstClockPtr clockPtr(gst_element_get_clock(self->selector));
-    GstClock* clock = clockPtr.get();
-    if(clock) {
-        const GstClockTime bufferTime = gst_clock_get_time(clock);
+        std::vector<GstBuffer*> gop;
+        if(!keyFrame && self->p->gopCache)
+            gop = self->p->gopCache->snapshot(GopCache::RecordTime(buffer));
 
-        // Log()->debug("Buffer. Pts: {}, clock: {}", GST_BUFFER_PTS(buffer), bufferTime);
+        if((keyFrame || !gop.empty()) &&
+           g_atomic_int_compare_and_exchange(&self->sourceSwitchPending, TRUE, FALSE))
+        {
+            // switching before key frame (or cached GOP) passes the pad,
+            // so players will not get frames referencing not seen ones
+            MediaLog()->debug("RtspPlayMedia. Switching to source on key frame.");
+            g_object_set(G_OBJECT(self->selector), "active-pad", self->selectorSourcePad, NULL);
+            g_atomic_int_set(&self->sourceSelected, TRUE);
+
+            if(PathMetrics* metrics = self->p->metrics.get()) {
+                ++metrics->switchesToSource;
+                metrics->splashActive = 0;
+            }
 
-        self->lastBufferTime = bufferTime;
+            if(!gop.empty())
+                primeFromGopCache(self, gop, buffer);
+        } else {
+            for(GstBuffer* cached: gop)
+                gst_buffer_unref(cached);
+        }
     }
 
-    Log()->trace("<< RtspPlayMedia.onSourcePadData");
+    TRACE_LOG(MediaLog(), "<< RtspPlayMedia.onSourcePadData");
 
     return GST_PAD_PROBE_OK;
 }
 
-static void
-switchSelector(
-    RtspPlayMedia* self,
-    bool selectSource)
+static GstPadProbeReturn
+onSplashPadData(GstPad* /*pad*/,
+                GstPadProbeInfo* info,
+                gpointer userData)
 {
-    GstElement* selector = self->selector;
+    RtspPlayMedia* self = static_cast<RtspPlayMedia*>(userData);
 
-    if(selectSource && !self->sourceSelected) {
-        Log()->debug("RtspPlayMedia. Switching to source.");
-        self->sourceSelected = true;
-        g_object_set(G_OBJECT(selector), "active-pad", self->selectorSourcePad, NULL);
-    } else if(!selectSource && self->sourceSelected) {
-        Log()->debug("RtspPlayMedia. Switching to splash screen.");
-        self->sourceSelected = false;
-        g_object_set(G_OBJECT(self->selector), "active-pad", self->selectorTestCardPad, NULL);
-    }
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if(!buffer)
+        return GST_PAD_PROBE_OK;
+
+    const GstClockTime time = BufferTime(buffer);
+    if(GST_CLOCK_TIME_IS_VALID(time))
+        self->p->lastSplashTime = time;
+
+    return GST_PAD_PROBE_OK;
 }
 
-static gboolean
-checkSourceTimeout(
-    gpointer userData)
+static void
+requestKeyUnit(RtspPlayMedia* self)
 {
-    Log()->trace(">> RtspPlayMedia.checkSourceTimeout");
+    gst_pad_send_event(
+        self->sourcePad,
+        gst_video_event_new_upstream_force_key_unit(
+            GST_CLOCK_TIME_NONE, TRUE, 0));
+}
 
-    RtspPlayMedia* self = _RTSP_PLAY_MEDIA(userData);
+void
+rtsp_play_media_session_started(RtspPlayMedia* self)
+{
+    if(!self->selector || !g_atomic_int_get(&self->sourceSelected))
+        return;
+
+    const gint64 now = g_get_monotonic_time();
+    gint64 lastRequest = self->p->lastKeyUnitRequest.load();
+    if(now - lastRequest < KEY_UNIT_REQUEST_INTERVAL_US ||
+       !self->p->lastKeyUnitRequest.compare_exchange_strong(lastRequest, now))
+    {
+        return;
+    }
 
-    GstClockPtr clockPtr(gst_element_get_clock(self->selector));
-    GstClock* clock = clockPtr.get();
-    if(clock) {
-        GstClockTime currentTime = gst_clock_get_time(clock);
+    MediaLog()->debug("RtspPlayMedia. Session joined live media, requesting key frame.");
+    requestKeyUnit(self);
+}
 
-        const bool timeout =
-            GST_CLOCK_DIFF(self->lastBufferTime, currentTime) > (2 * GST_SECOND);
+static void
+switchSelector(
+    RtspPlayMedia* self,
+    bool selectSource)
+{
+    const bool sourceSelected = g_atomic_int_get(&self->sourceSelected);
 
-        Log()->trace("Buffer timeout: {}", timeout);
+    if(selectSource && !sourceSelected) {
+        if(!g_atomic_int_get(&self->sourceSwitchPending)) {
+            MediaLog()->debug("RtspPlayMedia. Waiting source key frame to switch.");
+            g_atomic_int_set(&self->sourceSwitchPending, TRUE);
 
-        switchSelector(self, !timeout);
-    }
+            // ask recorder for key frame to not wait whole GOP
+            requestKeyUnit(self);
+        }
+    } else if(!selectSource) {
+        g_atomic_int_compare_and_exchange(&self->sourceSwitchPending, TRUE, FALSE);
 
-    Log()->trace("<< RtspPlayMedia.checkSourceTimeout");
+        if(sourceSelected) {
+            MediaLog()->debug("RtspPlayMedia. Switching to splash screen.");
+            g_atomic_int_set(&self->sourceSelected, FALSE);
+            g_object_set(G_OBJECT(self->selector), "active-pad", self->selectorTestCardPad, NULL);
 
-    return GST_PAD_PROBE_OK;
+            if(PathMetrics* metrics = self->p->metrics.get()) {
+                ++metrics->switchesToSplash;
+                metrics->splashActive = 1;
+            }
+        }
+    }
 }
 
 static void
@@ -209,23 +680,67 @@ prepared(
     GstRTSPMedia* media,
     gpointer /*userData*/)
 {
-    Log()->trace(">> RtspPlayMedia.prepared");
+    MediaLog()->trace(">> RtspPlayMedia.prepared");
 
     RtspPlayMedia* self = _RTSP_PLAY_MEDIA(media);
 
-    self->sourceSelected = false;
+    if(!self->selector)
+        return;
+
+    g_atomic_int_set(&self->sourceSelected, FALSE);
+    g_atomic_int_set(&self->sourceSwitchPending, FALSE);
     g_object_set(G_OBJECT(self->selector), "active-pad", self->selectorTestCardPad, NULL);
 
+    self->p->lastSplashTime = GST_CLOCK_TIME_NONE;
+    self->selectorTestCardPadProbe =
+        gst_pad_add_probe(
+            self->selectorTestCardPad,
+            GST_PAD_PROBE_TYPE_BUFFER, onSplashPadData,
+            self, nullptr);
+
+    if(self->p->metrics)
+        self->p->metrics->splashActive = 1;
+
+    if(!self->p->watchdog) {
+        MediaLog()->critical("RtspPlayMedia. Source watchdog is not set.");
+        return;
+    }
+
+    self->p->source =
+        self->p->watchdog->watch(
+            [self] (bool timeout) {
+                switchSelector(self, !timeout);
+            });
+
     self->sourcePadProbe =
         gst_pad_add_probe(
             self->sourcePad,
             GST_PAD_PROBE_TYPE_BUFFER, onSourcePadData,
-            self, NULL);
+            new SourceProbeData { self, self->p->source },
+            [] (gpointer userData) {
+                delete static_cast<SourceProbeData*>(userData);
+            });
+
+    MediaLog()->trace("<< RtspPlayMedia.prepared");
+}
+
+static void
+unwatch_source(RtspPlayMedia* self)
+{
+    if(self->sourcePadProbe) {
+        gst_pad_remove_probe(self->sourcePad, self->sourcePadProbe);
+        self->sourcePadProbe = 0;
+    }
 
-    self->checkTimeout =
-        g_timeout_add(500, checkSourceTimeout, self);
+    if(self->selectorTestCardPadProbe) {
+        gst_pad_remove_probe(self->selectorTestCardPad, self->selectorTestCardPadProbe);
+        self->selectorTestCardPadProbe = 0;
+    }
 
-    Log()->trace("<< RtspPlayMedia.prepared");
+    if(self->p->source) {
+        self->p->watchdog->unwatch(self->p->source);
+        self->p->source.reset();
+    }
 }
 
 static void
@@ -233,17 +748,40 @@ unprepared(
     GstRTSPMedia* media,
     gpointer /*userData*/)
 {
-    Log()->trace(">> RtspPlayMedia.unprepared");
+    MediaLog()->trace(">> RtspPlayMedia.unprepared");
 
     RtspPlayMedia* self = _RTSP_PLAY_MEDIA(media);
 
-    gst_pad_remove_probe(self->sourcePad, self->sourcePadProbe);
-    self->sourcePadProbe = 0;
+    if(!self->selector)
+        return;
 
-    g_source_remove(self->checkTimeout);
-    self->checkTimeout = 0;
+    unwatch_source(self);
 
-    Log()->trace("<< RtspPlayMedia.unprepared");
+    if(self->p->metrics)
+        self->p->metrics->splashActive = 0;
+
+    MediaLog()->trace("<< RtspPlayMedia.unprepared");
+}
+
+static void
+finalize(GObject* object)
+{
+    RtspPlayMedia* self = _RTSP_PLAY_MEDIA(object);
+
+    unwatch_source(self);
+
+    if(self->selector) {
+        gst_object_unref(self->selector);
+        gst_object_unref(self->selectorTestCardPad);
+        gst_object_unref(self->selectorSourcePad);
+        gst_object_unref(self->sourcePad);
+        self->selector = nullptr;
+    }
+
+    delete self->p;
+    self->p = nullptr;
+
+    G_OBJECT_CLASS(rtsp_play_media_parent_class)->finalize(object);
 }
 
 static void
@@ -255,6 +793,7 @@ rtsp_play_media_class_init(
     GObjectClass* objectKlass = G_OBJECT_CLASS(klass);
 
     objectKlass->constructed = constructed;
+    objectKlass->finalize = finalize;
 }
 
 static void
@@ -263,6 +802,8 @@ rtsp_play_media_init(
 {
     // GstRTSPMedia* parent = GST_RTSP_MEDIA(self);
 
+    self->p = new CxxPrivate;
+
     self->selector = nullptr;
 
     self->selectorTestCardPad = nullptr;
@@ -271,10 +812,10 @@ rtsp_play_media_init(
     self->selectorSourcePad = nullptr;
 
     self->sourcePadProbe = 0;
-    self->checkTimeout = 0;
+    self->selectorTestCardPadProbe = 0;
 
-    self->lastBufferTime = 0;
-    self->sourceSelected = false;
+    self->sourceSelected = FALSE;
+    self->sourceSwitchPending = FALSE;
 
     g_signal_connect(self, "prepared", G_CALLBACK(prepared), nullptr);
     g_signal_connect(self, "unprepared", G_CALLBACK(unprepared), nullptr);
@@ -7,6 +7,12 @@
 #include <CxxPtr/GlibPtr.h>
 
 #include "Types.h"
+#include "Options.h"
+#include "PathStreams.h"
+#include "SourceWatchdog.h"
+#include "GopCache.h"
+#include "Metrics.h"
+#include "ElementPool.h"
 
 
 namespace RestreamServerLib
@@ -17,10 +23,58 @@ G_BEGIN_DECLS
 #define TYPE_RTSP_PLAY_MEDIA rtsp_play_media_get_type()
 G_DECLARE_FINAL_TYPE(RtspPlayMedia, rtsp_play_media, , RTSP_PLAY_MEDIA, GstRTSPMedia)
 
+// splashSource is rtsp url for SplashMode::LOOPBACK
+// and interpipesink name for SplashMode::INTERPIPE.
+// Every of codecs gets own payN stream.
+// Splash screen is available only for first H264 stream.
+// batch groups RTP packets of every frame into buffer lists.
+// If remoteSource (rtsp url) is set, single H264 stream is pulled from it
+// instead of local recorder.
+// Pipeline is taken from pool if it's set.
+// latencyProfile is applied to rtspsrc of splash screen or remote source.
 GstElement*
 rtsp_play_media_create_element(
-    const URL& splashSource,
-    const std::string& listenTo);
+    SplashMode splashMode,
+    const std::string& splashSource,
+    const std::string& proxyName,
+    const Codecs& codecs,
+    bool batch = false,
+    const std::string& remoteSource = std::string(),
+    ElementPool* pool = nullptr,
+    const LatencyProfile& = LatencyProfile());
+
+// Every of codecs gets own payN stream relaying RTP from recorder.
+// Returns nullptr if codecs is empty (i.e. recorder is not connected yet).
+GstElement*
+rtsp_play_media_create_relay_element(
+    const std::string& proxyName,
+    const Codecs& codecs,
+    bool batch = false,
+    ElementPool* pool = nullptr);
+
+// should be set before media is prepared
+void
+rtsp_play_media_set_source_watchdog(
+    RtspPlayMedia*,
+    const std::shared_ptr<SourceWatchdog>&);
+
+// should be set before media is prepared
+void
+rtsp_play_media_set_gop_cache(
+    RtspPlayMedia*,
+    const std::shared_ptr<GopCache>&);
+
+// should be set before media is prepared
+void
+rtsp_play_media_set_metrics(
+    RtspPlayMedia*,
+    const std::shared_ptr<PathMetrics>&);
+
+// should be called when new session starts playing (possibly shared) media.
+// asks recorder for key frame if source is already live,
+// since cached GOP can't be pushed to one of sessions only
+void
+rtsp_play_media_session_started(RtspPlayMedia*);
 
 G_END_DECLS
 
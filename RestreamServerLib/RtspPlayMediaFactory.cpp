@@ -1,5 +1,9 @@
 #include "RtspPlayMediaFactory.h"
 
+#include <mutex>
+
+#include <CxxPtr/GstPtr.h>
+
 #include "Log.h"
 #include "RtspRecordMediaFactory.h"
 
@@ -12,8 +16,24 @@ namespace
 
 struct CxxPrivate
 {
-    URL splashSource;
-    std::string listenTo;
+    SplashMode splashMode;
+    std::string splashSource;
+    std::string proxyName;
+    std::shared_ptr<PathStreams> streams;
+    std::shared_ptr<SourceWatchdog> watchdog;
+    std::shared_ptr<GopCache> gopCache;
+    std::shared_ptr<PathMetrics> metrics;
+    bool rtpRelay;
+    bool batchUdp;
+    std::string remoteSource;
+    std::shared_ptr<ElementPool> elementPool;
+    LatencyProfile latencyProfile;
+    bool selectorCacheBuffers;
+
+    std::mutex builtMutex;
+    // streams known when media element was built last time
+    bool built;
+    Codecs builtCodecs;
 };
 
 }
@@ -29,6 +49,10 @@ static GstElement*
 create_element(
     GstRTSPMediaFactory* factory,
     const GstRTSPUrl* url);
+static void
+configure(
+    GstRTSPMediaFactory* factory,
+    GstRTSPMedia* media);
 
 
 G_DEFINE_TYPE(
@@ -39,16 +63,51 @@ G_DEFINE_TYPE(
 
 RtspPlayMediaFactory*
 rtsp_play_media_factory_new(
-    const URL& splashSource,
-    const std::string& listenTo)
+    SplashMode splashMode,
+    const std::string& splashSource,
+    const std::string& proxyName,
+    const std::shared_ptr<PathStreams>& streams,
+    const std::shared_ptr<SourceWatchdog>& watchdog,
+    const std::shared_ptr<GopCache>& gopCache,
+    const std::shared_ptr<PathMetrics>& metrics,
+    bool rtpRelay,
+    GstRTSPAddressPool* multicastPool,
+    bool batchUdp,
+    const std::string& remoteSource,
+    const std::shared_ptr<ElementPool>& elementPool,
+    const LatencyProfile& latencyProfile,
+    bool selectorCacheBuffers)
 {
     RtspPlayMediaFactory* instance =
         _RTSP_PLAY_MEDIA_FACTORY(
             g_object_new(TYPE_RTSP_PLAY_MEDIA_FACTORY, NULL));
 
     if(instance) {
+        instance->p->splashMode = splashMode;
         instance->p->splashSource = splashSource;
-        instance->p->listenTo = listenTo;
+        instance->p->proxyName = proxyName;
+        instance->p->streams = streams;
+        instance->p->watchdog = watchdog;
+        instance->p->gopCache = gopCache;
+        instance->p->metrics = metrics;
+        instance->p->rtpRelay = rtpRelay;
+        instance->p->batchUdp = batchUdp;
+        instance->p->remoteSource = remoteSource;
+        instance->p->elementPool = elementPool;
+        instance->p->latencyProfile = latencyProfile;
+        instance->p->selectorCacheBuffers = selectorCacheBuffers;
+
+        if(latencyProfile.retransmission) {
+            // lost packets could be requested by players
+            gst_rtsp_media_factory_set_retransmission_time(
+                GST_RTSP_MEDIA_FACTORY(instance), 500 * GST_MSECOND);
+        }
+
+        if(multicastPool) {
+            GstRTSPMediaFactory* parent = GST_RTSP_MEDIA_FACTORY(instance);
+            gst_rtsp_media_factory_set_address_pool(parent, multicastPool);
+            gst_rtsp_media_factory_set_protocols(parent, GST_RTSP_LOWER_TRANS_UDP_MCAST);
+        }
     }
 
     return instance;
@@ -62,6 +121,17 @@ rtsp_play_media_factory_class_init(
         GST_RTSP_MEDIA_FACTORY_CLASS(klass);
 
     parent_klass->create_element = create_element;
+
+    GObjectClass* object_klass = G_OBJECT_CLASS(klass);
+    object_klass->finalize =
+        [] (GObject* object) {
+            RtspPlayMediaFactory* self = _RTSP_PLAY_MEDIA_FACTORY(object);
+            delete self->p;
+            self->p = nullptr;
+
+            G_OBJECT_CLASS(rtsp_play_media_factory_parent_class)->finalize(object);
+        };
+    parent_klass->configure = configure;
 }
 
 static void
@@ -69,6 +139,10 @@ rtsp_play_media_factory_init(
     RtspPlayMediaFactory* self)
 {
     self->p = new CxxPrivate;
+    self->p->rtpRelay = false;
+    self->p->batchUdp = false;
+    self->p->selectorCacheBuffers = true;
+    self->p->built = false;
 
     GstRTSPMediaFactory* parent = GST_RTSP_MEDIA_FACTORY(self);
 
@@ -86,10 +160,138 @@ create_element(
 {
     RtspPlayMediaFactory* self = _RTSP_PLAY_MEDIA_FACTORY(factory);
 
-    return
-        rtsp_play_media_create_element(
-            self->p->splashSource,
-            self->p->listenTo);
+    const Codecs codecs = self->p->streams ? self->p->streams->get() : Codecs();
+
+    GstElement* element =
+        self->p->rtpRelay ?
+            rtsp_play_media_create_relay_element(
+                self->p->proxyName,
+                codecs,
+                self->p->batchUdp,
+                self->p->elementPool.get()) :
+            rtsp_play_media_create_element(
+                self->p->splashMode,
+                self->p->splashSource,
+                self->p->proxyName,
+                codecs,
+                self->p->batchUdp,
+                self->p->remoteSource,
+                self->p->elementPool.get(),
+                self->p->latencyProfile);
+
+    if(element) {
+        std::lock_guard<std::mutex> lock(self->p->builtMutex);
+        self->p->built = true;
+        self->p->builtCodecs = codecs;
+    }
+
+    return element;
+}
+
+bool
+rtsp_play_media_factory_is_stale(RtspPlayMediaFactory* self)
+{
+    // streams of remote recorder are not known
+    if(!self->p->streams || !self->p->remoteSource.empty())
+        return false;
+
+    // media built for previous recorder keeps showing splash screen
+    const Codecs codecs = self->p->streams->get();
+    if(codecs.empty())
+        return false;
+
+    std::lock_guard<std::mutex> lock(self->p->builtMutex);
+    if(!self->p->built)
+        return false;
+
+    // see rtsp_play_media_create_element
+    const Codecs builtCodecs =
+        self->p->builtCodecs.empty() ? Codecs{Codec::H264} : self->p->builtCodecs;
+
+    return builtCodecs != codecs;
+}
+
+// stages of i-th stream elements named by rtsp_play_media_create_element
+static void
+attach_stage_probes(
+    GstElement* element,
+    unsigned i,
+    const std::shared_ptr<PathMetrics>& metrics)
+{
+    const std::pair<std::string, TraceStage> stages[] = {
+        { fmt::format("source{}", i), TraceStage::INTERPIPE },
+        { fmt::format("parse{}", i), TraceStage::PARSE },
+        { fmt::format("pay{}", i), TraceStage::PAY },
+    };
+
+    for(const auto& stage: stages) {
+        GstElementPtr stagePtr(gst_bin_get_by_name(GST_BIN(element), stage.first.c_str()));
+        if(!stagePtr)
+            continue;
+
+        GstPadPtr srcPadPtr(gst_element_get_static_pad(stagePtr.get(), "src"));
+        if(srcPadPtr)
+            PathMetrics::AddStageProbe(srcPadPtr.get(), metrics, stage.second);
+    }
+}
+
+static void
+configure(
+    GstRTSPMediaFactory* factory,
+    GstRTSPMedia* media)
+{
+    GST_RTSP_MEDIA_FACTORY_CLASS(rtsp_play_media_factory_parent_class)->
+        configure(factory, media);
+
+    RtspPlayMediaFactory* self = _RTSP_PLAY_MEDIA_FACTORY(factory);
+
+    rtsp_play_media_set_source_watchdog(
+        _RTSP_PLAY_MEDIA(media),
+        self->p->watchdog);
+    rtsp_play_media_set_gop_cache(
+        _RTSP_PLAY_MEDIA(media),
+        self->p->gopCache);
+
+    GstElementPtr elementPtr(gst_rtsp_media_get_element(media));
+
+    if(!self->p->selectorCacheBuffers) {
+        // set here, so pooled pipelines are not keyed by it
+        GstElementPtr selectorPtr(gst_bin_get_by_name(GST_BIN(elementPtr.get()), "selector"));
+        if(selectorPtr)
+            g_object_set(selectorPtr.get(), "cache-buffers", FALSE, NULL);
+    }
+
+    if(!self->p->metrics)
+        return;
+
+    rtsp_play_media_set_metrics(
+        _RTSP_PLAY_MEDIA(media),
+        self->p->metrics);
+
+    PathMetrics::TrackElements(elementPtr.get(), self->p->metrics);
+
+    for(unsigned i = 0; ; ++i) {
+        const std::string payName = fmt::format("pay{}", i);
+        GstElementPtr payPtr(gst_bin_get_by_name(GST_BIN(elementPtr.get()), payName.c_str()));
+        if(!payPtr)
+            break;
+
+        GstPadPtr srcPadPtr(gst_element_get_static_pad(payPtr.get(), "src"));
+        PathMetrics::AddCountingProbe(
+            srcPadPtr.get(), self->p->metrics,
+            &PathMetrics::bytesOut, &PathMetrics::packetsOut);
+
+        if(self->p->metrics->tracing)
+            attach_stage_probes(elementPtr.get(), i, self->p->metrics);
+    }
+
+    if(self->p->metrics->tracing) {
+        GstElementPtr selectorPtr(gst_bin_get_by_name(GST_BIN(elementPtr.get()), "selector"));
+        if(selectorPtr) {
+            GstPadPtr srcPadPtr(gst_element_get_static_pad(selectorPtr.get(), "src"));
+            PathMetrics::AddStageProbe(srcPadPtr.get(), self->p->metrics, TraceStage::SELECTOR);
+        }
+    }
 }
 
 }
@@ -22,8 +22,25 @@ G_DECLARE_FINAL_TYPE(
 
 RtspPlayMediaFactory*
 rtsp_play_media_factory_new(
-    const URL& splashSource,
-    const std::string& listenTo);
+    SplashMode splashMode,
+    const std::string& splashSource,
+    const std::string& proxyName,
+    const std::shared_ptr<PathStreams>&,
+    const std::shared_ptr<SourceWatchdog>&,
+    const std::shared_ptr<GopCache>&,
+    const std::shared_ptr<PathMetrics>&,
+    bool rtpRelay = false,
+    GstRTSPAddressPool* multicastPool = nullptr, // offer only multicast if set
+    bool batchUdp = false,
+    const std::string& remoteSource = std::string(), // pulled instead of local recorder if set
+    const std::shared_ptr<ElementPool>& = nullptr,
+    const LatencyProfile& = LatencyProfile(),
+    bool selectorCacheBuffers = true); // see MemoryOptions::selectorCacheBuffers
+
+// true if shared media was built for other streams than recorder announced
+// (f.e. for assumed H264 stream before ANNOUNCE)
+bool
+rtsp_play_media_factory_is_stale(RtspPlayMediaFactory*);
 
 G_END_DECLS
 
@@ -2,9 +2,12 @@
 
 #include <glib.h>
 
+#include <CxxPtr/GlibPtr.h>
 #include <CxxPtr/GstPtr.h>
 
 #include "Log.h"
+#include "Private.h"
+#include "Elements.h"
 
 
 namespace RestreamServerLib
@@ -22,29 +25,262 @@ G_DEFINE_TYPE(
     GST_TYPE_RTSP_MEDIA)
 
 
+namespace
+{
+
+struct StreamDesc
+{
+    const char* encodingName;
+    Codec codec;
+    const char* depay;
+    const char* parse;
+    // parser has "config-interval" property
+    bool configInterval;
+};
+
+const StreamDesc StreamDescs[] = {
+    { "H264", Codec::H264, "rtph264depay", "h264parse", true },
+    { "H265", Codec::H265, "rtph265depay", "h265parse", true },
+    { "MPEG4-GENERIC", Codec::AAC, "rtpmp4gdepay", "aacparse", false },
+    { "MP4A-LATM", Codec::AAC, "rtpmp4adepay", "aacparse", false },
+    { "OPUS", Codec::OPUS, "rtpopusdepay", "opusparse", false },
+    { "X-GST-OPUS-DRAFT-SPITTKA-00", Codec::OPUS, "rtpopusdepay", "opusparse", false },
+};
+
+const StreamDesc* FindStreamDesc(const std::string& encodingName)
+{
+    for(const StreamDesc& desc: StreamDescs) {
+        if(0 == g_ascii_strcasecmp(desc.encodingName, encodingName.c_str()))
+            return &desc;
+    }
+
+    return nullptr;
+}
+
+bool IsVideo(Codec codec)
+{
+    return Codec::H264 == codec || Codec::H265 == codec;
+}
+
+struct SegmentLocation
+{
+    std::string dir;
+    const char* extension;
+};
+
+// segments are named by local time they are started at
+gchar* FormatSegmentLocation(GstElement* /*splitmux*/, guint fragmentId, gpointer userData)
+{
+    const SegmentLocation* location = static_cast<const SegmentLocation*>(userData);
+
+    GDateTime* now = g_date_time_new_now_local();
+    GCharPtr timePtr(g_date_time_format(now, "%Y%m%d-%H%M%S"));
+    g_date_time_unref(now);
+
+    const std::string path =
+        fmt::format(
+            "{}/{}-{:05}.{}",
+            location->dir, timePtr.get(), fragmentId, location->extension);
+
+    MediaLog()->debug("Starting archive segment \"{}\"", path);
+
+    return g_strdup(path.c_str());
+}
+
+// splitmuxsink rotating segments on key frames
+GstElement* MakeArchiveSink(const std::string& dir, const ArchiveOptions& archive)
+{
+    const bool mp4 = ArchiveFormat::FRAGMENTED_MP4 == archive.format;
+
+    if(g_mkdir_with_parents(dir.c_str(), 0755) != 0) {
+        MediaLog()->error("Fail to create archive directory \"{}\"", dir);
+        return nullptr;
+    }
+
+    GstElement* splitmux = MakeElement("splitmuxsink");
+    GstElement* muxer = MakeElement(mp4 ? "mp4mux" : "mpegtsmux");
+    GstElement* sink = MakeElement("filesink");
+    if(!splitmux || !muxer || !sink) {
+        for(GstElement* element: { splitmux, muxer, sink }) {
+            if(element)
+                ReleaseElement(element);
+        }
+        return nullptr;
+    }
+
+    if(mp4)
+        g_object_set(muxer, "fragment-duration", 1000, NULL);
+
+    // fully buffered, so disk gets large sequential writes
+    // instead of one write per buffer
+    g_object_set(sink,
+        "buffer-mode", 0,
+        "buffer-size", archive.writeBufferBytes,
+        NULL);
+
+    g_object_set(splitmux,
+        "max-size-time", static_cast<guint64>(archive.segmentDurationSec) * GST_SECOND,
+        "muxer", muxer,
+        "sink", sink,
+        NULL);
+
+    g_signal_connect_data(
+        splitmux, "format-location",
+        G_CALLBACK(FormatSegmentLocation),
+        new SegmentLocation { dir, mp4 ? "mp4" : "ts" },
+        [] (gpointer userData, GClosure*) {
+            delete static_cast<SegmentLocation*>(userData);
+        },
+        GConnectFlags());
+
+    return splitmux;
+}
+
+// tee ! queue ! parse ! archiveSink.
+// queue is leaky, so slow disk drops archived data instead of blocking tee
+bool AddArchiveBranch(
+    GstBin* bin,
+    GstElement* tee,
+    GstElement* archiveSink,
+    const StreamDesc* desc,
+    const ArchiveOptions& archive)
+{
+    GstElement* queue = MakeElement("queue");
+    if(queue) {
+        g_object_set(queue,
+            "leaky", 2, // downstream
+            "max-size-buffers", 0,
+            "max-size-bytes", 0,
+            "max-size-time", static_cast<guint64>(archive.maxQueueMs) * GST_MSECOND,
+            NULL);
+    }
+
+    // parser converts stream to format expected by muxer
+    GstElement* parse = MakeElement(desc->parse);
+
+    if(!AddLinked(bin, { tee, queue, parse }))
+        return false;
+
+    if(!gst_element_link_pads(
+        parse, "src",
+        archiveSink, IsVideo(desc->codec) ? "video" : "audio_%u"))
+    {
+        MediaLog()->critical("Fail to link archive branch");
+        return false;
+    }
+
+    return true;
+}
+
+GstElement*
+BuildRecordElement(
+    const std::string& proxyName,
+    const std::vector<const StreamDesc*>& descs,
+    bool rtpRelay,
+    const std::string& archiveDir,
+    const ArchiveOptions& archive,
+    bool sync)
+{
+    GstElement* bin = gst_bin_new(nullptr);
+
+    GstElement* archiveSink = nullptr;
+    if(!rtpRelay && !archiveDir.empty()) {
+        archiveSink = AddElement(GST_BIN(bin), MakeArchiveSink(archiveDir, archive));
+        if(!archiveSink)
+            MediaLog()->error("Fail to create archive sink. Archiving is disabled.");
+    }
+    bool videoArchived = false;
+
+    for(unsigned i = 0; i < descs.size(); ++i) {
+        const StreamDesc* desc = descs[i];
+        const std::string depayName = fmt::format("depay{}", i);
+
+        GstElement* sink =
+            MakeElement("interpipesink", Private::StreamProxyName(proxyName, i).c_str());
+        if(sink)
+            g_object_set(sink, "sync", !rtpRelay && sync ? TRUE : FALSE, "allow-negotiation", FALSE, NULL);
+
+        bool linked;
+        if(rtpRelay) {
+            linked =
+                AddLinked(GST_BIN(bin), { MakeElement("identity", depayName.c_str()), sink });
+        } else {
+            GstElement* parse = MakeElement(desc->parse);
+            if(parse && desc->configInterval)
+                g_object_set(parse, "config-interval", -1, NULL);
+
+            GstElement* depay = MakeElement(desc->depay, depayName.c_str());
+
+            // splitmuxsink accepts single video stream
+            const bool archived =
+                archiveSink && (!IsVideo(desc->codec) || !videoArchived);
+            if(archived) {
+                GstElement* tee = MakeElement("tee");
+                linked =
+                    AddLinked(GST_BIN(bin), { depay, parse, tee, sink }) &&
+                    AddArchiveBranch(GST_BIN(bin), tee, archiveSink, desc, archive);
+                videoArchived = videoArchived || IsVideo(desc->codec);
+            } else {
+                linked = AddLinked(GST_BIN(bin), { depay, parse, sink });
+            }
+        }
+
+        if(!linked) {
+            MediaLog()->critical("Fail to create record pipeline");
+            ReleaseElement(bin);
+            return nullptr;
+        }
+    }
+
+    return bin;
+}
+
+}
+
 GstElement*
 rtsp_record_media_create_element(
-    const std::string& proxyName)
+    const std::string& proxyName,
+    const std::vector<std::string>& encodingNames,
+    bool rtpRelay,
+    Codecs* codecs,
+    ElementPool* pool,
+    const std::string& archiveDir,
+    const ArchiveOptions& archive,
+    bool sync)
 {
-    Log()->trace(">> rtsp_record_media_create_element");
+    MediaLog()->trace(">> rtsp_record_media_create_element");
 
-    const std::string pipeline =
+    std::string key =
         fmt::format(
-            "rtph264depay name=depay0 ! h264parse config-interval=-1 ! "
-            "interpipesink name={} sync=true allow-negotiation=false",
-            proxyName);
+            "record {} {} {} {} {} {} {} {}",
+            proxyName, rtpRelay, sync, archiveDir,
+            static_cast<int>(archive.format), archive.segmentDurationSec,
+            archive.maxQueueMs, archive.writeBufferBytes);
+    std::vector<const StreamDesc*> descs;
+    Codecs streamCodecs;
+    for(unsigned i = 0; i < encodingNames.size(); ++i) {
+        const StreamDesc* desc = FindStreamDesc(encodingNames[i]);
+        if(!desc) {
+            MediaLog()->error(
+                "Unsupported record stream. stream: {}, encoding: {}",
+                i, encodingNames[i]);
+            return nullptr;
+        }
+
+        key += fmt::format(" {}", desc->encodingName);
+        descs.push_back(desc);
+        streamCodecs.push_back(desc->codec);
+    }
 
-    GError* error = nullptr;
     GstElement* element =
-        gst_parse_launch_full(
-            pipeline.c_str(), NULL, GST_PARSE_FLAG_PLACE_IN_BIN,
-            &error);
-    GErrorPtr errorPtr(error);
+        ElementPool::Launch(
+            pool, key,
+            [=] () {
+                return BuildRecordElement(proxyName, descs, rtpRelay, archiveDir, archive, sync);
+            });
 
-    if(errorPtr)
-        Log()->critical(
-            "Fail to create record pipeline: {}",
-            errorPtr->message);
+    if(element && codecs)
+        *codecs = streamCodecs;
 
     return element;
 }
@@ -53,7 +289,7 @@ static void
 constructed(
     GObject* object)
 {
-    Log()->trace(">> RtspRecordMedia.constructed");
+    MediaLog()->trace(">> RtspRecordMedia.constructed");
 
     // RtspRecordMedia* self = _RTSP_RECORD_MEDIA(object);
 
@@ -64,7 +300,7 @@ static void
 finalize(
     GObject* object)
 {
-    Log()->trace(">> RtspRecordMedia.finalize");
+    MediaLog()->trace(">> RtspRecordMedia.finalize");
 
     // RtspRecordMedia* self = _RTSP_RECORD_MEDIA(object);
 
@@ -76,7 +312,7 @@ prepared(
     GstRTSPMedia* media,
     gpointer userData)
 {
-    Log()->trace(">> RtspRecordMedia.prepared");
+    MediaLog()->trace(">> RtspRecordMedia.prepared");
 }
 
 static void
@@ -84,7 +320,7 @@ unprepared(
     GstRTSPMedia* media,
     gpointer /*userData*/)
 {
-    Log()->trace(">> RtspRecordMedia.unprepared");
+    MediaLog()->trace(">> RtspRecordMedia.unprepared");
 
     // RtspRecordMedia* self = _RTSP_RECORD_MEDIA(media);
 }
@@ -93,7 +329,7 @@ static void
 rtsp_record_media_class_init(
     RtspRecordMediaClass* klass)
 {
-    Log()->trace(">> RtspRecordMedia.class_init");
+    MediaLog()->trace(">> RtspRecordMedia.class_init");
 
     // GstRTSPMediaClass* parent_klass = GST_RTSP_MEDIA_CLASS(klass);
 
@@ -109,7 +345,7 @@ static void
 rtsp_record_media_init(
     RtspRecordMedia* self)
 {
-    Log()->trace(">> RtspRecordMedia.init");
+    MediaLog()->trace(">> RtspRecordMedia.init");
 
     // GstRTSPMedia* parent = GST_RTSP_MEDIA(self);
 
@@ -6,6 +6,10 @@
 
 #include <CxxPtr/GlibPtr.h>
 
+#include "Options.h"
+#include "PathStreams.h"
+#include "ElementPool.h"
+
 
 namespace RestreamServerLib
 {
@@ -20,9 +24,23 @@ G_DECLARE_FINAL_TYPE(
     RTSP_RECORD_MEDIA,
     GstRTSPMedia)
 
+// encodingNames are rtp encoding names of announced streams.
+// If rtpRelay is set streams are proxied as is, without depayloading.
+// Returns nullptr if any of streams is not supported.
+// Pipeline is taken from pool if it's set.
+// If archiveDir is set (and rtpRelay is not) streams are also muxed
+// to segments in archiveDir, without blocking live stream.
+// sync is applied to interpipesink of depayloaded streams.
 GstElement*
 rtsp_record_media_create_element(
-    const std::string& proxyName);
+    const std::string& proxyName,
+    const std::vector<std::string>& encodingNames,
+    bool rtpRelay,
+    Codecs* codecs,
+    ElementPool* pool = nullptr,
+    const std::string& archiveDir = std::string(),
+    const ArchiveOptions& archive = ArchiveOptions(),
+    bool sync = true);
 
 G_END_DECLS
 
@@ -1,6 +1,13 @@
 #include "RtspRecordMediaFactory.h"
 
+#include <cstdlib>
+
+#include <gst/sdp/gstsdpmessage.h>
+
+#include <CxxPtr/GstPtr.h>
+
 #include "Log.h"
+#include "Private.h"
 #include "RtspPlayMediaFactory.h"
 
 
@@ -13,6 +20,21 @@ namespace
 struct CxxPrivate
 {
     std::string proxyName;
+    std::shared_ptr<PathStreams> streams;
+    std::shared_ptr<GopCache> gopCache;
+    std::shared_ptr<PathMetrics> metrics;
+    bool rtpRelay;
+    std::shared_ptr<ElementPool> elementPool;
+    std::string archiveDir;
+    ArchiveOptions archive;
+    LatencyProfile latencyProfile;
+    std::shared_ptr<AccessUnitPool> accessUnitPool;
+};
+
+struct AccessUnitPoolProbeData
+{
+    std::shared_ptr<AccessUnitPool> pool;
+    std::shared_ptr<PathMetrics> metrics;
 };
 
 }
@@ -28,6 +50,10 @@ static GstElement*
 create_element(
     GstRTSPMediaFactory* factory,
     const GstRTSPUrl* url);
+static void
+configure(
+    GstRTSPMediaFactory* factory,
+    GstRTSPMedia* media);
 
 
 G_DEFINE_TYPE(
@@ -38,14 +64,41 @@ G_DEFINE_TYPE(
 
 RtspRecordMediaFactory*
 rtsp_record_media_factory_new(
-    const std::string& proxyName)
+    const std::string& proxyName,
+    const std::shared_ptr<PathStreams>& streams,
+    const std::shared_ptr<GopCache>& gopCache,
+    const std::shared_ptr<PathMetrics>& metrics,
+    bool rtpRelay,
+    const std::shared_ptr<ElementPool>& elementPool,
+    const std::string& archiveDir,
+    const ArchiveOptions& archive,
+    const LatencyProfile& latencyProfile,
+    const std::shared_ptr<AccessUnitPool>& accessUnitPool)
 {
     RtspRecordMediaFactory* instance =
         _RTSP_RECORD_MEDIA_FACTORY(
             g_object_new(TYPE_RTSP_RECORD_MEDIA_FACTORY, NULL));
 
-    if(instance)
+    if(instance) {
         instance->p->proxyName = proxyName;
+        instance->p->streams = streams;
+        instance->p->gopCache = gopCache;
+        instance->p->metrics = metrics;
+        instance->p->rtpRelay = rtpRelay;
+        instance->p->elementPool = elementPool;
+        instance->p->archiveDir = archiveDir;
+        instance->p->archive = archive;
+        instance->p->latencyProfile = latencyProfile;
+        instance->p->accessUnitPool = accessUnitPool;
+
+        GstRTSPMediaFactory* parent = GST_RTSP_MEDIA_FACTORY(instance);
+        if(latencyProfile.jitterLatencyMs >= 0)
+            gst_rtsp_media_factory_set_latency(parent, latencyProfile.jitterLatencyMs);
+#if GST_CHECK_VERSION(1, 16, 0)
+        if(latencyProfile.retransmission)
+            gst_rtsp_media_factory_set_do_retransmission(parent, TRUE);
+#endif
+    }
 
     return instance;
 }
@@ -58,6 +111,17 @@ rtsp_record_media_factory_class_init(
         GST_RTSP_MEDIA_FACTORY_CLASS(klass);
 
     parent_klass->create_element = create_element;
+    parent_klass->configure = configure;
+
+    GObjectClass* object_klass = G_OBJECT_CLASS(klass);
+    object_klass->finalize =
+        [] (GObject* object) {
+            RtspRecordMediaFactory* self = _RTSP_RECORD_MEDIA_FACTORY(object);
+            delete self->p;
+            self->p = nullptr;
+
+            G_OBJECT_CLASS(rtsp_record_media_factory_parent_class)->finalize(object);
+        };
 }
 
 static void
@@ -65,6 +129,7 @@ rtsp_record_media_factory_init(
     RtspRecordMediaFactory* self)
 {
     self->p = new CxxPrivate;
+    self->p->rtpRelay = false;
 
     GstRTSPMediaFactory* parent = GST_RTSP_MEDIA_FACTORY(self);
 
@@ -75,6 +140,218 @@ rtsp_record_media_factory_init(
     gst_rtsp_media_factory_set_media_gtype(parent, TYPE_RTSP_RECORD_MEDIA);
 }
 
+// marks element with generation of PathStreams it has set
+static GQuark
+streams_generation_quark()
+{
+    static GQuark quark = g_quark_from_static_string("restream-streams-generation");
+    return quark;
+}
+
+struct StreamsResetData
+{
+    std::shared_ptr<PathStreams> streams;
+    unsigned generation;
+};
+
+// extracts streams encoding names from SDP of ANNOUNCE request being handled
+static std::vector<std::string>
+announced_encoding_names()
+{
+    std::vector<std::string> encodingNames;
+
+    GstRTSPContext* ctx = gst_rtsp_context_get_current();
+    if(!ctx || !ctx->request || ctx->method != GST_RTSP_ANNOUNCE)
+        return encodingNames;
+
+    guint8* data = nullptr;
+    guint size = 0;
+    if(GST_RTSP_OK != gst_rtsp_message_get_body(ctx->request, &data, &size) || !size)
+        return encodingNames;
+
+    GstSDPMessage* sdp = nullptr;
+    gst_sdp_message_new(&sdp);
+    if(GST_SDP_OK == gst_sdp_message_parse_buffer(data, size, sdp)) {
+        for(guint i = 0; i < gst_sdp_message_medias_len(sdp); ++i) {
+            const GstSDPMedia* media = gst_sdp_message_get_media(sdp, i);
+
+            std::string encodingName;
+            if(gst_sdp_media_formats_len(media) > 0) {
+                const gint pt = atoi(gst_sdp_media_get_format(media, 0));
+                GstCaps* caps = gst_sdp_media_get_caps_from_media(media, pt);
+                if(caps) {
+                    const GstStructure* structure = gst_caps_get_structure(caps, 0);
+                    const gchar* name =
+                        gst_structure_get_string(structure, "encoding-name");
+                    if(name)
+                        encodingName = name;
+                    gst_caps_unref(caps);
+                }
+            }
+
+            encodingNames.push_back(encodingName);
+        }
+    }
+    gst_sdp_message_free(sdp);
+
+    return encodingNames;
+}
+
+static GstPadProbeReturn
+on_gop_cache_data(
+    GstPad* /*pad*/,
+    GstPadProbeInfo* info,
+    gpointer userData)
+{
+    GopCache* gopCache = static_cast<std::shared_ptr<GopCache>*>(userData)->get();
+
+    if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+        GstBuffer* buffer =
+            gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+        gopCache->push(buffer);
+    } else if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        switch(GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info))) {
+            case GST_EVENT_STREAM_START:
+            case GST_EVENT_FLUSH_START:
+            case GST_EVENT_EOS:
+                gopCache->clear();
+                break;
+            default:
+                break;
+        }
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+// attaches GOP cache to first H264 stream (the one with splash screen on play side).
+// should be attached after probes modifying buffer,
+// since buffer referenced by cache is not writable anymore
+static void
+attach_gop_cache(
+    GstElement* element,
+    const std::string& proxyName,
+    const Codecs& codecs,
+    const std::shared_ptr<GopCache>& gopCache)
+{
+    gopCache->clear();
+
+    for(unsigned i = 0; i < codecs.size(); ++i) {
+        if(Codec::H264 != codecs[i])
+            continue;
+
+        const std::string sinkName = Private::StreamProxyName(proxyName, i);
+        GstElementPtr sinkPtr(gst_bin_get_by_name(GST_BIN(element), sinkName.c_str()));
+        if(!sinkPtr)
+            return;
+
+        GstPadPtr padPtr(gst_element_get_static_pad(sinkPtr.get(), "sink"));
+        gst_pad_add_probe(
+            padPtr.get(),
+            static_cast<GstPadProbeType>(
+                GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+            on_gop_cache_data,
+            new std::shared_ptr<GopCache>(gopCache),
+            [] (gpointer userData) {
+                delete static_cast<std::shared_ptr<GopCache>*>(userData);
+            });
+
+        return;
+    }
+}
+
+// should be attached before other probes of sink pad,
+// so they see pooled buffer
+static void
+attach_access_unit_pool(
+    GstElement* element,
+    const std::string& proxyName,
+    const Codecs& codecs,
+    const std::shared_ptr<AccessUnitPool>& pool,
+    const std::shared_ptr<PathMetrics>& metrics)
+{
+    for(unsigned i = 0; i < codecs.size(); ++i) {
+        // audio frames are too small to be worth pool buffer
+        if(Codec::H264 != codecs[i] && Codec::H265 != codecs[i])
+            continue;
+
+        const std::string sinkName = Private::StreamProxyName(proxyName, i);
+        GstElementPtr sinkPtr(gst_bin_get_by_name(GST_BIN(element), sinkName.c_str()));
+        if(!sinkPtr)
+            continue;
+
+        GstPadPtr padPtr(gst_element_get_static_pad(sinkPtr.get(), "sink"));
+        gst_pad_add_probe(
+            padPtr.get(),
+            GST_PAD_PROBE_TYPE_BUFFER,
+            [] (GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+                const AccessUnitPoolProbeData* data =
+                    static_cast<const AccessUnitPoolProbeData*>(userData);
+
+                GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+                const bool pooled = data->pool->repack(&buffer);
+                GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+                if(data->metrics)
+                    ++(pooled ? data->metrics->pooledUnits : data->metrics->unpooledUnits);
+
+                return GST_PAD_PROBE_OK;
+            },
+            new AccessUnitPoolProbeData { pool, metrics },
+            [] (gpointer userData) {
+                delete static_cast<AccessUnitPoolProbeData*>(userData);
+            });
+    }
+}
+
+static void
+attach_metrics(
+    GstElement* element,
+    const std::string& proxyName,
+    const Codecs& codecs,
+    bool stampIngestTime,
+    const std::shared_ptr<PathMetrics>& metrics)
+{
+    for(unsigned i = 0; i < codecs.size(); ++i) {
+        const std::string sinkName = Private::StreamProxyName(proxyName, i);
+        GstElementPtr sinkPtr(gst_bin_get_by_name(GST_BIN(element), sinkName.c_str()));
+        if(!sinkPtr)
+            continue;
+
+        GstPadPtr padPtr(gst_element_get_static_pad(sinkPtr.get(), "sink"));
+        PathMetrics::AddCountingProbe(
+            padPtr.get(), metrics,
+            &PathMetrics::bytesIn, &PathMetrics::packetsIn);
+
+        if(metrics->tracing) {
+            const std::string depayName = fmt::format("depay{}", i);
+            GstElementPtr depayPtr(gst_bin_get_by_name(GST_BIN(element), depayName.c_str()));
+            if(depayPtr) {
+                GstPadPtr depaySinkPadPtr(gst_element_get_static_pad(depayPtr.get(), "sink"));
+                PathMetrics::AddTransitProbes(
+                    depaySinkPadPtr.get(), padPtr.get(),
+                    metrics, TraceStage::RECORD);
+            }
+        }
+
+        if(!stampIngestTime)
+            continue;
+
+        gst_pad_add_probe(
+            padPtr.get(),
+            GST_PAD_PROBE_TYPE_BUFFER,
+            [] (GstPad* /*pad*/, GstPadProbeInfo* info, gpointer /*userData*/) -> GstPadProbeReturn {
+                GstBuffer* buffer =
+                    gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+                GST_PAD_PROBE_INFO_DATA(info) = buffer;
+                Metrics::StampIngestTime(buffer);
+                return GST_PAD_PROBE_OK;
+            },
+            nullptr, nullptr);
+    }
+}
+
 static GstElement*
 create_element(
     GstRTSPMediaFactory* factory,
@@ -82,9 +359,81 @@ create_element(
 {
     RtspRecordMediaFactory* self = _RTSP_RECORD_MEDIA_FACTORY(factory);
 
-    return
+    std::vector<std::string> encodingNames = announced_encoding_names();
+    if(encodingNames.empty())
+        encodingNames.push_back("H264");
+
+    Codecs codecs;
+    GstElement* element =
         rtsp_record_media_create_element(
-            self->p->proxyName);
+            self->p->proxyName,
+            encodingNames,
+            self->p->rtpRelay,
+            &codecs,
+            self->p->elementPool.get(),
+            self->p->archiveDir,
+            self->p->archive,
+            self->p->latencyProfile.sync);
+
+    if(element && self->p->streams) {
+        const unsigned generation = self->p->streams->set(codecs);
+        g_object_set_qdata(
+            G_OBJECT(element), streams_generation_quark(), GUINT_TO_POINTER(generation));
+    }
+
+    // RTP relay passes packets, not access units
+    if(element && self->p->accessUnitPool && !self->p->rtpRelay) {
+        attach_access_unit_pool(
+            element, self->p->proxyName, codecs,
+            self->p->accessUnitPool, self->p->metrics);
+    }
+
+    // ingest time is stamped before GOP cache takes buffer reference,
+    // so stamping doesn't copy buffer
+    if(element && self->p->metrics) {
+        attach_metrics(
+            element, self->p->proxyName, codecs,
+            !self->p->rtpRelay, self->p->metrics);
+        PathMetrics::TrackElements(element, self->p->metrics);
+    }
+
+    if(element && self->p->gopCache && !self->p->rtpRelay)
+        attach_gop_cache(element, self->p->proxyName, codecs, self->p->gopCache);
+
+    return element;
+}
+
+static void
+configure(
+    GstRTSPMediaFactory* factory,
+    GstRTSPMedia* media)
+{
+    GST_RTSP_MEDIA_FACTORY_CLASS(rtsp_record_media_factory_parent_class)->
+        configure(factory, media);
+
+    RtspRecordMediaFactory* self = _RTSP_RECORD_MEDIA_FACTORY(factory);
+    if(!self->p->streams)
+        return;
+
+    GstElementPtr elementPtr(gst_rtsp_media_get_element(media));
+    const unsigned generation =
+        GPOINTER_TO_UINT(
+            g_object_get_qdata(G_OBJECT(elementPtr.get()), streams_generation_quark()));
+
+    // streams of next recorder are not known until it announces them
+    g_signal_connect_data(
+        media, "unprepared",
+        G_CALLBACK(
+            (void (*)(GstRTSPMedia*, gpointer))
+            [] (GstRTSPMedia*, gpointer userData) {
+                const StreamsResetData* data = static_cast<const StreamsResetData*>(userData);
+                data->streams->reset(data->generation);
+            }),
+        new StreamsResetData { self->p->streams, generation },
+        [] (gpointer userData, GClosure*) {
+            delete static_cast<StreamsResetData*>(userData);
+        },
+        GConnectFlags());
 }
 
 }
@@ -5,6 +5,9 @@
 #include <gst/rtsp-server/rtsp-server.h>
 
 #include "RtspRecordMedia.h"
+#include "GopCache.h"
+#include "Metrics.h"
+#include "AccessUnitPool.h"
 
 
 namespace RestreamServerLib
@@ -22,7 +25,16 @@ G_DECLARE_FINAL_TYPE(
 
 RtspRecordMediaFactory*
 rtsp_record_media_factory_new(
-    const std::string& proxyName);
+    const std::string& proxyName,
+    const std::shared_ptr<PathStreams>&,
+    const std::shared_ptr<GopCache>&,
+    const std::shared_ptr<PathMetrics>&,
+    bool rtpRelay = false,
+    const std::shared_ptr<ElementPool>& = nullptr,
+    const std::string& archiveDir = std::string(), // empty disables archiving
+    const ArchiveOptions& = ArchiveOptions(),
+    const LatencyProfile& = LatencyProfile(),
+    const std::shared_ptr<AccessUnitPool>& = nullptr); // video access units are repacked to it if set
 
 G_END_DECLS
 
@@ -1,20 +1,48 @@
 #include "Server.h"
 
-#include <set>
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <set>
+#include <vector>
 
+#include <sys/socket.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GstPtr.h>
 #include <CxxPtr/GstRtspServerPtr.h>
 
 #include "Log.h"
 #include "StaticSources.h"
 #include "Types.h"
 #include "RtspAuth.h"
+#include "AuthCache.h"
 #include "RtspMountPoints.h"
+#include "RtspPlayMedia.h"
+#include "RtpRelay.h"
+#include "SplashCache.h"
+#include "SourceWatchdog.h"
+#include "Registry.h"
+#include "Metrics.h"
+#include "HlsServer.h"
+#include "PlayerQueue.h"
+#include "H264Encoder.h"
 
 #if GST_CHECK_VERSION(1, 12, 0)
 #define ENABLE_LIMITS 1
 #endif
 
+#define SPLASH_INTERPIPE "splash"
+
+#define DRAIN_CHECK_PERIOD_MS 250
+
 
 namespace RestreamServerLib
 {
@@ -22,19 +50,220 @@ namespace RestreamServerLib
 namespace
 {
 
-struct ClientInfo
+// user callbacks are collected while registry mutex is locked
+// and called after it's released, so callbacks could be slow
+// or call back to Server
+typedef std::vector<std::function<void ()>> Notifications;
+
+void Notify(const Notifications& notifications)
 {
-    std::set<std::string> refPaths;
-};
+    for(const auto& notification: notifications)
+        notification();
+}
+
+void onStaticMediaConfigure(
+    GstRTSPMediaFactory* /*factory*/,
+    GstRTSPMedia* media,
+    gpointer userData)
+{
+    const SplashCache* cache = static_cast<const SplashCache*>(userData);
+
+    GstElementPtr elementPtr(gst_rtsp_media_get_element(media));
+    GstElementPtr appSrcPtr(gst_bin_get_by_name(GST_BIN(elementPtr.get()), "src"));
+    if(appSrcPtr)
+        cache->attach(appSrcPtr.get());
+}
+
+#if ENABLE_LIMITS
+// bits per second. splash screen is not counted
+guint64 PathBitrate(const Registry::PathInfo& info, const BandwidthOptions& options)
+{
+    if(!info.recordClient)
+        return 0;
+
+    const guint64 measured =
+        info.metrics ? info.metrics->bitrateIn.load(std::memory_order_relaxed) : 0;
+
+    return measured ? measured : guint64(options.defaultRecordKbps) * 1000;
+}
+
+guint64 ProjectedEgress(const Registry& registry, const BandwidthOptions& options)
+{
+    guint64 egress = 0;
+    registry.forEachPath(
+        [&egress, &options] (const Registry::PathInfo& info) {
+            // multicast group is fed once for all players
+            const unsigned players =
+                info.multicast ? std::min(info.playCount, 1u) : info.playCount;
+            egress += PathBitrate(info, options) * players;
+        });
+
+    return egress;
+}
+
+guint64 ProjectedIngress(const Registry& registry, const BandwidthOptions& options)
+{
+    guint64 ingress = 0;
+    registry.forEachPath(
+        [&ingress, &options] (const Registry::PathInfo& info) {
+            ingress += PathBitrate(info, options);
+        });
+
+    return ingress;
+}
+#endif
 
-struct PathInfo
+struct Listener
 {
-    std::set<const GstRTSPClient*> refClients;
-    unsigned playCount;
-    const GstRTSPClient* recordClient;
-    std::string recordSessionId;
+    GSocket* socket = nullptr;
+    guint source = 0;
 };
 
+gboolean OnAccept(GSocket* socket, GIOCondition /*condition*/, gpointer userData)
+{
+    GstRTSPServer* server = GST_RTSP_SERVER(userData);
+
+    GError* error = nullptr;
+    GSocket* clientSocket = g_socket_accept(socket, nullptr, &error);
+    GErrorPtr errorPtr(error);
+    if(!clientSocket) {
+        if(!g_error_matches(errorPtr.get(), G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            Log()->error("Fail to accept connection: {}", errorPtr->message);
+        return G_SOURCE_CONTINUE;
+    }
+
+    std::string ip;
+    guint16 port = 0;
+    if(GSocketAddress* address = g_socket_get_remote_address(clientSocket, nullptr)) {
+        if(G_IS_INET_SOCKET_ADDRESS(address)) {
+            GInetSocketAddress* inetAddress = G_INET_SOCKET_ADDRESS(address);
+            GCharPtr ipPtr(
+                g_inet_address_to_string(g_inet_socket_address_get_address(inetAddress)));
+            ip = ipPtr.get();
+            port = g_inet_socket_address_get_port(inetAddress);
+        }
+        g_object_unref(address);
+    }
+
+    // takes ownership of socket
+    if(!gst_rtsp_server_transfer_connection(server, clientSocket, ip.c_str(), port, nullptr))
+        Log()->error("Fail to handle connection from {}:{}", ip, port);
+
+    return G_SOURCE_CONTINUE;
+}
+
+// like gst_rtsp_server_create_socket, but with SO_REUSEPORT and given port.
+// port 0 means server's service
+GSocket* CreateSocket(GstRTSPServer* server, unsigned short port, bool reusePort, GError** error)
+{
+    GCharPtr addressPtr(gst_rtsp_server_get_address(server));
+    GCharPtr servicePtr(gst_rtsp_server_get_service(server));
+
+    GInetAddress* inetAddress = g_inet_address_new_from_string(addressPtr.get());
+    if(!inetAddress)
+        inetAddress = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+
+    GSocket* socket =
+        g_socket_new(
+            g_inet_address_get_family(inetAddress),
+            G_SOCKET_TYPE_STREAM,
+            G_SOCKET_PROTOCOL_TCP,
+            error);
+    if(socket && reusePort && !g_socket_set_option(socket, SOL_SOCKET, SO_REUSEPORT, 1, error)) {
+        g_object_unref(socket);
+        socket = nullptr;
+    }
+
+    if(socket) {
+        GSocketAddress* socketAddress =
+            g_inet_socket_address_new(
+                inetAddress,
+                port ? port : static_cast<guint16>(atoi(servicePtr.get())));
+        const bool bound = g_socket_bind(socket, socketAddress, TRUE, error);
+        g_object_unref(socketAddress);
+
+        g_socket_set_listen_backlog(socket, gst_rtsp_server_get_backlog(server));
+        if(!bound || !g_socket_listen(socket, error)) {
+            g_object_unref(socket);
+            socket = nullptr;
+        }
+    }
+
+    g_object_unref(inetAddress);
+
+    return socket;
+}
+
+// instead of gst_rtsp_server_attach, to be able to use inherited socket
+// and to give listening socket away.
+// fd is used if it's not -1, port 0 means server's service
+bool Listen(
+    GstRTSPServer* server,
+    int fd,
+    unsigned short port,
+    bool reusePort,
+    Listener* listener)
+{
+    GError* error = nullptr;
+    GSocket* socket;
+    if(fd >= 0)
+        socket = g_socket_new_from_fd(fd, &error);
+    else if(port || reusePort)
+        socket = CreateSocket(server, port, reusePort, &error);
+    else
+        socket = gst_rtsp_server_create_socket(server, nullptr, &error);
+    GErrorPtr errorPtr(error);
+    if(!socket) {
+        Log()->critical(
+            "Fail to listen: {}",
+            errorPtr ? errorPtr->message : "unknown error");
+        return false;
+    }
+
+    g_socket_set_blocking(socket, FALSE);
+
+    GSource* source = g_socket_create_source(socket, G_IO_IN, nullptr);
+    g_source_set_callback(
+        source,
+        reinterpret_cast<GSourceFunc>(OnAccept),
+        g_object_ref(server),
+        g_object_unref);
+    listener->source = g_source_attach(source, nullptr);
+    g_source_unref(source);
+
+    listener->socket = socket;
+
+    return true;
+}
+
+void StopListening(Listener* listener)
+{
+    if(listener->source) {
+        g_source_remove(listener->source);
+        listener->source = 0;
+    }
+    if(listener->socket) {
+        g_socket_close(listener->socket, nullptr);
+        g_object_unref(listener->socket);
+        listener->socket = nullptr;
+    }
+}
+
+int ListeningPort(GSocket* socket)
+{
+    GSocketAddress* address = g_socket_get_local_address(socket, nullptr);
+    if(!address)
+        return -1;
+
+    const int port =
+        G_IS_INET_SOCKET_ADDRESS(address) ?
+            g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(address)) :
+            -1;
+    g_object_unref(address);
+
+    return port;
+}
+
 }
 
 struct Server::Private
@@ -44,29 +273,75 @@ struct Server::Private
         unsigned short staticPort,
         unsigned short restreamPort,
         unsigned maxPathsCount,
-        unsigned maxClientsPerPath);
+        unsigned maxClientsPerPath,
+        const SplashOptions&);
 
     Callbacks callbacks;
 
     const unsigned short staticPort;
     const unsigned short restreamPort;
-    const unsigned maxPathsCount;
-    const unsigned maxClientsPerPath;
+    std::atomic<unsigned> maxPathsCount;
+    std::atomic<unsigned> maxClientsPerPath;
+    const SplashOptions splash;
+
+    // guarded by registry mutex
+    BandwidthOptions bandwidth;
+    TransportOptions transport;
+    guint bitrateTimer = 0;
+    guint trimTimer = 0;
+
+    // static path -> cache
+    std::map<std::string, SplashCache> splashCaches;
 
     GstRTSPServerPtr staticServer;
 
+    GstElementPtr splashPipeline;
+
     GstRTSPServerPtr restreamServer;
     GstRTSPAuthPtr auth;
+    std::shared_ptr<AuthCache> authCache;
     GstRTSPTokenPtr anonymousToken;
     GstRTSPMountPointsPtr mountPoints;
+    std::shared_ptr<SourceWatchdog> sourceWatchdog;
+    std::shared_ptr<HlsServer> hlsServer;
+
+    // clients are handled in thread pool threads,
+    // so registry is guarded by it's mutex.
+    // shared with mount points
+    const std::shared_ptr<Registry> registry;
+
+    const std::shared_ptr<Metrics> metrics;
 
-    std::map<const GstRTSPClient*, ClientInfo> clients;
-    std::map<std::string, PathInfo> paths;
+    ListenOptions listen;
+    Listener staticListener;
+    Listener restreamListener;
+    Listener directListener;
+
+    GMainLoop* loop = nullptr;
+
+    bool draining = false;
+    DrainOptions drainOptions;
+    gint64 drainStartTime = 0;
+    bool playersDisconnected = false;
+    guint drainTimer = 0;
+
+    static gboolean onBitrateTimer(gpointer userData);
+    static gboolean onDrainTimer(gpointer userData);
+    static gboolean onTrimTimer(gpointer userData);
+
+    // restream server clients having record session
+    std::set<const GstRTSPClient*> recordClients() const;
+    void redirectPlayers();
+    void disconnectClients(bool recorders);
+    void disconnectPlayers(const std::string& path);
+
+    // should be called without registry mutex locked
+    void refreshPath(const std::string& path);
 
     inline const gchar* user(const GstRTSPContext*) const;
 
-    bool isRecording(const GstRTSPClient* client, const std::string& path);
-    PathInfo& registerPath(const GstRTSPClient*, const std::string& path);
+    bool isRecording(const gchar* path) const;
+    Registry::PathInfo& registerPath(const GstRTSPClient*, const gchar* path);
 
     void onClientConnected(GstRTSPClient*);
 
@@ -76,16 +351,18 @@ struct Server::Private
 #endif
 
     void onPlay(const GstRTSPClient*, const GstRTSPContext*, const gchar* sessionId);
+    void attachPlayerQueue(GstRTSPClient*, const GstRTSPContext*);
     void onRecord(const GstRTSPClient*, const GstRTSPContext*, const gchar* sessionId);
     void onTeardown(const GstRTSPClient*, const GstRTSPUrl*, const gchar* sessionId);
 
     void onClientClosed(const GstRTSPClient*);
 
-    void firstPlayerConnected(const GstRTSPContext* ctx, const std::string& path);
-    void lastPlayerDisconnected(const std::string& path);
+    // should be called with registry mutex locked
+    void firstPlayerConnected(const GstRTSPContext* ctx, const std::string& path, Notifications*);
+    void lastPlayerDisconnected(const std::string& path, Notifications*);
 
-    void recorderConnected(const GstRTSPContext* ctx, const std::string& path);
-    void recorderDisconnected(const std::string& path);
+    void recorderConnected(const GstRTSPContext* ctx, const std::string& path, Notifications*);
+    void recorderDisconnected(const std::string& path, Notifications*);
 };
 
 
@@ -99,13 +376,199 @@ Server::Private::Private(
     unsigned short staticPort,
     unsigned short restreamPort,
     unsigned maxPathsCount,
-    unsigned maxClientsPerPath) :
+    unsigned maxClientsPerPath,
+    const SplashOptions& splash) :
     callbacks(callbacks),
     staticPort(staticPort),
     restreamPort(restreamPort),
     maxPathsCount(maxPathsCount),
-    maxClientsPerPath(maxClientsPerPath)
+    maxClientsPerPath(maxClientsPerPath),
+    splash(splash),
+    registry(std::make_shared<Registry>()),
+    metrics(std::make_shared<Metrics>())
+{
+}
+
+gboolean Server::Private::onBitrateTimer(gpointer userData)
+{
+    Private* p = static_cast<Private*>(userData);
+    p->metrics->updateBitrates();
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean Server::Private::onTrimTimer(gpointer /*userData*/)
+{
+#ifdef __GLIBC__
+    // pipelines of churning paths leave free chunks all over arenas
+    malloc_trim(0);
+#endif
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean Server::Private::onDrainTimer(gpointer userData)
+{
+    Private* p = static_cast<Private*>(userData);
+
+    const gint64 elapsedMs = (g_get_monotonic_time() - p->drainStartTime) / 1000;
+
+    if(!p->playersDisconnected) {
+        if(elapsedMs < static_cast<gint64>(p->drainOptions.playersGraceMs))
+            return G_SOURCE_CONTINUE;
+
+        Log()->info("Drain. Disconnecting players");
+        p->disconnectClients(false);
+        p->playersDisconnected = true;
+    }
+
+    const size_t recorders = p->recordClients().size();
+    if(recorders && elapsedMs < static_cast<gint64>(p->drainOptions.timeoutMs))
+        return G_SOURCE_CONTINUE;
+
+    if(recorders)
+        Log()->info("Drain timeout. Disconnecting {} recorders", recorders);
+    p->disconnectClients(true);
+
+    Log()->info("Drain finished");
+
+    p->drainTimer = 0;
+    if(p->loop)
+        g_main_loop_quit(p->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+std::set<const GstRTSPClient*> Server::Private::recordClients() const
 {
+    std::set<const GstRTSPClient*> clients;
+
+    std::lock_guard<std::mutex> lock(registry->mutex());
+    registry->forEachPath(
+        [&clients] (const Registry::PathInfo& info) {
+            if(info.recordClient)
+                clients.insert(static_cast<const GstRTSPClient*>(info.recordClient));
+        });
+
+    return clients;
+}
+
+void Server::Private::redirectPlayers()
+{
+    if(drainOptions.redirectUrl.empty())
+        return;
+
+    std::vector<std::pair<GstRTSPClient*, std::string>> players;
+    GList* clients =
+        gst_rtsp_server_client_filter(
+            restreamServer.get(),
+            [] (GstRTSPServer*, GstRTSPClient*, gpointer) {
+                return GST_RTSP_FILTER_REF;
+            },
+            nullptr);
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex());
+
+        for(GList* item = clients; item; item = g_list_next(item)) {
+            GstRTSPClient* client = GST_RTSP_CLIENT(item->data);
+            const std::vector<PathId>* paths = registry->sessionPaths(client);
+            if(!paths)
+                continue;
+
+            for(PathId pathId: *paths) {
+                const Registry::PathInfo& pathInfo = registry->path(pathId);
+                if(pathInfo.recordClient != client)
+                    players.emplace_back(client, pathInfo.name);
+            }
+        }
+    }
+
+    for(const auto& player: players) {
+        const std::string url = drainOptions.redirectUrl + player.second;
+
+        GstRTSPMessage* message = nullptr;
+        if(GST_RTSP_OK != gst_rtsp_message_new_request(&message, GST_RTSP_REDIRECT, url.c_str()))
+            continue;
+        gst_rtsp_message_add_header(message, GST_RTSP_HDR_LOCATION, url.c_str());
+
+        Log()->debug(
+            "Drain. Redirecting player. client: {}, url: {}",
+            static_cast<const void*>(player.first), url);
+        gst_rtsp_client_send_message(player.first, nullptr, message);
+
+        gst_rtsp_message_free(message);
+    }
+
+    g_list_free_full(clients, g_object_unref);
+}
+
+void Server::Private::disconnectClients(bool recorders)
+{
+    const std::set<const GstRTSPClient*> recordClients =
+        recorders ? std::set<const GstRTSPClient*>() : this->recordClients();
+
+    for(GstRTSPServer* server: { staticServer.get(), restreamServer.get() }) {
+        GList* clients =
+            gst_rtsp_server_client_filter(
+                server,
+                [] (GstRTSPServer*, GstRTSPClient*, gpointer) {
+                    return GST_RTSP_FILTER_REF;
+                },
+                nullptr);
+
+        for(GList* item = clients; item; item = g_list_next(item)) {
+            GstRTSPClient* client = GST_RTSP_CLIENT(item->data);
+            if(!recordClients.count(client))
+                gst_rtsp_client_close(client);
+        }
+
+        g_list_free_full(clients, g_object_unref);
+    }
+}
+
+void Server::Private::disconnectPlayers(const std::string& path)
+{
+    std::vector<GstRTSPClient*> players;
+    GList* clients =
+        gst_rtsp_server_client_filter(
+            restreamServer.get(),
+            [] (GstRTSPServer*, GstRTSPClient*, gpointer) {
+                return GST_RTSP_FILTER_REF;
+            },
+            nullptr);
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex());
+
+        const PathId pathId = registry->findPath(path.c_str());
+        for(GList* item = clients; item && pathId != NO_PATH; item = g_list_next(item)) {
+            GstRTSPClient* client = GST_RTSP_CLIENT(item->data);
+            const std::vector<PathId>* paths = registry->sessionPaths(client);
+            if(!paths || std::find(paths->begin(), paths->end(), pathId) == paths->end())
+                continue;
+
+            if(registry->path(pathId).recordClient != client)
+                players.push_back(client);
+        }
+    }
+
+    for(GstRTSPClient* client: players) {
+        Log()->debug(
+            "Disconnecting player of stale source. client: {}, path: {}",
+            static_cast<const void*>(client), path);
+        gst_rtsp_client_close(client);
+    }
+
+    g_list_free_full(clients, g_object_unref);
+}
+
+void Server::Private::refreshPath(const std::string& path)
+{
+    if(!mountPoints)
+        return;
+
+    // players reconnect to replaced play factory
+    if(rtsp_mount_points_refresh_path(_RTSP_MOUNT_POINTS(mountPoints.get()), path))
+        disconnectPlayers(path);
 }
 
 const gchar* Server::Private::user(const GstRTSPContext* ctx) const
@@ -118,86 +581,90 @@ const gchar* Server::Private::user(const GstRTSPContext* ctx) const
 
 void Server::Private::firstPlayerConnected(
     const GstRTSPContext* ctx,
-    const std::string& path)
+    const std::string& path,
+    Notifications* notifications)
 {
     Log()->debug(
         "First player connected. Path: {}",
         path);
 
-    if(callbacks.firstPlayerConnected)
-        callbacks.firstPlayerConnected(user(ctx), path);
+    if(callbacks.firstPlayerConnected) {
+        const std::string user = this->user(ctx);
+        notifications->emplace_back(
+            [this, user, path] () { callbacks.firstPlayerConnected(user, path); });
+    }
 }
 
 void Server::Private::lastPlayerDisconnected(
-    const std::string& path)
+    const std::string& path,
+    Notifications* notifications)
 {
     Log()->debug(
         "Last player disconnected. Path: {}",
         path);
 
-    if(callbacks.lastPlayerDisconnected)
-        callbacks.lastPlayerDisconnected(path);
+    if(callbacks.lastPlayerDisconnected) {
+        notifications->emplace_back(
+            [this, path] () { callbacks.lastPlayerDisconnected(path); });
+    }
 }
 
 void Server::Private::recorderConnected(
     const GstRTSPContext* ctx,
-    const std::string& path)
+    const std::string& path,
+    Notifications* notifications)
 {
     Log()->debug(
         "Recorder connected. Path: {}",
         path);
 
-    if(callbacks.recorderConnected)
-        callbacks.recorderConnected(user(ctx), path);
+    ++metrics->recorders;
+
+    if(callbacks.recorderConnected) {
+        const std::string user = this->user(ctx);
+        notifications->emplace_back(
+            [this, user, path] () { callbacks.recorderConnected(user, path); });
+    }
+
+    // after ownership is published by user callback
+    notifications->emplace_back([this, path] () { refreshPath(path); });
 }
 
 void Server::Private::recorderDisconnected(
-    const std::string& path)
+    const std::string& path,
+    Notifications* notifications)
 {
     Log()->debug(
         "Recorder disconnected. Path: {}",
         path);
 
-    if(callbacks.recorderDisconnected)
-        callbacks.recorderDisconnected(path);
+    --metrics->recorders;
+
+    if(callbacks.recorderDisconnected) {
+        notifications->emplace_back(
+            [this, path] () { callbacks.recorderDisconnected(path); });
+    }
+
+    notifications->emplace_back([this, path] () { refreshPath(path); });
 }
 
-bool Server::Private::isRecording(const GstRTSPClient* client, const std::string& path)
+bool Server::Private::isRecording(const gchar* path) const
 {
-    auto pathIt = paths.find(path);
-    if(paths.end() == pathIt)
+    const PathId pathId = registry->findPath(path);
+    if(NO_PATH == pathId)
         return false;
     else {
-        const PathInfo& pathInfo = pathIt->second;
+        const Registry::PathInfo& pathInfo = registry->path(pathId);
         return pathInfo.recordClient || !pathInfo.recordSessionId.empty();
     }
 }
 
-PathInfo& Server::Private::registerPath(const GstRTSPClient* client, const std::string& path)
+Registry::PathInfo& Server::Private::registerPath(const GstRTSPClient* client, const gchar* path)
 {
-    const auto clientIt = clients.find(client);
-    if(clients.end() == clientIt) {
-        clients.emplace(client, ClientInfo{.refPaths = {path}});
-    } else {
-        auto& refPaths = clientIt->second.refPaths;
-        refPaths.emplace(path);
-    }
-
-    auto pathIt = paths.find(path);
-    if(paths.end() == pathIt) {
-        pathIt =
-            paths.emplace(
-                path,
-                PathInfo {
-                .refClients = {client},
-                .playCount = 0,
-                .recordClient = nullptr}).first;
-    } else {
-        auto& refClients = pathIt->second.refClients;
-        refClients.emplace(client);
-    }
+    const PathId pathId = registry->internPath(path);
+    registry->addSessionRef(client, pathId);
 
-    return pathIt->second;
+    return registry->path(pathId);
 }
 
 void Server::Private::onClientConnected(GstRTSPClient* client)
@@ -221,6 +688,25 @@ void Server::Private::onClientConnected(GstRTSPClient* client)
     g_signal_connect(client, "pre-play-request", GCallback(prePlayCallback), this);
 #endif
 
+    // transports are already active in play-request,
+    // so they could be replaced by queues.
+    // connected before playCallback to queue GOP cache sent on session start
+    auto attachQueueCallback =
+        (void (*)(GstRTSPClient*, GstRTSPContext*, gpointer))
+        [] (GstRTSPClient* client, GstRTSPContext* context, gpointer userData) {
+            Private* p =
+                static_cast<Private*>(userData);
+            p->attachPlayerQueue(client, context);
+        };
+    g_signal_connect(client, "play-request", GCallback(attachQueueCallback), this);
+
+    auto pauseCallback = (void (*)(GstRTSPClient*, GstRTSPContext*, gpointer))
+        [] (GstRTSPClient*, GstRTSPContext* context, gpointer) {
+            if(context->sessmedia)
+                PlayerQueue::Detach(context->sessmedia);
+        };
+    g_signal_connect(client, "pause-request", GCallback(pauseCallback), nullptr);
+
     auto playCallback = (void (*)(GstRTSPClient*, GstRTSPContext*, gpointer))
         [] (GstRTSPClient* client, GstRTSPContext* context, gpointer userData) {
             Private* p =
@@ -284,11 +770,13 @@ GstRTSPStatusCode Server::Private::beforePlay(
         " client: {}, path: {}, sessionId: {}",
         static_cast<const void*>(client), url->abspath, sessionId);
 
-    const std::string path = url->abspath;
+    std::lock_guard<std::mutex> lock(registry->mutex());
 
-    auto pathIt = paths.find(path);
-    if(maxClientsPerPath > 0 && paths.end() != pathIt) {
-        if(pathIt->second.playCount >= (maxClientsPerPath - 1)) {
+    const PathId pathId = registry->findPath(url->abspath);
+    // multicast players don't cost own transport
+    const unsigned maxClientsPerPath = this->maxClientsPerPath.load();
+    if(maxClientsPerPath > 0 && pathId != NO_PATH && !registry->path(pathId).multicast) {
+        if(registry->path(pathId).playCount >= (maxClientsPerPath - 1)) {
             Log()->error(
                 "Max players count limit reached. "
                 "client: {}, path: {}, sessionId: {}",
@@ -297,6 +785,22 @@ GstRTSPStatusCode Server::Private::beforePlay(
         }
     }
 
+    if(bandwidth.egressBudgetKbps > 0 && pathId != NO_PATH) {
+        const Registry::PathInfo& pathInfo = registry->path(pathId);
+        const guint64 pathBitrate = PathBitrate(pathInfo, bandwidth);
+        const bool joinsMulticast = pathInfo.multicast && pathInfo.playCount > 0;
+        const guint64 egress = ProjectedEgress(*registry, bandwidth);
+        const guint64 budget = guint64(bandwidth.egressBudgetKbps) * 1000;
+        if(!joinsMulticast && pathBitrate > 0 && egress + pathBitrate > budget) {
+            Log()->warn(
+                "Egress bandwidth budget exceeded. "
+                "client: {}, path: {}, sessionId: {}, egress: {}kbps, path: {}kbps",
+                static_cast<const void*>(client), url->abspath, sessionId,
+                egress / 1000, pathBitrate / 1000);
+            return GST_RTSP_STS_NOT_ENOUGH_BANDWIDTH;
+        }
+    }
+
     return GST_RTSP_STS_OK;
 }
 #endif
@@ -311,12 +815,34 @@ void Server::Private::onPlay(
         " client: {}, path: {}, sessionId: {}",
         static_cast<const void*>(client), ctx->uri->abspath, sessionId);
 
-    const std::string path = ctx->uri->abspath;
+    Notifications notifications;
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex());
+
+        Registry::PathInfo& pathInfo = registerPath(client, ctx->uri->abspath);
+        ++pathInfo.playCount;
+        ++metrics->players;
+        if(1 == pathInfo.playCount)
+            firstPlayerConnected(ctx, pathInfo.name, &notifications);
+    }
+
+    // media could be shared with sessions already playing it
+    if(ctx->media && _IS_RTSP_PLAY_MEDIA(ctx->media))
+        rtsp_play_media_session_started(_RTSP_PLAY_MEDIA(ctx->media));
+
+    Notify(notifications);
+}
+
+void Server::Private::attachPlayerQueue(GstRTSPClient* client, const GstRTSPContext* ctx)
+{
+    TransportOptions transport;
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex());
+        transport = this->transport;
+    }
 
-    PathInfo& pathInfo = registerPath(client, path);
-    ++pathInfo.playCount;
-    if(1 == pathInfo.playCount)
-        firstPlayerConnected(ctx, path);
+    if(transport.tcpQueueBytes > 0 && ctx->sessmedia)
+        PlayerQueue::Attach(client, ctx->sessmedia, transport);
 }
 
 #if ENABLE_LIMITS
@@ -330,13 +856,45 @@ GstRTSPStatusCode Server::Private::beforeRecord(
         " client: {}, path: {}, sessionId: {}",
         static_cast<const void*>(client), url->abspath, sessionId);
 
-    if(isRecording(client, url->abspath)) {
+    std::lock_guard<std::mutex> lock(registry->mutex());
+
+    if(isRecording(url->abspath)) {
         Log()->info(
             "Second record on the same path. client: {}, path: {}",
             static_cast<const void*>(client), url->abspath);
         return GST_RTSP_STS_SERVICE_UNAVAILABLE;
-    } else
-       return GST_RTSP_STS_OK;
+    }
+
+    // real bitrate is not known until recorder sends data
+    const guint64 recordBitrate = guint64(bandwidth.defaultRecordKbps) * 1000;
+
+    if(bandwidth.ingressBudgetKbps > 0) {
+        const guint64 ingress = ProjectedIngress(*registry, bandwidth);
+        if(ingress + recordBitrate > guint64(bandwidth.ingressBudgetKbps) * 1000) {
+            Log()->warn(
+                "Ingress bandwidth budget exceeded. client: {}, path: {}, ingress: {}kbps",
+                static_cast<const void*>(client), url->abspath, ingress / 1000);
+            return GST_RTSP_STS_NOT_ENOUGH_BANDWIDTH;
+        }
+    }
+
+    const PathId pathId = registry->findPath(url->abspath);
+    if(bandwidth.egressBudgetKbps > 0 && pathId != NO_PATH) {
+        // players waiting on splash screen will switch to recorded stream
+        const Registry::PathInfo& pathInfo = registry->path(pathId);
+        const unsigned players =
+            pathInfo.multicast ? std::min(pathInfo.playCount, 1u) : pathInfo.playCount;
+        const guint64 egress = ProjectedEgress(*registry, bandwidth);
+        if(egress + recordBitrate * players > guint64(bandwidth.egressBudgetKbps) * 1000) {
+            Log()->warn(
+                "Egress bandwidth budget exceeded by recorder. "
+                "client: {}, path: {}, egress: {}kbps, players: {}",
+                static_cast<const void*>(client), url->abspath, egress / 1000, players);
+            return GST_RTSP_STS_NOT_ENOUGH_BANDWIDTH;
+        }
+    }
+
+    return GST_RTSP_STS_OK;
 }
 #endif
 
@@ -350,19 +908,24 @@ void Server::Private::onRecord(
         "client: {}, path: {}, sessionId: {}",
         static_cast<const void*>(client), ctx->uri->abspath, sessionId);
 
-    const std::string path = ctx->uri->abspath;
+    Notifications notifications;
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex());
 
-    PathInfo& pathInfo = registerPath(client, path);
-    if(pathInfo.recordClient || !pathInfo.recordSessionId.empty()) {
-        Log()->critical(
-            "Second record on the same path. client: {}, path: {}",
-            static_cast<const void*>(client), ctx->uri->abspath);
-    } else {
-        pathInfo.recordClient = client;
-        pathInfo.recordSessionId = sessionId;
+        Registry::PathInfo& pathInfo = registerPath(client, ctx->uri->abspath);
+        if(pathInfo.recordClient || !pathInfo.recordSessionId.empty()) {
+            Log()->critical(
+                "Second record on the same path. client: {}, path: {}",
+                static_cast<const void*>(client), ctx->uri->abspath);
+        } else {
+            pathInfo.recordClient = client;
+            pathInfo.recordSessionId = sessionId;
 
-        recorderConnected(ctx, path);
+            recorderConnected(ctx, pathInfo.name, &notifications);
+        }
     }
+
+    Notify(notifications);
 }
 
 void Server::Private::onTeardown(
@@ -375,42 +938,43 @@ void Server::Private::onTeardown(
         "client: {}, path: {}, sessionId: {}",
         static_cast<const void*>(client), url->abspath, sessionId);
 
-    const std::string path = url->abspath;
-
-    auto pathIt = paths.find(path);
-    if(paths.end() == pathIt) {
-        Log()->critical(
-            "Not registered path teardown. client: {}, path: {}",
-            static_cast<const void*>(client), url->abspath);
-        return;
-    }
-
-    PathInfo& pathInfo = pathIt->second;
-    if(client == pathInfo.recordClient &&
-       sessionId == pathInfo.recordSessionId)
+    Notifications notifications;
     {
-        pathInfo.recordClient = nullptr;
-        pathInfo.recordSessionId.clear();
-
-        recorderDisconnected(path);
-    } else {
-        if(pathInfo.playCount > 0) {
-            --pathInfo.playCount;
-            if(0 == pathInfo.playCount)
-                lastPlayerDisconnected(path);
-        } else {
+        std::lock_guard<std::mutex> lock(registry->mutex());
+
+        const PathId pathId = registry->findPath(url->abspath);
+        if(NO_PATH == pathId) {
             Log()->critical(
-                "Not registered reader teardown. client: {}, path: {}",
+                "Not registered path teardown. client: {}, path: {}",
                 static_cast<const void*>(client), url->abspath);
+            return;
         }
-    }
-    pathInfo.refClients.erase(client);
 
-    const auto clientIt = clients.find(client);
-    if(clients.end() != clientIt) {
-        auto& refPaths = clientIt->second.refPaths;
-        refPaths.erase(path);
+        Registry::PathInfo& pathInfo = registry->path(pathId);
+        if(client == pathInfo.recordClient &&
+           sessionId == pathInfo.recordSessionId)
+        {
+            pathInfo.recordClient = nullptr;
+            pathInfo.recordSessionId.clear();
+
+            recorderDisconnected(pathInfo.name, &notifications);
+        } else {
+            if(pathInfo.playCount > 0) {
+                --pathInfo.playCount;
+                --metrics->players;
+                if(0 == pathInfo.playCount)
+                    lastPlayerDisconnected(pathInfo.name, &notifications);
+            } else {
+                Log()->critical(
+                    "Not registered reader teardown. client: {}, path: {}",
+                    static_cast<const void*>(client), url->abspath);
+            }
+        }
+
+        registry->removeSessionRef(client, pathId);
     }
+
+    Notify(notifications);
 }
 
 void Server::Private::onClientClosed(const GstRTSPClient* client)
@@ -420,63 +984,50 @@ void Server::Private::onClientClosed(const GstRTSPClient* client)
         "client: {}",
         static_cast<const void*>(client));
 
-    const auto clientIt = clients.find(client);
-    if(clients.end() != clientIt) {
-        auto& refPaths = clientIt->second.refPaths;
-        for(const std::string& path: refPaths) {
-            auto pathIt = paths.find(path);
-            if(paths.end() != pathIt) {
-                PathInfo& pathInfo = pathIt->second;
-
-                auto& refClients = pathIt->second.refClients;
-                refClients.erase(client);
-
-                if(refClients.empty()) {
-                    if(pathInfo.recordClient == client) {
-                        assert(pathInfo.playCount == 0);
-
-                        pathInfo.recordClient = nullptr;
-                        pathInfo.recordSessionId.clear();
-
-                        recorderDisconnected(path);
-                    } else {
-                        assert(nullptr == pathInfo.recordClient && 1 == pathInfo.playCount);
-
-                        --pathInfo.playCount;
-
-                        lastPlayerDisconnected(path);
-                    }
-
-                    paths.erase(pathIt);
-                } else {
-                    if(client == pathInfo.recordClient) {
-                        pathInfo.recordClient = nullptr;
-                        pathInfo.recordSessionId.clear();
-
-                        recorderDisconnected(path);
-                    } else {
-                        assert(pathInfo.playCount > 0);
-                        --pathInfo.playCount;
-
-                        if(0 == pathInfo.playCount) {
-                            assert(refClients.empty() || ++refClients.begin() == refClients.end());
-                            lastPlayerDisconnected(path);
-                        }
-                    }
-                }
+    Notifications notifications;
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex());
+
+        const std::vector<PathId>* sessionPaths = registry->sessionPaths(client);
+        if(!sessionPaths)
+            return;
+
+        for(PathId pathId: *sessionPaths) {
+            Registry::PathInfo& pathInfo = registry->path(pathId);
 
-                Log()->debug(
-                    "Referencing clients count: {}, has recorder: {}, players count: {}",
-                    refClients.size(), !!pathInfo.recordClient, pathInfo.playCount);
+            // references are dropped all at once below
+            const unsigned refClients = pathInfo.sessionRefs - 1;
 
-                if(refClients.size() != pathInfo.playCount + (pathInfo.recordClient ? 1 : 0))
-                    Log()->critical("Inconsitency in clients counting");
+            if(client == pathInfo.recordClient) {
+                assert(refClients > 0 || pathInfo.playCount == 0);
+
+                pathInfo.recordClient = nullptr;
+                pathInfo.recordSessionId.clear();
+
+                recorderDisconnected(pathInfo.name, &notifications);
             } else {
-                Log()->critical("Inconsitency between clients and paths");
+                assert(pathInfo.playCount > 0);
+                --pathInfo.playCount;
+                --metrics->players;
+
+                if(0 == pathInfo.playCount) {
+                    assert(refClients <= 1);
+                    lastPlayerDisconnected(pathInfo.name, &notifications);
+                }
             }
+
+            Log()->debug(
+                "Referencing clients count: {}, has recorder: {}, players count: {}",
+                refClients, !!pathInfo.recordClient, pathInfo.playCount);
+
+            if(refClients != pathInfo.playCount + (pathInfo.recordClient ? 1 : 0))
+                Log()->critical("Inconsitency in clients counting");
         }
-        clients.erase(clientIt);
+
+        registry->releaseSessionPaths(client);
     }
+
+    Notify(notifications);
 }
 
 
@@ -486,19 +1037,65 @@ Server::Server(
     unsigned short restreamPort,
     bool useTls,
     unsigned maxPathsCount,
-    unsigned maxClientsPerPath) :
+    unsigned maxClientsPerPath,
+    const Options& options) :
     _p(
         new Private(
             callbacks,
             staticPort, restreamPort,
-            maxPathsCount, maxClientsPerPath))
+            maxPathsCount, maxClientsPerPath,
+            options.splash))
 {
+    ConfigureLogging(options.log);
+
+    _p->listen = options.listen;
+
+    if(options.tracing.enabled)
+        _p->metrics->enableTracing(options.tracing.maxEvents);
+
+    _p->bandwidth = options.bandwidth;
+    _p->bitrateTimer = g_timeout_add_seconds(1, Private::onBitrateTimer, _p.get());
+    if(options.memory.trimIntervalSec) {
+        _p->trimTimer =
+            g_timeout_add_seconds(options.memory.trimIntervalSec, Private::onTrimTimer, nullptr);
+    }
+
+    SelectH264Encoder(options.splash.encoder);
+
     initStaticServer();
-    initRestreamServer(useTls);
+    if(SplashMode::INTERPIPE == options.splash.mode)
+        initSplashSource();
+    initRestreamServer(
+        useTls,
+        options.threadPool,
+        options.source,
+        options.gopCache,
+        options.authCache,
+        options.multicast,
+        options.transport,
+        options.cluster,
+        options.mediaPool,
+        options.archive,
+        options.hls,
+        options.memory);
 }
 
 Server::~Server()
 {
+    if(_p->bitrateTimer)
+        g_source_remove(_p->bitrateTimer);
+    if(_p->trimTimer)
+        g_source_remove(_p->trimTimer);
+    if(_p->drainTimer)
+        g_source_remove(_p->drainTimer);
+
+    StopListening(&_p->staticListener);
+    StopListening(&_p->restreamListener);
+    StopListening(&_p->directListener);
+
+    if(_p->splashPipeline)
+        gst_element_set_state(_p->splashPipeline.get(), GST_STATE_NULL);
+
     _p.reset();
 }
 
@@ -516,89 +1113,166 @@ void Server::initStaticServer()
 
     gst_rtsp_server_set_mount_points(server, mountPoints);
 
-    {
-        GstRTSPMediaFactory* barsFactory = gst_rtsp_media_factory_new();
-        gst_rtsp_media_factory_set_transport_mode(
-            barsFactory, GST_RTSP_TRANSPORT_MODE_PLAY);
-        gst_rtsp_media_factory_set_launch(barsFactory,
-            "( videotestsrc pattern=smpte100 ! "
-            "x264enc ! video/x-h264, profile=baseline ! "
-            "rtph264pay name=pay0 pt=96 config-interval=-1 )");
-        gst_rtsp_media_factory_set_shared(barsFactory, TRUE);
-        gst_rtsp_mount_points_add_factory(mountPoints, BARS, barsFactory);
-    }
+    const std::pair<const char*, const char*> sources[] = {
+        { BARS, "smpte100" },
+        { WHITE, "white" },
+        { BLACK, "black" },
+        { RED, "red" },
+        { GREEN, "green" },
+        { BLUE, "blue" },
+    };
 
-    {
-        GstRTSPMediaFactory* whiteScreenFactory = gst_rtsp_media_factory_new();
-        gst_rtsp_media_factory_set_transport_mode(
-            whiteScreenFactory, GST_RTSP_TRANSPORT_MODE_PLAY);
-        gst_rtsp_media_factory_set_launch(whiteScreenFactory,
-            "( videotestsrc pattern=white ! "
-            "x264enc ! video/x-h264, profile=baseline ! "
-            "rtph264pay name=pay0 pt=96 config-interval=-1 )");
-        gst_rtsp_media_factory_set_shared(whiteScreenFactory, TRUE);
-        gst_rtsp_mount_points_add_factory(mountPoints, WHITE, whiteScreenFactory);
-    }
+    for(const auto& source: sources) {
+        const char* path = source.first;
+        const char* pattern = source.second;
+
+        SplashCache* cache = nullptr;
+        if(_p->splash.cached) {
+            cache = &_p->splashCaches[path];
+
+            const bool filled =
+                (0 == g_strcmp0(path, BLUE) && !_p->splash.file.empty()) ?
+                    cache->load(_p->splash.file) :
+                    cache->encode(pattern);
+            if(!filled) {
+                Log()->error(
+                    "Fail to fill splash cache. Falling back to live encoding. path: {}",
+                    path);
+                _p->splashCaches.erase(path);
+                cache = nullptr;
+            }
+        }
 
-    {
-        GstRTSPMediaFactory* blackScreenFactory = gst_rtsp_media_factory_new();
+        GstRTSPMediaFactory* factory = gst_rtsp_media_factory_new();
         gst_rtsp_media_factory_set_transport_mode(
-            blackScreenFactory, GST_RTSP_TRANSPORT_MODE_PLAY);
-        gst_rtsp_media_factory_set_launch(blackScreenFactory,
-            "( videotestsrc pattern=black ! "
-            "x264enc ! video/x-h264, profile=baseline ! "
-            "rtph264pay name=pay0 pt=96 config-interval=-1 )");
-        gst_rtsp_media_factory_set_shared(blackScreenFactory, TRUE);
-        gst_rtsp_mount_points_add_factory(mountPoints, BLACK, blackScreenFactory);
+            factory, GST_RTSP_TRANSPORT_MODE_PLAY);
+        if(cache) {
+            gst_rtsp_media_factory_set_launch(factory,
+                "( appsrc name=src ! identity sync=true ! "
+                "rtph264pay name=pay0 pt=96 config-interval=-1 )");
+            g_signal_connect(
+                factory, "media-configure",
+                G_CALLBACK(onStaticMediaConfigure), cache);
+        } else {
+            const std::string launch =
+                fmt::format(
+                    "( videotestsrc pattern={} ! "
+                    "{} ! "
+                    "rtph264pay name=pay0 pt=96 config-interval=-1 )",
+                    pattern, H264EncoderDescription(30));
+            gst_rtsp_media_factory_set_launch(factory, launch.c_str());
+        }
+        gst_rtsp_media_factory_set_shared(factory, TRUE);
+        gst_rtsp_mount_points_add_factory(mountPoints, path, factory);
     }
+}
 
-    {
-        GstRTSPMediaFactory* redScreenFactory = gst_rtsp_media_factory_new();
-        gst_rtsp_media_factory_set_transport_mode(
-            redScreenFactory, GST_RTSP_TRANSPORT_MODE_PLAY);
-        gst_rtsp_media_factory_set_launch(redScreenFactory,
-            "( videotestsrc pattern=red ! "
-            "x264enc ! video/x-h264, profile=baseline ! "
-            "rtph264pay name=pay0 pt=96 config-interval=-1 )");
-        gst_rtsp_media_factory_set_shared(redScreenFactory, TRUE);
-        gst_rtsp_mount_points_add_factory(mountPoints, RED, redScreenFactory);
-    }
+void Server::initSplashSource()
+{
+    auto cacheIt = _p->splashCaches.find(BLUE);
+    const SplashCache* cache =
+        _p->splashCaches.end() == cacheIt ? nullptr : &cacheIt->second;
+
+    const std::string pipeline =
+        cache ?
+            "appsrc name=src ! identity sync=true ! "
+            "interpipesink name=" SPLASH_INTERPIPE " sync=true allow-negotiation=false" :
+            "videotestsrc pattern=blue is-live=true ! " +
+            H264EncoderDescription(30) + " ! "
+            "h264parse config-interval=-1 ! "
+            "interpipesink name=" SPLASH_INTERPIPE " sync=true allow-negotiation=false";
+
+    GError* error = nullptr;
+    GstElement* element = gst_parse_launch(pipeline.c_str(), &error);
+    GErrorPtr errorPtr(error);
+
+    if(element)
+        _p->splashPipeline.reset(GST_ELEMENT(gst_object_ref_sink(element)));
+
+    if(errorPtr)
+        Log()->critical(
+            "Fail to create splash pipeline: {}",
+            errorPtr->message);
 
-    {
-        GstRTSPMediaFactory* greenScreenFactory = gst_rtsp_media_factory_new();
-        gst_rtsp_media_factory_set_transport_mode(
-            greenScreenFactory, GST_RTSP_TRANSPORT_MODE_PLAY);
-        gst_rtsp_media_factory_set_launch(greenScreenFactory,
-            "( videotestsrc pattern=green ! "
-            "x264enc ! video/x-h264, profile=baseline ! "
-            "rtph264pay name=pay0 pt=96 config-interval=-1 )");
-        gst_rtsp_media_factory_set_shared(greenScreenFactory, TRUE);
-        gst_rtsp_mount_points_add_factory(mountPoints, GREEN, greenScreenFactory);
+    if(!_p->splashPipeline)
+        return;
+
+    if(cache) {
+        GstElementPtr appSrcPtr(
+            gst_bin_get_by_name(GST_BIN(_p->splashPipeline.get()), "src"));
+        cache->attach(appSrcPtr.get());
     }
 
+    if(GST_STATE_CHANGE_FAILURE ==
+       gst_element_set_state(_p->splashPipeline.get(), GST_STATE_PLAYING))
     {
-        GstRTSPMediaFactory* blueScreenFactory = gst_rtsp_media_factory_new();
-        gst_rtsp_media_factory_set_transport_mode(
-            blueScreenFactory, GST_RTSP_TRANSPORT_MODE_PLAY);
-        gst_rtsp_media_factory_set_launch(blueScreenFactory,
-            "( videotestsrc pattern=blue ! "
-            "x264enc ! video/x-h264, profile=baseline ! "
-            "rtph264pay name=pay0 pt=96 config-interval=-1 )");
-        gst_rtsp_media_factory_set_shared(blueScreenFactory, TRUE);
-        gst_rtsp_mount_points_add_factory(mountPoints, BLUE, blueScreenFactory);
+        Log()->critical("Fail to start splash pipeline");
     }
 }
 
-void Server::initRestreamServer(bool useTls)
+void Server::initRestreamServer(
+    bool useTls,
+    const ThreadPoolOptions& threadPoolOptions,
+    const SourceOptions& sourceOptions,
+    const GopCacheOptions& gopCacheOptions,
+    const AuthCacheOptions& authCacheOptions,
+    const MulticastOptions& multicastOptions,
+    const TransportOptions& transportOptions,
+    const ClusterOptions& clusterOptions,
+    const MediaPoolOptions& mediaPoolOptions,
+    const ArchiveOptions& archiveOptions,
+    const HlsOptions& hlsOptions,
+    const MemoryOptions& memoryOptions)
 {
+    _p->transport = transportOptions;
+
     _p->restreamServer.reset(gst_rtsp_server_new());
 
-    const AuthCallbacks authCallbacks {
+    rtp_relay_register();
+
+    GstRTSPThreadPool* threadPool = gst_rtsp_thread_pool_new();
+    gst_rtsp_thread_pool_set_max_threads(
+        threadPool,
+        threadPoolOptions.threadPerClient ?
+            -1 : static_cast<gint>(threadPoolOptions.maxThreads));
+    gst_rtsp_server_set_thread_pool(_p->restreamServer.get(), threadPool);
+    g_object_unref(threadPool);
+
+    Log()->info(
+        "RTSP restream server client threads: {}",
+        threadPoolOptions.threadPerClient ?
+            std::string("per client") :
+            std::to_string(threadPoolOptions.maxThreads));
+
+    AuthCallbacks authCallbacks {
         .tlsAuthenticate = _p->callbacks.tlsAuthenticate,
         .authenticationRequired = _p->callbacks.authenticationRequired,
         .authenticate = _p->callbacks.authenticate,
-        .authorize = _p->callbacks.authorize };
-    _p->auth.reset(GST_RTSP_AUTH(rtsp_auth_new(authCallbacks, useTls)));
+        .authorize = _p->callbacks.authorize,
+        .authenticateAsync = _p->callbacks.authenticateAsync,
+        .authorizeAsync = _p->callbacks.authorizeAsync };
+    if(ClusterMode::REDIRECT == clusterOptions.mode && _p->callbacks.pathOwner) {
+        Private* p = _p.get();
+        authCallbacks.redirect =
+            [p] (const std::string& path) -> std::string {
+                {
+                    std::lock_guard<std::mutex> lock(p->registry->mutex());
+                    if(p->isRecording(path.c_str()))
+                        return std::string();
+                }
+
+                const std::string owner = p->callbacks.pathOwner(path);
+                return owner.empty() ? owner : owner + path;
+            };
+    }
+
+    if(authCacheOptions.ttlMs > 0) {
+        _p->authCache =
+            std::make_shared<AuthCache>(
+                std::max<size_t>(authCacheOptions.maxEntries, 1),
+                authCacheOptions.ttlMs);
+    }
+    _p->auth.reset(GST_RTSP_AUTH(rtsp_auth_new(authCallbacks, useTls, _p->authCache, _p->metrics)));
 
     _p->anonymousToken.reset(
         gst_rtsp_token_new(
@@ -606,24 +1280,97 @@ void Server::initRestreamServer(bool useTls)
             NULL));
 
     MountPointsCallbacks mountPointsCallbacks;
-    if(authCallbacks.authorize) {
+    if(authCallbacks.authorize || authCallbacks.authorizeAsync) {
+        const std::shared_ptr<AuthCache> authCache = _p->authCache;
+        const auto authorize = _p->callbacks.authorize;
         mountPointsCallbacks.authorizeAccess =
-            std::bind(
-                _p->callbacks.authorize,
-                std::placeholders::_1,
-                Action::ACCESS,
-                std::placeholders::_2,
-                std::placeholders::_3);
-    };
+            [authCache, authorize] (const std::string& user, const std::string& path, bool record) {
+                bool result = false;
+                if(authCache && authCache->findAuthorization(user, Action::ACCESS, path, record, &result))
+                    return result;
+
+                if(!authorize) {
+                    // async access decision is checked by auth before path is requested,
+                    // i.e. only allowed requests get here
+                    return true;
+                }
+
+                result = authorize(user, Action::ACCESS, path, record);
+                if(authCache)
+                    authCache->storeAuthorization(user, Action::ACCESS, path, record, result);
+
+                return result;
+            };
+    }
+    mountPointsCallbacks.rtpRelay = _p->callbacks.rtpRelay;
+    mountPointsCallbacks.multicast = _p->callbacks.multicast;
+    mountPointsCallbacks.archive = _p->callbacks.archive;
+    mountPointsCallbacks.hls = _p->callbacks.hls;
+    mountPointsCallbacks.latencyProfile = _p->callbacks.latencyProfile;
+
+    if(hlsOptions.port && _p->callbacks.hls)
+        _p->hlsServer = std::make_shared<HlsServer>(hlsOptions);
+    if(ClusterMode::RELAY == clusterOptions.mode && _p->callbacks.pathOwner) {
+        const auto pathOwner = _p->callbacks.pathOwner;
+        mountPointsCallbacks.remoteSource =
+            [pathOwner] (const std::string& path) -> std::string {
+                const std::string owner = pathOwner(path);
+                return owner.empty() ? owner : owner + path;
+            };
+    }
+
+    GstRTSPAddressPool* multicastPool = nullptr;
+    if(_p->callbacks.multicast) {
+        multicastPool = gst_rtsp_address_pool_new();
+        if(!gst_rtsp_address_pool_add_range(
+            multicastPool,
+            multicastOptions.minAddress.c_str(),
+            multicastOptions.maxAddress.c_str(),
+            multicastOptions.minPort,
+            multicastOptions.maxPort,
+            multicastOptions.ttl))
+        {
+            Log()->critical(
+                "Invalid multicast address range: {} - {}",
+                multicastOptions.minAddress, multicastOptions.maxAddress);
+            g_object_unref(multicastPool);
+            multicastPool = nullptr;
+        }
+    }
+
+    _p->sourceWatchdog =
+        std::make_shared<SourceWatchdog>(
+            sourceOptions.timeoutMs,
+            sourceOptions.checkPeriodMs);
 
     _p->mountPoints.reset(
         GST_RTSP_MOUNT_POINTS(
             rtsp_mount_points_new(
                 mountPointsCallbacks,
-                fmt::format("rtsp://localhost:{}/blue", _p->staticPort).c_str(),
+                _p->splash.mode,
+                SplashMode::INTERPIPE == _p->splash.mode ?
+                    std::string(SPLASH_INTERPIPE) :
+                    fmt::format("rtsp://localhost:{}/blue", _p->staticPort),
+                _p->sourceWatchdog,
+                _p->registry,
+                _p->metrics,
+                _p->hlsServer,
+                gopCacheOptions.enabled ?
+                    std::make_shared<GopCacheLimits>(
+                        gopCacheOptions.maxPathBytes,
+                        gopCacheOptions.maxTotalBytes) :
+                    nullptr,
+                multicastPool,
+                transportOptions,
+                mediaPoolOptions,
+                archiveOptions,
+                memoryOptions,
                 _p->maxPathsCount,
                 _p->maxClientsPerPath)));
 
+    if(multicastPool)
+        g_object_unref(multicastPool);
+
     GstRTSPServer* server = _p->restreamServer.get();
     GstRTSPAuth* auth = _p->auth.get();
     GstRTSPMountPoints* mountPoints = _p->mountPoints.get();
@@ -652,6 +1399,16 @@ void Server::initRestreamServer(bool useTls)
         (GCallback) clientConnectedCallback, _p.get());
 }
 
+std::string Server::metrics() const
+{
+    return _p->metrics->prometheus();
+}
+
+std::string Server::chromeTrace() const
+{
+    return _p->metrics->chromeTrace();
+}
+
 void Server::serverMain()
 {
     GstRTSPServer* staticServer = _p->staticServer.get();
@@ -666,19 +1423,114 @@ void Server::serverMain()
         return;
     }
 
-    GMainLoop* loop = g_main_loop_new(nullptr, FALSE);
-
-    gst_rtsp_server_attach(staticServer, nullptr);
-    gst_rtsp_server_attach(restreamServer, nullptr);
+    const ListenOptions& listen = _p->listen;
+    if(!Listen(staticServer, listen.staticFd, 0, listen.reusePort, &_p->staticListener) ||
+       !Listen(restreamServer, listen.restreamFd, 0, listen.reusePort, &_p->restreamListener) ||
+       (listen.directPort &&
+        !Listen(restreamServer, -1, listen.directPort, false, &_p->directListener)))
+    {
+        StopListening(&_p->staticListener);
+        StopListening(&_p->restreamListener);
+        return;
+    }
 
     Log()->info(
         "RTSP static server running on port {}",
-        gst_rtsp_server_get_bound_port(staticServer));
+        ListeningPort(_p->staticListener.socket));
     Log()->info(
         "RTSP restream server running on port {}",
-        gst_rtsp_server_get_bound_port(restreamServer));
+        ListeningPort(_p->restreamListener.socket));
+    if(_p->directListener.socket) {
+        Log()->info(
+            "RTSP restream server direct port {}",
+            ListeningPort(_p->directListener.socket));
+    }
+
+    if(_p->hlsServer)
+        _p->hlsServer->start();
+
+    _p->loop = g_main_loop_new(nullptr, FALSE);
+    g_main_loop_run(_p->loop);
+    g_main_loop_unref(_p->loop);
+    _p->loop = nullptr;
+}
+
+void Server::drain(const DrainOptions& options)
+{
+    if(_p->draining)
+        return;
+
+    Log()->info(
+        "Draining. redirect: \"{}\", timeout: {}ms",
+        options.redirectUrl, options.timeoutMs);
+
+    _p->draining = true;
+    _p->drainOptions = options;
+    _p->drainStartTime = g_get_monotonic_time();
+
+    // sockets handed over keep accepting in other instance
+    StopListening(&_p->staticListener);
+    StopListening(&_p->restreamListener);
+    StopListening(&_p->directListener);
+
+    _p->redirectPlayers();
+
+    _p->drainTimer = g_timeout_add(DRAIN_CHECK_PERIOD_MS, Private::onDrainTimer, _p.get());
+}
+
+ListenOptions Server::listenSockets() const
+{
+    ListenOptions sockets;
+    if(_p->staticListener.socket)
+        sockets.staticFd = g_socket_get_fd(_p->staticListener.socket);
+    if(_p->restreamListener.socket)
+        sockets.restreamFd = g_socket_get_fd(_p->restreamListener.socket);
+
+    return sockets;
+}
+
+void Server::reconfigure(const RuntimeOptions& options)
+{
+    _p->maxPathsCount = options.maxPathsCount;
+    _p->maxClientsPerPath = options.maxClientsPerPath;
+    {
+        std::lock_guard<std::mutex> lock(_p->registry->mutex());
+        _p->bandwidth = options.bandwidth;
+        _p->transport = options.transport;
+    }
+
+    if(_p->sourceWatchdog) {
+        _p->sourceWatchdog->setTimeout(options.source.timeoutMs);
+        _p->sourceWatchdog->setCheckPeriod(options.source.checkPeriodMs);
+    }
+
+    if(_p->mountPoints) {
+        rtsp_mount_points_reconfigure(
+            _RTSP_MOUNT_POINTS(_p->mountPoints.get()),
+            options.transport,
+            options.maxPathsCount,
+            options.maxClientsPerPath);
+    }
+
+    Log()->info(
+        "Server reconfigured. maxPaths: {}, maxClientsPerPath: {}, "
+        "sourceTimeout: {}ms, sourceCheckPeriod: {}ms, batchUdp: {}, "
+        "egressBudget: {}kbps, ingressBudget: {}kbps",
+        options.maxPathsCount, options.maxClientsPerPath,
+        options.source.timeoutMs, options.source.checkPeriodMs,
+        options.transport.batchUdp,
+        options.bandwidth.egressBudgetKbps, options.bandwidth.ingressBudgetKbps);
+}
+
+void Server::refreshPaths()
+{
+    if(!_p->mountPoints)
+        return;
 
-    g_main_loop_run(loop);
+    const std::vector<std::string> replaced =
+        rtsp_mount_points_refresh_paths(_RTSP_MOUNT_POINTS(_p->mountPoints.get()));
+    for(const std::string& path: replaced)
+        _p->disconnectPlayers(path);
 }
 
 void Server::setTlsCertificate(GTlsCertificate* certificate)
@@ -5,12 +5,14 @@
 #include <gst/rtsp/gstrtspdefs.h>
 
 #include "Action.h"
+#include "Options.h"
 #include "Log.h"
 
 
 namespace RestreamServerLib
 {
 
+// callbacks could be called from different threads
 struct Callbacks
 {
     std::function<bool (GTlsCertificate* peerCert, std::string* user)> tlsAuthenticate;
@@ -18,6 +20,40 @@ struct Callbacks
     std::function<bool (const std::string& user, const std::string& pass)> authenticate;
     std::function<bool (const std::string& user, Action, const std::string& path, bool record)> authorize;
 
+    // asynchronous variants of authenticate/authorize, used instead of them if set.
+    // request is suspended until completion is called (once, from any thread).
+    // require GStreamer 1.14
+    typedef std::function<void (bool result)> AuthCompletion;
+    std::function<void (const std::string& user, const std::string& pass, const AuthCompletion&)> authenticateAsync;
+    std::function<void (const std::string& user, Action, const std::string& path, bool record, const AuthCompletion&)> authorizeAsync;
+
+    // if returns true, path is relayed on RTP level, without splash screen.
+    // players can't connect to such path until recorder is connected.
+    std::function<bool (const std::string& path)> rtpRelay;
+
+    // if returns true, path is offered to players as RTP multicast only,
+    // so every packet is sent once for all players.
+    // multicast players are not limited by maxClientsPerPath
+    std::function<bool (const std::string& path)> multicast;
+
+    // cluster mode: base url (f.e. "rtsp://node2:8001") of node owning path (i.e. having it's recorder),
+    // or empty string if path is owned by this node or is not owned at all.
+    // ownership could be published from recorderConnected/recorderDisconnected.
+    // re-resolved when recorder of path connects to or disconnects from this node
+    // and on Server::refreshPaths, players of path are disconnected if it's source changed
+    std::function<std::string (const std::string& path)> pathOwner;
+
+    // directory to write segments of recorded path to (see ArchiveOptions),
+    // or empty string to not archive path
+    std::function<std::string (const std::string& path)> archive;
+
+    // if returns true, path is also served as HLS (see HlsOptions).
+    // HLS viewers are not authenticated
+    std::function<bool (const std::string& path)> hls;
+
+    // applied to path when it's mount point is created
+    std::function<LatencyProfile (const std::string& path)> latencyProfile;
+
     std::function<void (const std::string& user, const std::string& path)> firstPlayerConnected;
     std::function<void (const std::string& path)> lastPlayerDisconnected;
     std::function<void (const std::string& user, const std::string& path)> recorderConnected;
@@ -33,18 +69,61 @@ public:
         unsigned short restreamPort,
         bool useTls = false,
         unsigned maxPathsCount = 0,
-        unsigned maxClientsPerPath = 0);
+        unsigned maxClientsPerPath = 0,
+        const Options& = Options());
     ~Server();
 
+    // returns after drain is finished
     void serverMain();
 
+    // stops accepting connections, disconnects players
+    // and waits recorders to leave, then makes serverMain return.
+    // Should be called from server's main loop
+    void drain(const DrainOptions&);
+
+    // fds of listening sockets (-1 if not listening),
+    // to be inherited by instance taking over connections.
+    // Sockets are closed on drain start
+    ListenOptions listenSockets() const;
+
+    // could be called from any thread.
+    // already mounted paths keep transport options they were mounted with
+    void reconfigure(const RuntimeOptions&);
+
+    // re-resolves Callbacks::pathOwner of mounted paths
+    // (f.e. after ownership was changed by other node).
+    // Should be called from server's main loop
+    void refreshPaths();
+
+    // metrics snapshot in Prometheus text exposition format.
+    // could be called from any thread
+    std::string metrics() const;
+
+    // last pipeline stage events in Chrome Trace Event Format
+    // (see TracingOptions), empty if not kept.
+    // could be called from any thread
+    std::string chromeTrace() const;
+
     void setTlsCertificate(GTlsCertificate*);
 
 private:
     static inline const std::shared_ptr<spdlog::logger>& Log();
 
     void initStaticServer();
-    void initRestreamServer(bool useTls);
+    void initSplashSource();
+    void initRestreamServer(
+        bool useTls,
+        const ThreadPoolOptions&,
+        const SourceOptions&,
+        const GopCacheOptions&,
+        const AuthCacheOptions&,
+        const MulticastOptions&,
+        const TransportOptions&,
+        const ClusterOptions&,
+        const MediaPoolOptions&,
+        const ArchiveOptions&,
+        const HlsOptions&,
+        const MemoryOptions&);
 
 private:
     struct Private;
@@ -0,0 +1,385 @@
+#include "ShardTable.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+static_assert(
+    ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+    "atomics in shared memory should be lock free");
+
+namespace
+{
+
+const uint64_t FREE_HASH = 0;
+const uint64_t TOMBSTONE_HASH = 1;
+
+// slot stays locked forever if worker crashed while changing it,
+// so it's skipped after this many attempts
+const unsigned SPIN_ATTEMPTS = 1000;
+
+size_t RoundUpToPowerOf2(size_t value)
+{
+    size_t result = 1;
+    while(result < value)
+        result <<= 1;
+
+    return result;
+}
+
+}
+
+ShardTable::ShardTable(unsigned capacity) :
+    _capacity(RoundUpToPowerOf2(std::max(capacity, 2u))),
+    _fd(-1),
+    _header(nullptr),
+    _slots(nullptr)
+{
+    // fd allows to map table in processes started after fork
+    _fd = memfd_create("restream-shard-table", MFD_CLOEXEC);
+    if(_fd < 0 || ftruncate(_fd, TableSize(_capacity)) != 0) {
+        Log()->critical("Fail to allocate shard table: {}", strerror(errno));
+        return;
+    }
+
+    // memfd is zero filled, i.e. all slots are free and generation is 0
+    map();
+}
+
+ShardTable::ShardTable(int fd, size_t capacity) :
+    _capacity(capacity),
+    _fd(fd),
+    _header(nullptr),
+    _slots(nullptr)
+{
+    map();
+}
+
+ShardTable::~ShardTable()
+{
+    if(_header)
+        munmap(_header, TableSize(_capacity));
+    if(_fd >= 0)
+        close(_fd);
+}
+
+std::unique_ptr<ShardTable> ShardTable::Inherit(int fd)
+{
+    struct stat fdStat;
+    if(fstat(fd, &fdStat) != 0) {
+        Log()->critical("Fail to inherit shard table: {}", strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+
+    const size_t size = static_cast<size_t>(fdStat.st_size);
+    const size_t capacity =
+        size > sizeof(Header) ? (size - sizeof(Header)) / sizeof(Slot) : 0;
+    if(capacity < 2 || TableSize(capacity) != size || RoundUpToPowerOf2(capacity) != capacity) {
+        Log()->critical("Inherited shard table has unexpected size: {}", size);
+        close(fd);
+        return nullptr;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    std::unique_ptr<ShardTable> table(new ShardTable(fd, capacity));
+    if(!table->valid())
+        return nullptr;
+
+    return table;
+}
+
+size_t ShardTable::TableSize(size_t capacity)
+{
+    return sizeof(Header) + capacity * sizeof(Slot);
+}
+
+bool ShardTable::map()
+{
+    void* memory =
+        mmap(
+            nullptr, TableSize(_capacity),
+            PROT_READ | PROT_WRITE, MAP_SHARED,
+            _fd, 0);
+    if(MAP_FAILED == memory) {
+        Log()->critical("Fail to map shard table: {}", strerror(errno));
+        return false;
+    }
+
+    // slots follow header
+    _header = static_cast<Header*>(memory);
+    _slots = reinterpret_cast<Slot*>(_header + 1);
+
+    return true;
+}
+
+void ShardTable::changed()
+{
+    _header->generation.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t ShardTable::generation() const
+{
+    if(!_header)
+        return 0;
+
+    return _header->generation.load(std::memory_order_acquire);
+}
+
+// FNV-1a
+uint64_t ShardTable::Hash(const std::string& path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(char c: path) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+
+    // FREE_HASH and TOMBSTONE_HASH mark unused slots
+    return hash > TOMBSTONE_HASH ? hash : hash + 2;
+}
+
+bool ShardTable::Lock(Slot* slot, uint32_t* sequence)
+{
+    for(unsigned attempt = 0; attempt < SPIN_ATTEMPTS; ++attempt) {
+        uint32_t current = slot->sequence.load(std::memory_order_relaxed);
+        if(!(current & 1) &&
+           slot->sequence.compare_exchange_weak(current, current + 1, std::memory_order_acquire))
+        {
+            // slot changes shouldn't be visible before sequence is odd
+            std::atomic_thread_fence(std::memory_order_release);
+            *sequence = current + 1;
+            return true;
+        }
+
+        sched_yield();
+    }
+
+    return false;
+}
+
+void ShardTable::Unlock(Slot* slot, uint32_t sequence)
+{
+    slot->sequence.store(sequence + 1, std::memory_order_release);
+}
+
+// path could be read while it's changed by other worker,
+// so result is valid only if slot sequence didn't change meanwhile
+bool ShardTable::Matches(const Slot& slot, uint64_t hash, const std::string& path)
+{
+    return
+        slot.hash.load(std::memory_order_relaxed) == hash &&
+        0 == strncmp(slot.path, path.c_str(), MAX_PATH_SIZE);
+}
+
+// should be called with slot locked
+void ShardTable::Release(Slot* slot)
+{
+    slot->owner.store(0, std::memory_order_relaxed);
+    slot->hash.store(TOMBSTONE_HASH, std::memory_order_relaxed);
+    slot->path[0] = '\0';
+}
+
+ShardTable::SlotState ShardTable::inspect(
+    const Slot& slot,
+    uint64_t hash,
+    const std::string& path,
+    uint32_t* owner) const
+{
+    for(unsigned attempt = 0; attempt < SPIN_ATTEMPTS; ++attempt) {
+        const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if(sequence & 1) {
+            sched_yield();
+            continue;
+        }
+
+        const uint64_t slotHash = slot.hash.load(std::memory_order_relaxed);
+        const bool matches = Matches(slot, hash, path);
+        const uint32_t slotOwner = slot.owner.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.sequence.load(std::memory_order_relaxed) != sequence)
+            continue;
+
+        if(FREE_HASH == slotHash)
+            return SlotState::FREE;
+        if(TOMBSTONE_HASH == slotHash)
+            return SlotState::TOMBSTONE;
+        if(!matches)
+            return SlotState::OTHER;
+
+        *owner = slotOwner;
+        return SlotState::MATCH;
+    }
+
+    return SlotState::OTHER;
+}
+
+bool ShardTable::setOwner(const std::string& path, unsigned worker)
+{
+    if(!_slots)
+        return false;
+
+    if(path.size() >= MAX_PATH_SIZE) {
+        Log()->error("Path is too long for shard table. path: {}", path);
+        return false;
+    }
+
+    const uint64_t hash = Hash(path);
+    const size_t mask = _capacity - 1;
+
+    // slot could be changed by other worker between lookup and lock,
+    // so lookup is repeated in that case
+    for(unsigned attempt = 0; attempt < SPIN_ATTEMPTS; ++attempt) {
+        Slot* vacant = nullptr;
+        Slot* matching = nullptr;
+        for(size_t i = 0; i < _capacity && !matching; ++i) {
+            Slot* slot = &_slots[(hash + i) & mask];
+
+            uint32_t owner;
+            const SlotState state = inspect(*slot, hash, path, &owner);
+            if(SlotState::MATCH == state)
+                matching = slot;
+            else if(SlotState::TOMBSTONE == state && !vacant)
+                vacant = slot;
+            else if(SlotState::FREE == state) {
+                if(!vacant)
+                    vacant = slot;
+                break;
+            }
+        }
+
+        Slot* slot = matching ? matching : vacant;
+        if(!slot) {
+            Log()->error("Shard table is full. path: {}", path);
+            return false;
+        }
+
+        uint32_t sequence;
+        if(!Lock(slot, &sequence))
+            continue;
+
+        const uint64_t slotHash = slot->hash.load(std::memory_order_relaxed);
+        if(matching ?
+               !Matches(*slot, hash, path) :
+               slotHash != FREE_HASH && slotHash != TOMBSTONE_HASH)
+        {
+            Unlock(slot, sequence);
+            continue;
+        }
+
+        if(!matching) {
+            memcpy(slot->path, path.c_str(), path.size() + 1);
+            slot->hash.store(hash, std::memory_order_relaxed);
+        }
+        const bool ownerChanged =
+            slot->owner.exchange(worker + 1, std::memory_order_relaxed) != worker + 1;
+
+        Unlock(slot, sequence);
+
+        if(ownerChanged)
+            changed();
+
+        return true;
+    }
+
+    Log()->error("Fail to update shard table. path: {}", path);
+
+    return false;
+}
+
+void ShardTable::resetOwner(const std::string& path, unsigned worker)
+{
+    if(!_slots)
+        return;
+
+    const uint64_t hash = Hash(path);
+    const size_t mask = _capacity - 1;
+
+    // path could be inserted twice by workers racing for it
+    for(size_t i = 0; i < _capacity; ++i) {
+        Slot* slot = &_slots[(hash + i) & mask];
+
+        uint32_t owner;
+        const SlotState state = inspect(*slot, hash, path, &owner);
+        if(SlotState::FREE == state)
+            return;
+        if(SlotState::MATCH != state || owner != worker + 1)
+            continue;
+
+        uint32_t sequence;
+        if(!Lock(slot, &sequence))
+            continue;
+
+        const bool released =
+            Matches(*slot, hash, path) &&
+            slot->owner.load(std::memory_order_relaxed) == worker + 1;
+        if(released)
+            Release(slot);
+
+        Unlock(slot, sequence);
+
+        if(released)
+            changed();
+    }
+}
+
+void ShardTable::resetWorker(unsigned worker)
+{
+    if(!_slots)
+        return;
+
+    for(size_t i = 0; i < _capacity; ++i) {
+        Slot* slot = &_slots[i];
+        if(slot->owner.load(std::memory_order_relaxed) != worker + 1)
+            continue;
+
+        uint32_t sequence;
+        if(!Lock(slot, &sequence))
+            continue;
+
+        const bool released = slot->owner.load(std::memory_order_relaxed) == worker + 1;
+        if(released)
+            Release(slot);
+
+        Unlock(slot, sequence);
+
+        if(released)
+            changed();
+    }
+}
+
+int ShardTable::owner(const std::string& path) const
+{
+    if(!_slots)
+        return -1;
+
+    const uint64_t hash = Hash(path);
+    const size_t mask = _capacity - 1;
+
+    for(size_t i = 0; i < _capacity; ++i) {
+        uint32_t owner;
+        const SlotState state = inspect(_slots[(hash + i) & mask], hash, path, &owner);
+        if(SlotState::FREE == state)
+            return -1;
+        if(SlotState::MATCH == state && owner != 0)
+            return static_cast<int>(owner) - 1;
+    }
+
+    return -1;
+}
+
+}
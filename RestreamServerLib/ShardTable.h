@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+namespace RestreamServerLib
+{
+
+// Path -> worker table shared by worker processes listening on the same port.
+// Lives in shared memory, so it should be created before workers are forked
+// and is inherited by them (or mapped from fd by workers started later).
+// Open addressing over 64 bit path hashes, slot keeps path itself to verify match.
+// Readers are lock free, writers lock single slot (seqlock).
+// Released slots are tombstoned and reused by later paths.
+class ShardTable
+{
+public:
+    // including terminating zero
+    static const size_t MAX_PATH_SIZE = 256;
+
+    explicit ShardTable(unsigned capacity);
+    ~ShardTable();
+
+    ShardTable(const ShardTable&) = delete;
+    ShardTable& operator = (const ShardTable&) = delete;
+
+    // maps table created by other process. takes fd ownership.
+    // returns nullptr on failure
+    static std::unique_ptr<ShardTable> Inherit(int fd);
+
+    // false if shared memory can't be allocated
+    bool valid() const { return _slots != nullptr; }
+
+    // to be passed to processes started later (close on exec)
+    int fd() const { return _fd; }
+
+    // returns false if table is full or path is too long
+    bool setOwner(const std::string& path, unsigned worker);
+    // path is released only if it's still owned by worker
+    void resetOwner(const std::string& path, unsigned worker);
+    // releases all paths owned by worker (i.e. crashed one)
+    void resetWorker(unsigned worker);
+    // returns -1 if path is not owned
+    int owner(const std::string& path) const;
+    // changed on every ownership change made by any worker,
+    // so workers could re-resolve owners of their paths
+    uint64_t generation() const;
+
+private:
+    struct Header
+    {
+        std::atomic<uint64_t> generation;
+    };
+
+    struct Slot
+    {
+        // odd while slot is being changed
+        std::atomic<uint32_t> sequence;
+        // worker + 1, 0 - not owned
+        std::atomic<uint32_t> owner;
+        // FREE_HASH - never used slot, TOMBSTONE_HASH - released one
+        std::atomic<uint64_t> hash;
+        char path[MAX_PATH_SIZE];
+    };
+
+    enum class SlotState {
+        FREE,
+        TOMBSTONE,
+        OTHER,
+        MATCH,
+    };
+
+    ShardTable(int fd, size_t capacity);
+
+    static uint64_t Hash(const std::string& path);
+
+    static bool Lock(Slot*, uint32_t* sequence);
+    static void Unlock(Slot*, uint32_t sequence);
+    static bool Matches(const Slot&, uint64_t hash, const std::string& path);
+    static void Release(Slot*);
+
+    static size_t TableSize(size_t capacity);
+    void changed();
+
+    // consistent snapshot of slot state (and owner of matching slot)
+    SlotState inspect(const Slot&, uint64_t hash, const std::string& path, uint32_t* owner) const;
+
+    bool map();
+
+private:
+    const size_t _capacity;
+    int _fd;
+    Header* _header;
+    Slot* _slots;
+};
+
+}
@@ -0,0 +1,87 @@
+#include "SourceWatchdog.h"
+
+#include <algorithm>
+
+
+namespace RestreamServerLib
+{
+
+SourceWatchdog::SourceWatchdog(unsigned timeoutMs, unsigned checkPeriodMs) :
+    _timeout(static_cast<gint64>(timeoutMs) * 1000),
+    _checkPeriodMs(checkPeriodMs ? checkPeriodMs : 1),
+    _checkSource(0)
+{
+    _checkSource = g_timeout_add(_checkPeriodMs, onCheck, this);
+}
+
+SourceWatchdog::~SourceWatchdog()
+{
+    std::lock_guard<std::mutex> lock(_checkSourceMutex);
+    g_source_remove(_checkSource);
+}
+
+std::shared_ptr<SourceWatchdog::Source>
+SourceWatchdog::watch(const Callback& callback)
+{
+    std::shared_ptr<Source> source(new Source(callback));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sources.push_back(source);
+
+    return source;
+}
+
+void SourceWatchdog::unwatch(const std::shared_ptr<Source>& source)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = std::find(_sources.begin(), _sources.end(), source);
+    if(it != _sources.end()) {
+        *it = _sources.back();
+        _sources.pop_back();
+    }
+}
+
+void SourceWatchdog::setTimeout(unsigned timeoutMs)
+{
+    _timeout.store(static_cast<gint64>(timeoutMs) * 1000);
+}
+
+void SourceWatchdog::setCheckPeriod(unsigned checkPeriodMs)
+{
+    if(!checkPeriodMs)
+        checkPeriodMs = 1;
+
+    std::lock_guard<std::mutex> lock(_checkSourceMutex);
+
+    if(checkPeriodMs == _checkPeriodMs)
+        return;
+
+    // timer is attached to default main context, so it's safe to do from any thread
+    g_source_remove(_checkSource);
+    _checkPeriodMs = checkPeriodMs;
+    _checkSource = g_timeout_add(_checkPeriodMs, onCheck, this);
+}
+
+gboolean SourceWatchdog::onCheck(gpointer userData)
+{
+    static_cast<SourceWatchdog*>(userData)->check();
+
+    return G_SOURCE_CONTINUE;
+}
+
+void SourceWatchdog::check()
+{
+    const gint64 now = g_get_monotonic_time();
+    const gint64 timeout = _timeout.load();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(const std::shared_ptr<Source>& source: _sources) {
+        const gint64 lastDataTime =
+            source->_lastDataTime.load(std::memory_order_relaxed);
+        source->_callback(now - lastDataTime > timeout);
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <glib.h>
+
+
+namespace RestreamServerLib
+{
+
+// Checks all watched sources for data timeout with single main context timer,
+// instead of timer per source.
+class SourceWatchdog
+{
+public:
+    // called from main context on every check
+    typedef std::function<void (bool timeout)> Callback;
+
+    class Source
+    {
+    public:
+        // cheap enough to be called from streaming thread on every buffer
+        void touch()
+            { _lastDataTime.store(g_get_monotonic_time(), std::memory_order_relaxed); }
+
+    private:
+        friend class SourceWatchdog;
+
+        Source(const Callback& callback) :
+            _callback(callback), _lastDataTime(0) {}
+
+        const Callback _callback;
+        std::atomic<gint64> _lastDataTime;
+    };
+
+    SourceWatchdog(unsigned timeoutMs, unsigned checkPeriodMs);
+    ~SourceWatchdog();
+
+    std::shared_ptr<Source> watch(const Callback&);
+    // guarantees callback will not be called after return
+    void unwatch(const std::shared_ptr<Source>&);
+
+    void setTimeout(unsigned timeoutMs);
+    void setCheckPeriod(unsigned checkPeriodMs);
+
+private:
+    static gboolean onCheck(gpointer userData);
+    void check();
+
+private:
+    std::atomic<gint64> _timeout;
+
+    std::mutex _mutex;
+    std::vector<std::shared_ptr<Source>> _sources;
+
+    std::mutex _checkSourceMutex;
+    guint _checkPeriodMs;
+    guint _checkSource;
+};
+
+}
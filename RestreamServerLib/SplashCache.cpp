@@ -0,0 +1,199 @@
+#include "SplashCache.h"
+
+#include <vector>
+
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+#include "H264Encoder.h"
+
+#define SPLASH_FRAMERATE 10
+#define PULL_TIMEOUT (5 * GST_SECOND)
+
+
+namespace RestreamServerLib
+{
+
+struct SplashCache::Frames
+{
+    ~Frames();
+
+    GstCaps* caps = nullptr;
+    std::vector<GstBuffer*> buffers;
+    GstClockTime duration = GST_SECOND / SPLASH_FRAMERATE;
+};
+
+SplashCache::Frames::~Frames()
+{
+    for(GstBuffer* buffer: buffers)
+        gst_buffer_unref(buffer);
+
+    if(caps)
+        gst_caps_unref(caps);
+}
+
+namespace
+{
+
+struct Replay
+{
+    std::shared_ptr<const SplashCache::Frames> frames;
+    size_t next = 0;
+    GstClockTime pts = GST_CLOCK_TIME_NONE;
+};
+
+void needData(GstAppSrc* appSrc, guint /*length*/, gpointer userData)
+{
+    Replay* replay = static_cast<Replay*>(userData);
+    const auto& buffers = replay->frames->buffers;
+
+    if(!GST_CLOCK_TIME_IS_VALID(replay->pts)) {
+        // start from current running time to not make sinks wait or drop
+        replay->pts = 0;
+        GstClockPtr clockPtr(gst_element_get_clock(GST_ELEMENT(appSrc)));
+        if(GstClock* clock = clockPtr.get()) {
+            const GstClockTime now = gst_clock_get_time(clock);
+            const GstClockTime baseTime = gst_element_get_base_time(GST_ELEMENT(appSrc));
+            if(now > baseTime)
+                replay->pts = now - baseTime;
+        }
+    }
+
+    // shallow copy: memory is shared with cached buffer
+    GstBuffer* buffer = gst_buffer_copy(buffers[replay->next]);
+    GST_BUFFER_PTS(buffer) = replay->pts;
+    GST_BUFFER_DTS(buffer) = replay->pts;
+    GST_BUFFER_DURATION(buffer) = replay->frames->duration;
+
+    replay->pts += replay->frames->duration;
+    replay->next = (replay->next + 1) % buffers.size();
+
+    gst_app_src_push_buffer(appSrc, buffer);
+}
+
+}
+
+bool SplashCache::encode(const std::string& pattern, unsigned framesCount)
+{
+    const std::string pipelineDesc =
+        fmt::format(
+            "videotestsrc pattern={} num-buffers={} ! "
+            "video/x-raw, framerate={}/1 ! "
+            "{} ! "
+            "h264parse config-interval=-1 ! "
+            "video/x-h264, stream-format=byte-stream, alignment=au ! "
+            "appsink name=sink sync=false",
+            pattern, framesCount ? framesCount : 1, SPLASH_FRAMERATE,
+            H264EncoderDescription(1));
+
+    return fill(pipelineDesc);
+}
+
+bool SplashCache::load(const std::string& fileName)
+{
+    GCharPtr escapedPtr(g_strescape(fileName.c_str(), nullptr));
+
+    const std::string pipelineDesc =
+        fmt::format(
+            "filesrc location=\"{}\" ! h264parse config-interval=-1 ! "
+            "video/x-h264, stream-format=byte-stream, alignment=au ! "
+            "appsink name=sink sync=false",
+            escapedPtr.get());
+
+    return fill(pipelineDesc);
+}
+
+bool SplashCache::fill(const std::string& pipelineDesc)
+{
+    GError* error = nullptr;
+    GstElement* element = gst_parse_launch(pipelineDesc.c_str(), &error);
+    GErrorPtr errorPtr(error);
+
+    if(errorPtr)
+        MediaLog()->critical(
+            "Fail to create splash cache pipeline: {}",
+            errorPtr->message);
+
+    if(!element)
+        return false;
+
+    GstElementPtr pipelinePtr(GST_ELEMENT(gst_object_ref_sink(element)));
+    GstElement* pipeline = pipelinePtr.get();
+
+    GstElementPtr sinkPtr(gst_bin_get_by_name(GST_BIN(pipeline), "sink"));
+    GstElement* sink = sinkPtr.get();
+    if(!sink) {
+        MediaLog()->critical("Splash cache pipeline doesn't have appsink");
+        return false;
+    }
+
+    std::shared_ptr<Frames> frames = std::make_shared<Frames>();
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    while(GstSample* sample =
+        gst_app_sink_try_pull_sample(GST_APP_SINK(sink), PULL_TIMEOUT))
+    {
+        if(!frames->caps) {
+            if(GstCaps* caps = gst_sample_get_caps(sample))
+                frames->caps = gst_caps_ref(caps);
+        }
+
+        if(GstBuffer* buffer = gst_sample_get_buffer(sample))
+            frames->buffers.push_back(gst_buffer_ref(buffer));
+
+        gst_sample_unref(sample);
+    }
+
+    const bool eos = gst_app_sink_is_eos(GST_APP_SINK(sink));
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    if(!eos || frames->buffers.empty() || !frames->caps) {
+        MediaLog()->critical("Fail to fill splash cache");
+        return false;
+    }
+
+    MediaLog()->debug(
+        "Splash cache filled. frames: {}",
+        frames->buffers.size());
+
+    _frames = frames;
+
+    return true;
+}
+
+bool SplashCache::empty() const
+{
+    return !_frames;
+}
+
+void SplashCache::attach(GstElement* appSrc) const
+{
+    if(!_frames)
+        return;
+
+    g_object_set(appSrc,
+        "format", GST_FORMAT_TIME,
+        "is-live", TRUE,
+        NULL);
+    gst_app_src_set_caps(GST_APP_SRC(appSrc), _frames->caps);
+
+    GstAppSrcCallbacks callbacks = {};
+    callbacks.need_data = needData;
+
+    Replay* replay = new Replay;
+    replay->frames = _frames;
+
+    gst_app_src_set_callbacks(
+        GST_APP_SRC(appSrc), &callbacks, replay,
+        [] (gpointer userData) {
+            delete static_cast<Replay*>(userData);
+        });
+}
+
+}
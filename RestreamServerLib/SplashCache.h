@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <gst/gst.h>
+
+
+namespace RestreamServerLib
+{
+
+// Keeps once encoded (or loaded) h264 access units in memory
+// and replays them endlessly with rewritten timestamps
+class SplashCache
+{
+public:
+    struct Frames;
+
+    // encodes framesCount IDR frames from videotestsrc with given pattern
+    bool encode(const std::string& pattern, unsigned framesCount = 1);
+    // loads frames from h264 elementary stream file
+    bool load(const std::string& fileName);
+
+    bool empty() const;
+
+    // makes appsrc replay cached frames until it's destroyed
+    void attach(GstElement* appSrc) const;
+
+private:
+    bool fill(const std::string& pipelineDesc);
+
+private:
+    std::shared_ptr<const Frames> _frames;
+};
+
+}
@@ -0,0 +1,167 @@
+#include "Tracing.h"
+
+#include "Log.h"
+
+
+namespace RestreamServerLib
+{
+
+namespace
+{
+
+std::string EscapeJson(const std::string& value)
+{
+    std::string escaped;
+    escaped.reserve(value.size());
+    for(char c: value) {
+        switch(c) {
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '"':
+                escaped += "\\\"";
+                break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20)
+                    escaped += fmt::format("\\u{:04x}", static_cast<unsigned>(c));
+                else
+                    escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+}
+
+const char* TraceStageName(TraceStage stage)
+{
+    switch(stage) {
+        case TraceStage::RECORD:
+            return "record";
+        case TraceStage::INTERPIPE:
+            return "interpipe";
+        case TraceStage::SELECTOR:
+            return "selector";
+        case TraceStage::PARSE:
+            return "parse";
+        case TraceStage::PAY:
+            return "pay";
+        case TraceStage::COUNT:
+            break;
+    }
+
+    return "unknown";
+}
+
+Tracer::Tracer(unsigned maxEvents) :
+    _maxEvents(maxEvents),
+    _slots(maxEvents ? new Slot[maxEvents] : nullptr),
+    _next(0),
+    _lastPathId(0)
+{
+}
+
+uint32_t Tracer::addPath(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    prunePaths();
+
+    const uint32_t pathId = ++_lastPathId;
+    _pathNames.emplace(pathId, path);
+
+    return pathId;
+}
+
+void Tracer::removePath(uint32_t pathId)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _removedPaths.push_back({ pathId, _next.load(std::memory_order_relaxed) });
+
+    prunePaths();
+}
+
+// events of removed path are overwritten after _maxEvents more events
+void Tracer::prunePaths()
+{
+    const uint64_t recorded = _next.load(std::memory_order_relaxed);
+    while(!_removedPaths.empty() &&
+          recorded - _removedPaths.front().recorded >= _maxEvents)
+    {
+        _pathNames.erase(_removedPaths.front().pathId);
+        _removedPaths.pop_front();
+    }
+}
+
+void Tracer::record(uint32_t pathId, TraceStage stage, gint64 startUs, gint64 durationUs)
+{
+    if(!_maxEvents)
+        return;
+
+    const uint64_t position = _next.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = _slots[position % _maxEvents];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.pathId.store(pathId, std::memory_order_relaxed);
+    slot.stage.store(static_cast<unsigned>(stage), std::memory_order_relaxed);
+    slot.startUs.store(startUs, std::memory_order_relaxed);
+    slot.durationUs.store(durationUs, std::memory_order_relaxed);
+
+    slot.sequence.store(position + 1, std::memory_order_release);
+}
+
+std::string Tracer::chromeTrace() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const uint64_t recorded = _next.load(std::memory_order_acquire);
+
+    std::string out = "{\"traceEvents\":[\n";
+
+    bool first = true;
+    auto separator =
+        [&out, &first] () {
+            if(!first)
+                out += ",\n";
+            first = false;
+        };
+
+    for(const auto& pair: _pathNames) {
+        separator();
+        out += fmt::format(
+            "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+            pair.first, EscapeJson(pair.second));
+    }
+
+    // oldest first. slots being written or already overwritten are skipped
+    const uint64_t begin = recorded > _maxEvents ? recorded - _maxEvents : 0;
+    for(uint64_t position = begin; position < recorded; ++position) {
+        const Slot& slot = _slots[position % _maxEvents];
+        if(slot.sequence.load(std::memory_order_acquire) != position + 1)
+            continue;
+
+        const uint32_t pathId = slot.pathId.load(std::memory_order_relaxed);
+        const unsigned stage = slot.stage.load(std::memory_order_relaxed);
+        const gint64 startUs = slot.startUs.load(std::memory_order_relaxed);
+        const gint64 durationUs = slot.durationUs.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.sequence.load(std::memory_order_relaxed) != position + 1)
+            continue;
+
+        separator();
+        out += fmt::format(
+            "{{\"name\":\"{}\",\"cat\":\"latency\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{}}}",
+            TraceStageName(static_cast<TraceStage>(stage)), pathId, startUs, durationUs);
+    }
+
+    out += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return out;
+}
+
+}
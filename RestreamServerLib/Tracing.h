@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <glib.h>
+
+
+namespace RestreamServerLib
+{
+
+// points of record and play pipelines latency is measured at
+enum class TraceStage {
+    // recorder's depayloader sink -> interpipesink (depay and parse)
+    RECORD,
+    // ingest -> play side interpipesrc
+    INTERPIPE,
+    // ingest -> splash screen input-selector output
+    SELECTOR,
+    // ingest -> play side parser output
+    PARSE,
+    // ingest -> payloader output
+    PAY,
+    COUNT
+};
+
+const char* TraceStageName(TraceStage);
+
+// Keeps last stage events to export them in Chrome Trace Event Format
+// (loadable by chrome://tracing and Perfetto UI).
+// Every path is shown as separate thread. Thread safe.
+class Tracer
+{
+public:
+    explicit Tracer(unsigned maxEvents);
+
+    // returns id to record path events with
+    uint32_t addPath(const std::string& path);
+    // path name is kept while ring has its events
+    void removePath(uint32_t pathId);
+
+    // lock free, called for every traced buffer
+    void record(uint32_t pathId, TraceStage, gint64 startUs, gint64 durationUs);
+
+    std::string chromeTrace() const;
+
+private:
+    // seqlock slot of ring buffer
+    struct Slot
+    {
+        // position of event in slot + 1, 0 while slot is written
+        std::atomic<uint64_t> sequence { 0 };
+        std::atomic<uint32_t> pathId { 0 };
+        std::atomic<unsigned> stage { 0 };
+        std::atomic<gint64> startUs { 0 };
+        std::atomic<gint64> durationUs { 0 };
+    };
+
+    struct RemovedPath
+    {
+        uint32_t pathId;
+        // events recorded before removal
+        uint64_t recorded;
+    };
+
+    // should be called with _mutex locked
+    void prunePaths();
+
+private:
+    const size_t _maxEvents;
+
+    std::unique_ptr<Slot[]> _slots;
+    // events ever recorded, next event position
+    std::atomic<uint64_t> _next;
+
+    mutable std::mutex _mutex;
+    uint32_t _lastPathId;
+    std::unordered_map<uint32_t, std::string> _pathNames;
+    std::deque<RemovedPath> _removedPaths;
+};
+
+}